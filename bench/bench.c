@@ -0,0 +1,411 @@
+// Lexer and parser throughput benchmark.
+//
+// Generates a synthetic Self source (or takes an existing one), then reports
+// lexing and parsing throughput along with the allocations the parser makes,
+// how long loading the parsed source from its cache takes instead, and how
+// long it takes to bring the AST up to date after a small edit, and how fast
+// the AST is dumped in each format. A second, deeply nested source shows
+// what parsing and dumping cost when nesting is tens of thousands deep.
+// Allocations are counted by wrapping malloc and friends at link time.
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "dump.h"
+#include "generate.h"
+#include "lexer.h"
+#include "measure.h"
+#include "parser.h"
+#include "symbol.h"
+
+// Lexes the whole file, returning the number of tokens.
+static long lex_file(const char *fname) {
+  struct Lexer lexer;
+  if (!lexer_init(&lexer, fname)) {
+    perror(fname);
+    exit(1);
+  }
+
+  long tokens = 0;
+  do {
+    lexer_lex(&lexer);
+    tokens++;
+  } while (lexer.current.type != TEOF);
+
+  lexer_deinit(&lexer);
+  return tokens;
+}
+
+// Parses the whole file, returning the number of top-level statements and
+// the size of the AST.
+static long parse_file(const char *fname, size_t *ast_size_out) {
+  struct Parser parser;
+  if (!parser_init(&parser, fname)) {
+    perror(fname);
+    exit(1);
+  }
+
+  if (!parser_parse(&parser)) {
+    fputs(parser.lexer.error, stderr);
+    exit(1);
+  }
+
+  long length = parser.ast.root.length;
+  *ast_size_out = ast_size(&parser.ast);
+  parser_deinit(&parser);
+  return length;
+}
+
+// Writes the AST cache of the file, keyed as if the source was at
+// cache_source so the cache goes there instead of next to the file.
+static void store_cache(const char *fname, const char *cache_source) {
+  struct Parser parser;
+  if (!parser_init(&parser, fname) || !parser_parse(&parser)) {
+    perror(fname);
+    exit(1);
+  }
+
+  uint64_t hash = cache_hash(parser.lexer.data, parser.lexer.size);
+  if (!cache_store(cache_source, hash, parser.lexer.size, &parser.ast)) {
+    perror(cache_source);
+    exit(1);
+  }
+  parser_deinit(&parser);
+}
+
+// Loads the file from its cache the way the loader does: the source still
+// has to be read and hashed to find out whether the cache is up to date.
+static void load_cache(const char *fname, const char *cache_source) {
+  struct Lexer lexer;
+  if (!lexer_init(&lexer, fname)) {
+    perror(fname);
+    exit(1);
+  }
+
+  struct Ast ast;
+  ast_init(&ast);
+  uint64_t hash = cache_hash(lexer.data, lexer.size);
+  if (!cache_load(cache_source, hash, lexer.size, &ast)) {
+    fputs("cache miss\n", stderr);
+    exit(1);
+  }
+
+  ast_deinit(&ast);
+  lexer_deinit(&lexer);
+}
+
+// Dumps the parsed file in the given format into the scratch file fd, best
+// of runs. Returns the time it took, with the size of the dump in *size.
+static double dump_file(const char *fname, enum DumpFormat format, int fd,
+                        int runs, off_t *size) {
+  struct Parser parser;
+  if (!parser_init(&parser, fname) || !parser_parse(&parser)) {
+    perror(fname);
+    exit(1);
+  }
+
+  double best = 1e9;
+  for (int i = 0; i < runs; i++) {
+    if (ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+      perror("dump");
+      exit(1);
+    }
+
+    double start = now();
+    if (!dump_ast(fd, format, &parser.ast, parser.ast.root)) {
+      perror("dump");
+      exit(1);
+    }
+    double elapsed = now() - start;
+    if (elapsed < best)
+      best = elapsed;
+  }
+
+  *size = lseek(fd, 0, SEEK_CUR);
+  parser_deinit(&parser);
+  return best;
+}
+
+// Inserts a space after every step-th opening parenthesis, one at a time,
+// updating the AST and undoing the edit each time. Returns the number of
+// edits, with the mean and the longest time they took in *mean and *max.
+static int edit_file(const char *fname, int step, double *mean, double *max) {
+  struct Parser parser;
+  if (!parser_init(&parser, fname) || !parser_parse(&parser)) {
+    perror(fname);
+    exit(1);
+  }
+
+  // The source can only be read in one piece before it is edited.
+  long *offsets = malloc((parser.lexer.size / step + 1) * sizeof(long));
+  int count = 0, parens = 0;
+  for (long offset = 0; offset < parser.lexer.size; offset++) {
+    if (parser.lexer.data[offset] == '(' && parens++ % step == 0)
+      offsets[count++] = offset;
+  }
+
+  int edits = 0;
+  double total = 0;
+  *max = 0;
+
+  for (int i = 0; i < count; i++) {
+    long offset = offsets[i];
+    double start = now();
+    bool ok = parser_edit(&parser, offset + 1, 0, " ", 1);
+    double elapsed = now() - start;
+    if (!ok || !parser_edit(&parser, offset + 1, 1, "", 0)) {
+      fputs(parser.lexer.error, stderr);
+      exit(1);
+    }
+
+    edits++;
+    total += elapsed;
+    if (elapsed > *max)
+      *max = elapsed;
+  }
+
+  free(offsets);
+  parser_deinit(&parser);
+  *mean = edits ? total / edits : 0;
+  return edits;
+}
+
+static void usage(void) {
+  puts("Usage: ./bench [options] [source]\n"
+       "\n"
+       "Benchmarks the given source, or a generated one if there is none.\n"
+       "\n"
+       "  --runs N              runs per measurement, the best one counts (5)\n"
+       "  --output FILE         keep the generated source in FILE\n"
+       "  --seed N              generator seed (1)\n"
+       "  --size N              generated size in KB (8192)\n"
+       "  --slots N             slots per object (8)\n"
+       "  --keyword-depth N     nesting of keyword messages (3)\n"
+       "  --annotation-depth N  nesting of annotation blocks (2)\n"
+       "  --comments N          chance of a comment before a slot, % (20)\n"
+       "  --numbers N           chance of a number literal, % (30)\n"
+       "  --nesting N           depth of the nested source (20000)");
+}
+
+int main(int argc, char **argv) {
+  struct GenerateOptions options = GENERATE_DEFAULT_OPTIONS;
+  int runs = 5;
+  const char *output = NULL;
+  int nesting = 20000;
+
+  static const struct option long_options[] = {
+      {"runs", required_argument, NULL, 'r'},
+      {"output", required_argument, NULL, 'o'},
+      {"seed", required_argument, NULL, 'S'},
+      {"size", required_argument, NULL, 's'},
+      {"slots", required_argument, NULL, 'l'},
+      {"keyword-depth", required_argument, NULL, 'k'},
+      {"annotation-depth", required_argument, NULL, 'a'},
+      {"comments", required_argument, NULL, 'c'},
+      {"numbers", required_argument, NULL, 'n'},
+      {"nesting", required_argument, NULL, 'N'},
+      {"help", no_argument, NULL, 'h'},
+      {0},
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'r':
+      runs = atoi(optarg);
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'S':
+      options.seed = strtoull(optarg, NULL, 10);
+      break;
+    case 's':
+      options.size = atol(optarg) * 1024;
+      break;
+    case 'l':
+      options.slots = atoi(optarg);
+      break;
+    case 'k':
+      options.keyword_depth = atoi(optarg);
+      break;
+    case 'a':
+      options.annotation_depth = atoi(optarg);
+      break;
+    case 'c':
+      options.comment_percent = atoi(optarg);
+      break;
+    case 'n':
+      options.number_percent = atoi(optarg);
+      break;
+    case 'N':
+      nesting = atoi(optarg);
+      break;
+    default:
+      usage();
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  // Get hold of the source.
+  char generated[] = "/tmp/mySelf-bench-XXXXXX";
+  const char *fname;
+  if (optind < argc) {
+    fname = argv[optind];
+  } else {
+    FILE *out;
+    if (output) {
+      fname = output;
+      out = fopen(output, "w");
+    } else {
+      int fd = mkstemp(generated);
+      fname = generated;
+      out = fd < 0 ? NULL : fdopen(fd, "w");
+    }
+
+    if (!out) {
+      perror(fname);
+      return 1;
+    }
+
+    generate_source(out, &options);
+    fclose(out);
+  }
+
+  symbol_table_init();
+
+  struct Lexer probe;
+  if (!lexer_init(&probe, fname)) {
+    perror(fname);
+    return 1;
+  }
+  double megabytes = probe.size / 1e6;
+  double kilobytes = probe.size / 1024.0;
+  lexer_deinit(&probe);
+
+  double lex_time = 1e9, parse_time = 1e9;
+  long tokens = 0, statements = 0;
+  long allocations = 0, allocated_bytes = 0;
+  size_t ast_bytes = 0;
+
+  for (int i = 0; i < runs; i++) {
+    double start = now();
+    tokens = lex_file(fname);
+    double elapsed = now() - start;
+    if (elapsed < lex_time)
+      lex_time = elapsed;
+  }
+
+  for (int i = 0; i < runs; i++) {
+    long allocations_before = g_allocations;
+    long bytes_before = g_allocated_bytes;
+
+    double start = now();
+    statements = parse_file(fname, &ast_bytes);
+    double elapsed = now() - start;
+    if (elapsed < parse_time)
+      parse_time = elapsed;
+
+    allocations = g_allocations - allocations_before;
+    allocated_bytes = g_allocated_bytes - bytes_before;
+  }
+
+  char cache_source[] = "/tmp/mySelf-bench-cache-XXXXXX";
+  int cache_fd = mkstemp(cache_source);
+  if (cache_fd < 0) {
+    perror(cache_source);
+    return 1;
+  }
+  close(cache_fd);
+  store_cache(fname, cache_source);
+
+  double cache_time = 1e9;
+  for (int i = 0; i < runs; i++) {
+    double start = now();
+    load_cache(fname, cache_source);
+    double elapsed = now() - start;
+    if (elapsed < cache_time)
+      cache_time = elapsed;
+  }
+
+  double edit_mean, edit_max;
+  int edits = edit_file(fname, 97, &edit_mean, &edit_max);
+
+  static const char *format_names[] = {"human", "json", "binary"};
+  double dump_time[3];
+  off_t dump_size[3];
+  char dump_file_name[] = "/tmp/mySelf-bench-dump-XXXXXX";
+  int dump_fd = mkstemp(dump_file_name);
+  if (dump_fd < 0) {
+    perror(dump_file_name);
+    return 1;
+  }
+  for (int i = 0; i < 3; i++)
+    dump_time[i] = dump_file(fname, (enum DumpFormat)i, dump_fd, runs,
+                             &dump_size[i]);
+
+  // The nested source, parsed and dumped as JSON.
+  char nested[] = "/tmp/mySelf-bench-nested-XXXXXX";
+  int nested_fd = mkstemp(nested);
+  FILE *nested_out = nested_fd < 0 ? NULL : fdopen(nested_fd, "w");
+  if (!nested_out) {
+    perror(nested);
+    return 1;
+  }
+  generate_nested(nested_out, nesting);
+  fclose(nested_out);
+
+  double nested_parse_time = 1e9;
+  for (int i = 0; i < runs; i++) {
+    size_t nested_ast_bytes;
+    double start = now();
+    parse_file(nested, &nested_ast_bytes);
+    double elapsed = now() - start;
+    if (elapsed < nested_parse_time)
+      nested_parse_time = elapsed;
+  }
+  off_t nested_dump_size;
+  double nested_dump_time =
+      dump_file(nested, DJson, dump_fd, runs, &nested_dump_size);
+  unlink(nested);
+
+  close(dump_fd);
+  unlink(dump_file_name);
+
+  char *cache_file;
+  if (asprintf(&cache_file, "%sc", cache_source) < 0)
+    abort();
+  unlink(cache_file);
+  unlink(cache_source);
+  free(cache_file);
+
+  printf("source: %s, %.2f MB, %ld tokens, %ld statements\n", fname, megabytes,
+         tokens, statements);
+  printf("lex:    %8.1f MB/s  %8.2f Mtokens/s\n", megabytes / lex_time,
+         tokens / lex_time / 1e6);
+  printf("parse:  %8.1f MB/s  %8.0f statements/s\n", megabytes / parse_time,
+         statements / parse_time);
+  printf("allocs: %8.1f per KB  %8.1f bytes per KB\n", allocations / kilobytes,
+         allocated_bytes / kilobytes);
+  printf("ast:    %8.1f bytes per KB\n", ast_bytes / kilobytes);
+  printf("cache:  %8.1f MB/s  %8.2f ms, parsing takes %.2f ms\n",
+         megabytes / cache_time, cache_time * 1e3, parse_time * 1e3);
+  printf("edit:   %8.3f ms mean  %8.3f ms max, over %d edits\n",
+         edit_mean * 1e3, edit_max * 1e3, edits);
+  for (int i = 0; i < 3; i++)
+    printf("dump:   %8.1f MB/s  %8.1f bytes per KB, %s\n",
+           megabytes / dump_time[i], dump_size[i] / kilobytes,
+           format_names[i]);
+  printf("nested: %8.2f ms parse  %8.2f ms JSON dump, %d deep\n",
+         nested_parse_time * 1e3, nested_dump_time * 1e3, nesting);
+
+  if (fname == generated)
+    unlink(generated);
+
+  return 0;
+}
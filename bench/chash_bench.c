@@ -0,0 +1,253 @@
+// Concurrent hashtable stress test and benchmark.
+//
+// Fills a CHashTable, then measures lookup throughput with 1, 2, 4, ... up to
+// --threads reader threads, next to a HashTable behind a mutex, which is how
+// shared tables were done before. Then it runs readers and writers together
+// for a while: writers keep replacing values and retire the old ones, and
+// readers check that whatever they find is the right value for its key.
+// Built with -fsanitize=address, that also checks that nothing is freed
+// while a reader can still see it.
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chash.h"
+#include "hash.h"
+#include "measure.h"
+
+struct Value {
+  int key;
+};
+
+static int g_keys;
+static char (*g_names)[16];
+
+static struct CHashTable g_table;
+static struct HashTable g_locked_table;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_bool g_stop;
+static atomic_long g_reads;
+static atomic_long g_writes;
+static atomic_long g_errors;
+
+// xorshift64, so that threads don't share the state of rand().
+static uint64_t next_random(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+struct Reader {
+  pthread_t thread;
+  uint64_t seed;
+  long lookups;
+  bool locked;
+};
+
+static void *read_keys(void *arg) {
+  struct Reader *reader = arg;
+  uint64_t state = reader->seed;
+  long found = 0;
+
+  for (long i = 0; i < reader->lookups; i++) {
+    char *name = g_names[next_random(&state) % g_keys];
+    struct Value *value;
+    if (reader->locked) {
+      pthread_mutex_lock(&g_lock);
+      value = hashtable_get(&g_locked_table, name);
+      pthread_mutex_unlock(&g_lock);
+    } else {
+      value = chash_get(&g_table, name);
+    }
+    found += value != NULL;
+  }
+
+  if (found != reader->lookups)
+    atomic_fetch_add(&g_errors, 1);
+  return NULL;
+}
+
+// Returns the lookups per second of threads readers together.
+static double measure_reads(int threads, long lookups, bool locked) {
+  struct Reader *readers = calloc(threads, sizeof(*readers));
+
+  double start = now();
+  for (int i = 0; i < threads; i++) {
+    readers[i] = (struct Reader){.seed = i + 1, .lookups = lookups,
+                                 .locked = locked};
+    pthread_create(&readers[i].thread, NULL, read_keys, &readers[i]);
+  }
+  for (int i = 0; i < threads; i++)
+    pthread_join(readers[i].thread, NULL);
+  double elapsed = now() - start;
+
+  free(readers);
+  return threads * lookups / elapsed;
+}
+
+static void *stress_read(void *arg) {
+  uint64_t state = (uintptr_t)arg;
+  long reads = 0;
+
+  while (!atomic_load(&g_stop)) {
+    int key = next_random(&state) % g_keys;
+    // Writers retire the values they replace, so they are only safe to look
+    // at while reading.
+    chash_read_begin();
+    struct Value *value = chash_get(&g_table, g_names[key]);
+    if (value && value->key != key)
+      atomic_fetch_add(&g_errors, 1);
+    chash_read_end();
+    reads++;
+  }
+
+  atomic_fetch_add(&g_reads, reads);
+  return NULL;
+}
+
+// Replaces values, and now and then removes a key, which a later write adds
+// back.
+static void *stress_write(void *arg) {
+  uint64_t state = (uintptr_t)arg;
+  long writes = 0;
+
+  while (!atomic_load(&g_stop)) {
+    uint64_t random = next_random(&state);
+    int key = random % g_keys;
+    void *old;
+    if (random >> 60 == 0) {
+      old = chash_remove(&g_table, g_names[key]);
+    } else {
+      struct Value *value = malloc(sizeof(*value));
+      value->key = key;
+      if (!chash_set(&g_table, g_names[key], value, &old)) {
+        free(value);
+        old = NULL;
+      }
+    }
+    if (old)
+      chash_retire(&g_table, old);
+    writes++;
+  }
+
+  atomic_fetch_add(&g_writes, writes);
+  return NULL;
+}
+
+static void usage(void) {
+  fputs("Usage: ./chash_bench [options]\n"
+        "\n"
+        "Measures concurrent hashtable lookups, then stress tests it.\n"
+        "\n"
+        "  --threads N   most reader threads, doubling from 1 (online CPUs)\n"
+        "  --keys N      keys in the table (100000)\n"
+        "  --lookups N   lookups per thread (2000000)\n"
+        "  --writers N   writer threads in the stress test (2)\n"
+        "  --seconds N   length of the stress test (2)\n",
+        stderr);
+}
+
+int main(int argc, char **argv) {
+  int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  long lookups = 2000000;
+  int writers = 2;
+  int seconds = 2;
+  g_keys = 100000;
+
+  static struct option long_options[] = {
+      {"threads", required_argument, NULL, 't'},
+      {"keys", required_argument, NULL, 'k'},
+      {"lookups", required_argument, NULL, 'l'},
+      {"writers", required_argument, NULL, 'w'},
+      {"seconds", required_argument, NULL, 's'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    case 'k':
+      g_keys = atoi(optarg);
+      break;
+    case 'l':
+      lookups = atol(optarg);
+      break;
+    case 'w':
+      writers = atoi(optarg);
+      break;
+    case 's':
+      seconds = atoi(optarg);
+      break;
+    default:
+      usage();
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (max_threads < 1 || g_keys < 1 || lookups < 1 || writers < 0) {
+    usage();
+    return 1;
+  }
+
+  g_names = malloc(g_keys * sizeof(*g_names));
+  chash_init(&g_table, 0, hash_string, hash_string_equal);
+  hashtable_init(&g_locked_table, 0, hash_string, hash_string_equal);
+  for (int i = 0; i < g_keys; i++) {
+    snprintf(g_names[i], sizeof(g_names[i]), "key%d", i);
+    struct Value *value = malloc(sizeof(*value));
+    value->key = i;
+    void *old;
+    chash_set(&g_table, g_names[i], value, &old);
+    hashtable_set(&g_locked_table, g_names[i], value);
+  }
+
+  printf("keys:   %d, %ld lookups per thread, %ld online CPUs\n", g_keys,
+         lookups, sysconf(_SC_NPROCESSORS_ONLN));
+  double single = 0;
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    double reads = measure_reads(threads, lookups, false);
+    double locked = measure_reads(threads, lookups, true);
+    if (threads == 1)
+      single = reads;
+    printf("reads:  %8.2f M/s  %5.2fx  %8.2f M/s with a mutex, %d threads\n",
+           reads / 1e6, reads / single, locked / 1e6, threads);
+  }
+
+  int readers = max_threads;
+  pthread_t *threads = malloc((readers + writers) * sizeof(pthread_t));
+  for (int i = 0; i < readers + writers; i++)
+    pthread_create(&threads[i], NULL, i < readers ? stress_read : stress_write,
+                   (void *)(uintptr_t)(i + 1));
+  sleep(seconds);
+  atomic_store(&g_stop, true);
+  for (int i = 0; i < readers + writers; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+
+  printf("stress: %8.2f M reads  %8.2f M writes, %d readers, %d writers\n",
+         atomic_load(&g_reads) / 1e6, atomic_load(&g_writes) / 1e6, readers,
+         writers);
+
+  long errors = atomic_load(&g_errors);
+  if (errors)
+    printf("errors: %ld\n", errors);
+
+  // The values which are still in the table. The retired ones go with it.
+  for (int i = 0; i < g_keys; i++)
+    free(chash_remove(&g_table, g_names[i]));
+  chash_deinit(&g_table);
+  hashtable_deinit(&g_locked_table);
+  free(g_names);
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,220 @@
+#include <stdbool.h>
+
+#include "generate.h"
+
+struct Generator {
+  FILE *out;
+  const struct GenerateOptions *options;
+
+  uint64_t state;
+  long written;
+  int indent;
+  int slot_counter;
+};
+
+static const char *words[] = {
+    "value",  "parent",     "size",   "printString", "copy",     "traits",
+    "lobby",  "collection", "first",  "last",        "isEmpty",  "name",
+    "x",      "y",          "origin", "corner",      "children", "owner",
+    "bounds", "color",      "next",   "count",       "key",      "sum",
+};
+#define WORD_COUNT (int)(sizeof(words) / sizeof(words[0]))
+
+static const char *keywords[] = {
+    "at",   "Put",  "with", "With",   "ifTrue", "IfFalse", "add",
+    "To",   "from", "By",   "insert", "Before", "copyTo",  "Size",
+};
+#define KEYWORD_COUNT (int)(sizeof(keywords) / sizeof(keywords[0]))
+
+// xorshift64*
+static uint64_t next_random(struct Generator *g) {
+  g->state ^= g->state >> 12;
+  g->state ^= g->state << 25;
+  g->state ^= g->state >> 27;
+  return g->state * 0x2545F4914F6CDD1DULL;
+}
+
+static int random_below(struct Generator *g, int n) {
+  return (int)(next_random(g) % (uint64_t)n);
+}
+
+static bool chance(struct Generator *g, int percent) {
+  return random_below(g, 100) < percent;
+}
+
+static void emit(struct Generator *g, const char *s) {
+  g->written += fprintf(g->out, "%s", s);
+}
+
+static void emit_indent(struct Generator *g) {
+  g->written += fprintf(g->out, "%*s", g->indent, "");
+}
+
+static void emit_word(struct Generator *g) {
+  emit(g, words[random_below(g, WORD_COUNT)]);
+}
+
+// Keywords alternate between lower and upper case ones, so that the parts of
+// a selector are recognized as belonging to the same message.
+static void emit_keyword(struct Generator *g, bool first) {
+  int i = random_below(g, KEYWORD_COUNT / 2) * 2 + (first ? 0 : 1);
+  g->written += fprintf(g->out, "%s:", keywords[i]);
+}
+
+static void emit_number(struct Generator *g) {
+  if (chance(g, 25)) {
+    g->written += fprintf(g->out, "%d.%d", random_below(g, 10000),
+                          random_below(g, 1000));
+  } else {
+    g->written += fprintf(g->out, "%d", random_below(g, 1000000));
+  }
+}
+
+static void emit_expr(struct Generator *g, int depth) {
+  if (depth > 0 && chance(g, 60)) {
+    // Keyword send. Nested sends are parenthesized so that their keywords
+    // don't get mixed with ours.
+    emit(g, "(");
+    emit_word(g);
+    int parts = 1 + random_below(g, 3);
+    for (int i = 0; i < parts; i++) {
+      emit(g, " ");
+      emit_keyword(g, i == 0);
+      emit(g, " ");
+      emit_expr(g, depth - 1);
+    }
+    emit(g, ")");
+    return;
+  }
+
+  if (chance(g, g->options->number_percent)) {
+    emit_number(g);
+    return;
+  }
+
+  // Receiver followed by some unary sends.
+  emit_word(g);
+  int unary = random_below(g, 3);
+  for (int i = 0; i < unary; i++) {
+    emit(g, " ");
+    emit_word(g);
+  }
+}
+
+static void emit_comment(struct Generator *g) {
+  emit_indent(g);
+  emit(g, "\"");
+  int length = 3 + random_below(g, 20);
+  for (int i = 0; i < length; i++) {
+    if (i > 0)
+      emit(g, i % 8 == 0 ? "\n " : " ");
+    emit_word(g);
+  }
+  emit(g, "\"\n");
+}
+
+static void emit_slot(struct Generator *g) {
+  if (chance(g, g->options->comment_percent))
+    emit_comment(g);
+
+  emit_indent(g);
+  int kind = random_below(g, 10);
+  if (kind == 0) {
+    // Keyword method with an argument per keyword.
+    int parts = 1 + random_below(g, 2);
+    for (int i = 0; i < parts; i++) {
+      emit_keyword(g, i == 0);
+      g->written += fprintf(g->out, " arg%d ", i);
+    }
+    emit(g, "= ( arg0 ");
+    emit_word(g);
+    emit(g, " ).\n");
+  } else {
+    g->written += fprintf(g->out, "%s%d", words[random_below(g, WORD_COUNT)],
+                          g->slot_counter++);
+    if (kind == 1)
+      emit(g, "*");
+    emit(g, kind == 2 ? " <- " : " = ");
+    emit_expr(g, g->options->keyword_depth);
+    emit(g, ".\n");
+  }
+}
+
+static void emit_slots(struct Generator *g, int depth, int count) {
+  if (depth > 0 && count > 1) {
+    // Wrap the slots in an annotation block.
+    emit_indent(g);
+    emit(g, "{ ");
+    if (chance(g, 50)) {
+      emit(g, "*'");
+      emit_word(g);
+      emit(g, "'. ");
+    }
+    emit(g, "'");
+    emit_word(g);
+    emit(g, " ");
+    emit_word(g);
+    emit(g, "'.\n");
+
+    g->indent += 2;
+    emit_slots(g, depth - 1, count);
+    g->indent -= 2;
+
+    emit_indent(g);
+    emit(g, "}\n");
+    return;
+  }
+
+  for (int i = 0; i < count; i++)
+    emit_slot(g);
+}
+
+long generate_source(FILE *out, const struct GenerateOptions *options) {
+  struct Generator g = {.out = out,
+                        .options = options,
+                        .state = options->seed * 0x9E3779B97F4A7C15ULL + 1,
+                        .written = 0,
+                        .indent = 0,
+                        .slot_counter = 0};
+
+  while (g.written < options->size) {
+    emit_word(&g);
+    emit(&g, " _AddSlots: (\n  |\n");
+    g.indent = 4;
+    emit_indent(&g);
+    emit(&g, "{} = '");
+    emit_word(&g);
+    emit(&g, "'.\n");
+    emit_slots(&g, options->annotation_depth, options->slots);
+    emit(&g, "  |\n).\n");
+  }
+
+  return g.written;
+}
+
+long generate_nested(FILE *out, int depth) {
+  long written = 0;
+
+  // Object literals in slot values.
+  for (int i = 0; i < depth; i++)
+    written += fprintf(out, "(| x%d = ", i % 10);
+  written += fprintf(out, "1");
+  for (int i = 0; i < depth; i++)
+    written += fprintf(out, " |)");
+  written += fprintf(out, ".\n");
+
+  // Parenthesized sub-expressions.
+  for (int i = 0; i < depth; i++)
+    written += fprintf(out, "(");
+  written += fprintf(out, "1 negate");
+  for (int i = 0; i < depth; i++)
+    written += fprintf(out, ")");
+  written += fprintf(out, ".\n");
+
+  // Keyword messages in the last argument of keyword messages.
+  for (int i = 0; i < depth; i++)
+    written += fprintf(out, "x at: 1 Put: ");
+  written += fprintf(out, "1.\n");
+
+  return written;
+}
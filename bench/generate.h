@@ -0,0 +1,41 @@
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Parameters for the synthetic Self source generator. The same options and
+// seed always produce the same source.
+struct GenerateOptions {
+  uint64_t seed;
+  // Approximate size of the output in bytes.
+  long size;
+
+  // Number of slots in each object literal.
+  int slots;
+  // How deeply keyword message sends are nested in slot values.
+  int keyword_depth;
+  // How deeply annotation blocks are nested in slot lists.
+  int annotation_depth;
+  // Chance of a comment before a slot, in percent.
+  int comment_percent;
+  // Chance of an expression leaf being a number literal, in percent.
+  int number_percent;
+};
+
+#define GENERATE_DEFAULT_OPTIONS                                               \
+  (struct GenerateOptions) {                                                   \
+    .seed = 1, .size = 8 << 20, .slots = 8, .keyword_depth = 3,                \
+    .annotation_depth = 2, .comment_percent = 20, .number_percent = 30         \
+  }
+
+// Writes a source of roughly options->size bytes to out. Returns the number
+// of bytes written.
+long generate_source(FILE *out, const struct GenerateOptions *options);
+
+// Writes a source which nests depth levels deep three ways: object literals
+// in slot values, parenthesized sub-expressions, and keyword messages in the
+// last argument of keyword messages. Returns the number of bytes written.
+long generate_nested(FILE *out, int depth);
+
+#endif /* GENERATE_H */
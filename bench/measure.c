@@ -0,0 +1,28 @@
+#include <stddef.h>
+
+#include "measure.h"
+
+long g_allocations;
+long g_allocated_bytes;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  g_allocations++;
+  g_allocated_bytes += size;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  g_allocations++;
+  g_allocated_bytes += count * size;
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  g_allocations++;
+  g_allocated_bytes += size;
+  return __real_realloc(ptr, size);
+}
@@ -0,0 +1,20 @@
+#ifndef MEASURE_H
+#define MEASURE_H
+
+#include <time.h>
+
+// What the benchmarks measure with. measure.c counts allocations by wrapping
+// malloc, calloc and realloc, so a benchmark which is built with it has to
+// be linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc.
+
+// Allocations so far, and the bytes they asked for.
+extern long g_allocations;
+extern long g_allocated_bytes;
+
+static inline double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#endif /* MEASURE_H */
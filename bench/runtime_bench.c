@@ -0,0 +1,351 @@
+// Message send benchmark.
+//
+// Builds chains of parents the way traits are used: each receiver inherits
+// foo from an object depth parents up, through objects with a few slots of
+// their own. Then it sends foo from one site in C to one receiver, which the
+// inline cache handles, and round-robin to several receivers with maps of
+// their own, which makes the site megamorphic, with and without the lookup
+// cache. Then it checks that the caches notice when a parent in the chains
+// changes. Last it runs arithmetic loops, on SmallIntegers and SmallFloats,
+// which shouldn't allocate, and on integers too big for 63 bits, which are
+// boxed. Every send's result is checked. Allocations are counted by wrapping
+// the allocator at link time.
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "measure.h"
+#include "object.h"
+#include "parser.h"
+#include "runtime.h"
+#include "symbol.h"
+
+// level0 holds foo, and leveln inherits from level(n-1). The receivers rdi
+// inherit from level(d-1), so foo is d parents up from them.
+static void write_source(FILE *out, int max_depth, int slots, int receivers) {
+  fputs("lobby _AddSlots: (| level0 = (| l* = lobby. foo = 0", out);
+  for (int s = 0; s < slots; s++)
+    fprintf(out, ". s0x%d = nil", s);
+  fputs(" |) |).\n", out);
+
+  for (int level = 1; level < max_depth; level++) {
+    fprintf(out, "lobby _AddSlots: (| level%d = (| p* = level%d", level,
+            level - 1);
+    for (int s = 0; s < slots; s++)
+      fprintf(out, ". s%dx%d = nil", level, s);
+    fputs(" |) |).\n", out);
+  }
+
+  for (int depth = 1; depth <= max_depth; depth++) {
+    for (int r = 0; r < receivers; r++)
+      fprintf(out,
+              "lobby _AddSlots: "
+              "(| r%dx%d = (| p* = level%d. x%d = nil |) |).\n",
+              depth, r, depth - 1, r);
+  }
+
+  // Loops without blocks: the comparison answers true or false, and true
+  // goes around again.
+  fputs("true _AddSlots: (| sumFrom: i To: n Into: sum = ( "
+        "((i _IntAdd: 1) _IntLT: n) sumFrom: (i _IntAdd: 1) To: n "
+        "Into: (sum _IntAdd: i) ) |).\n"
+        "false _AddSlots: (| sumFrom: i To: n Into: sum = ( sum ) |).\n"
+        "true _AddSlots: (| floatSumFrom: x To: y Into: sum = ( "
+        "((x _FloatAdd: 0.5) _FloatLT: y) floatSumFrom: (x _FloatAdd: 0.5) "
+        "To: y Into: (sum _FloatAdd: x) ) |).\n"
+        "false _AddSlots: (| floatSumFrom: x To: y Into: sum = ( sum ) |).\n",
+        out);
+}
+
+static Value global(struct Object *lobby, const char *name) {
+  int index = object_find_slot(lobby, symbol_intern_string(name));
+  if (index < 0) {
+    fprintf(stderr, "no %s in the lobby\n", name);
+    exit(1);
+  }
+  return object_slot(lobby, index).value;
+}
+
+// Whether the value is the number, boxed or not.
+static bool same_number(Value value, Value number) {
+  if (value_is_object(value) && value_is_object(number))
+    return object_box_bits(value_object(value)) ==
+           object_box_bits(value_object(number));
+  return value == number;
+}
+
+static void check_result(Value result, Value expected, const char *what) {
+  if (!same_number(result, expected)) {
+    fprintf(stderr, "%s answered the wrong value\n", what);
+    exit(1);
+  }
+}
+
+// Sends foo to receivers round-robin, and checks that it answers 0. Returns
+// the nanoseconds per send.
+static double measure(struct Runtime *rt, Value *receivers,
+                      int count, long sends, long *allocations) {
+  const struct Symbol *foo = symbol_intern_string("foo");
+  struct SendCache cache = {0};
+  Value expected = value_from_int(0);
+  long wrong = 0;
+
+  long start_allocations = g_allocations;
+  double start = now();
+  for (long i = 0; i < sends; i++) {
+    if (runtime_send(rt, &cache, receivers[i % count], foo, NULL, 0) !=
+        expected)
+      wrong++;
+  }
+  double elapsed = now() - start;
+
+  *allocations = g_allocations - start_allocations;
+  if (wrong) {
+    fprintf(stderr, "foo answered the wrong value %ld times\n", wrong);
+    exit(1);
+  }
+  return elapsed * 1e9 / sends;
+}
+
+// Sends foo to the receivers from a monomorphic site and from one which
+// sends to all of them, gives a parent halfway up their chains a foo of its
+// own, and sends again from the same sites. The inline caches and the lookup
+// cache have to notice that the answer changed.
+static void check_invalidation(struct Runtime *rt, struct Object *lobby,
+                               Value *receivers, int count, int depth) {
+  const struct Symbol *foo = symbol_intern_string("foo");
+  struct SendCache mono = {0}, mega = {0}, add = {0};
+
+  for (int i = 0; i < 2 * count; i++) {
+    check_result(runtime_send(rt, &mono, receivers[0], foo, NULL, 0),
+                 value_from_int(0), "foo");
+    check_result(runtime_send(rt, &mega, receivers[i % count], foo, NULL, 0),
+                 value_from_int(0), "foo");
+  }
+
+  char name[32];
+  snprintf(name, sizeof(name), "level%d", depth / 2);
+  struct Object *slots = object_create();
+  if (!slots || !object_add_slot(slots, (struct ObjectSlot){
+                                            .name = foo,
+                                            .value = value_from_int(1)})) {
+    fputs("out of memory\n", stderr);
+    exit(1);
+  }
+  Value arg = value_from_object(slots);
+  runtime_send(rt, &add, global(lobby, name),
+               symbol_intern_string("_AddSlots:"), &arg, 1);
+
+  for (int i = 0; i < 2 * count; i++) {
+    check_result(runtime_send(rt, &mono, receivers[0], foo, NULL, 0),
+                 value_from_int(1), "foo after its parent changed");
+    check_result(runtime_send(rt, &mega, receivers[i % count], foo, NULL, 0),
+                 value_from_int(1), "foo after its parent changed");
+  }
+  object_destroy(slots);
+}
+
+// Sends the selector with args to true, which runs a loop of length
+// iterations, until it has done at least iterations of them, and checks that
+// every loop answers expected. Returns the nanoseconds per iteration.
+static double measure_loop(struct Runtime *rt, const char *selector,
+                           Value *args, Value expected, long length,
+                           long iterations, long *allocations) {
+  const struct Symbol *symbol = symbol_intern_string(selector);
+  Value receiver = value_from_object(rt->true_object);
+  struct SendCache cache = {0};
+  long loops = (iterations + length - 1) / length;
+
+  long start_allocations = g_allocations;
+  double start = now();
+  for (long i = 0; i < loops; i++)
+    check_result(runtime_send(rt, &cache, receiver, symbol, args, 3),
+                 expected, selector);
+  double elapsed = now() - start;
+
+  *allocations = g_allocations - start_allocations;
+  return elapsed * 1e9 / (loops * length);
+}
+
+// Loops recurse once per iteration, so they have to be well inside
+// RUNTIME_MAX_DEPTH.
+#define LOOP_LENGTH 1000
+
+static Value float_value(double d) {
+  Value value;
+  if (!value_from_float(d, &value)) {
+    fprintf(stderr, "%g isn't a SmallFloat\n", d);
+    exit(1);
+  }
+  return value;
+}
+
+static void usage(void) {
+  fputs("Usage: ./runtime_bench [options]\n"
+        "\n"
+        "Measures sends through deep parent chains, and arithmetic.\n"
+        "\n"
+        "  --depth N      deepest chain of parents (10)\n"
+        "  --slots N      slots of each object in the chains (6)\n"
+        "  --receivers N  receivers of the megamorphic sends (8)\n"
+        "  --sends N      sends per measurement (5000000)\n"
+        "  --iterations N iterations of each arithmetic loop (5000000)\n",
+        stderr);
+}
+
+int main(int argc, char **argv) {
+  int max_depth = 10;
+  int slots = 6;
+  int receiver_count = 8;
+  long sends = 5000000;
+  long iterations = 5000000;
+
+  static struct option long_options[] = {
+      {"depth", required_argument, NULL, 'd'},
+      {"slots", required_argument, NULL, 's'},
+      {"receivers", required_argument, NULL, 'r'},
+      {"sends", required_argument, NULL, 'n'},
+      {"iterations", required_argument, NULL, 'i'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'd':
+      max_depth = atoi(optarg);
+      break;
+    case 's':
+      slots = atoi(optarg);
+      break;
+    case 'r':
+      receiver_count = atoi(optarg);
+      break;
+    case 'n':
+      sends = atol(optarg);
+      break;
+    case 'i':
+      iterations = atol(optarg);
+      break;
+    default:
+      usage();
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (max_depth < 1 || slots < 0 || receiver_count < 1 || sends < 1 ||
+      iterations < 1) {
+    usage();
+    return 1;
+  }
+
+  symbol_table_init();
+
+  char source[] = "/tmp/mySelf-runtime-bench-XXXXXX";
+  int fd = mkstemp(source);
+  FILE *out = fd >= 0 ? fdopen(fd, "w") : NULL;
+  if (!out) {
+    perror(source);
+    return 1;
+  }
+  write_source(out, max_depth, slots, receiver_count);
+  fclose(out);
+
+  struct Parser parser;
+  if (!parser_init(&parser, source) || !parser_parse(&parser)) {
+    fputs(parser.lexer.error ? parser.lexer.error : "parse failed\n", stderr);
+    unlink(source);
+    return 1;
+  }
+  unlink(source);
+
+  struct Ast *ast = &parser.ast;
+  struct Object *lobby = object_create();
+  struct Runtime rt;
+  if (!lobby || !runtime_init(&rt, ast, lobby, object_create())) {
+    fputs("out of memory\n", stderr);
+    return 1;
+  }
+  for (uint32_t i = 0; i < ast->root.length; i++) {
+    if (!execute(&rt, &ast->stmts[ast->root.start + i],
+                 value_from_object(lobby)))
+      return 1;
+  }
+
+  printf("sends:  %ld per measurement, %d slots per object, %d receivers\n",
+         sends, slots, receiver_count);
+  printf("depth  monomorphic  megamorphic  no lookup cache  allocations\n");
+
+  Value *receivers = malloc(receiver_count * sizeof(*receivers));
+  for (int depth = 1; depth <= max_depth; depth++) {
+    if (depth != 1 && depth % 5 != 0 && depth != max_depth)
+      continue;
+
+    char name[32];
+    for (int r = 0; r < receiver_count; r++) {
+      snprintf(name, sizeof(name), "r%dx%d", depth, r);
+      receivers[r] = global(lobby, name);
+    }
+
+    long allocations, total = 0;
+    rt.use_lookup_cache = true;
+    double mono = measure(&rt, receivers, 1, sends, &allocations);
+    total += allocations;
+    double mega = measure(&rt, receivers, receiver_count, sends, &allocations);
+    total += allocations;
+    rt.use_lookup_cache = false;
+    double uncached =
+        measure(&rt, receivers, receiver_count, sends, &allocations);
+    total += allocations;
+
+    printf("%5d  %8.2f ns  %8.2f ns  %12.2f ns  %11ld\n", depth, mono, mega,
+           uncached, total);
+  }
+
+  // The receivers are the ones of the deepest chains now.
+  rt.use_lookup_cache = true;
+  check_invalidation(&rt, lobby, receivers, receiver_count, max_depth);
+  free(receivers);
+
+  // The sums start at zero, or past the largest SmallInteger. The loops add
+  // up the numbers from 0 below LOOP_LENGTH, the floats in steps of a half.
+  int64_t sum = (int64_t)LOOP_LENGTH * (LOOP_LENGTH - 1) / 2;
+  struct Object *big = object_box(rt.integer_box, UINT64_C(1) << 62);
+  struct Object *big_sum =
+      object_box(rt.integer_box, (UINT64_C(1) << 62) + sum);
+  Value int_args[] = {value_from_int(0), value_from_int(LOOP_LENGTH),
+                      value_from_int(0)};
+  Value float_args[] = {float_value(0), float_value(LOOP_LENGTH * 0.5),
+                        float_value(0)};
+  Value boxed_args[] = {value_from_int(0), value_from_int(LOOP_LENGTH),
+                        value_from_object(big)};
+  struct {
+    const char *name;
+    const char *selector;
+    Value *args;
+    Value expected;
+  } loops[] = {{"SmallInteger", "sumFrom:To:Into:", int_args,
+                value_from_int(sum)},
+               {"SmallFloat", "floatSumFrom:To:Into:", float_args,
+                float_value(sum * 0.5)},
+               {"boxed integer", "sumFrom:To:Into:", boxed_args,
+                value_from_object(big_sum)}};
+
+  printf("\narithmetic:  %ld iterations per measurement, %d per loop\n",
+         iterations, LOOP_LENGTH);
+  printf("sums            per iteration  allocations\n");
+  for (size_t i = 0; i < sizeof(loops) / sizeof(*loops); i++) {
+    long allocations;
+    double ns = measure_loop(&rt, loops[i].selector, loops[i].args,
+                             loops[i].expected, LOOP_LENGTH, iterations,
+                             &allocations);
+    printf("%-14s  %10.2f ns  %11ld\n", loops[i].name, ns, allocations);
+  }
+
+  runtime_deinit(&rt);
+  parser_deinit(&parser);
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN(size)                                                     \
+  (((size) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1))
+
+void arena_init(struct Arena *arena) { arena->chunk = NULL; }
+
+void arena_deinit(struct Arena *arena) {
+  struct ArenaChunk *chunk = arena->chunk;
+  while (chunk) {
+    struct ArenaChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  arena->chunk = NULL;
+}
+
+static struct ArenaChunk *arena_new_chunk(struct Arena *arena, size_t size) {
+  size_t capacity = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+  struct ArenaChunk *chunk = malloc(sizeof(*chunk) + capacity);
+  if (!chunk)
+    abort();
+
+  chunk->used = 0;
+  chunk->capacity = capacity;
+
+  if (size > ARENA_CHUNK_SIZE && arena->chunk) {
+    // Oversized allocations get a chunk of their own. Keep allocating from
+    // the current chunk, since it probably still has room.
+    chunk->next = arena->chunk->next;
+    arena->chunk->next = chunk;
+  } else {
+    chunk->next = arena->chunk;
+    arena->chunk = chunk;
+  }
+
+  return chunk;
+}
+
+void *arena_alloc(struct Arena *arena, size_t size) {
+  size = ARENA_ALIGN(size);
+
+  struct ArenaChunk *chunk = arena->chunk;
+  if (!chunk || chunk->capacity - chunk->used < size)
+    chunk = arena_new_chunk(arena, size);
+
+  void *ptr = chunk->data + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+void *arena_calloc(struct Arena *arena, size_t count, size_t size) {
+  void *ptr = arena_alloc(arena, count * size);
+  memset(ptr, 0, count * size);
+  return ptr;
+}
+
+void *arena_grow(struct Arena *arena, void *ptr, size_t old_size,
+                 size_t new_size) {
+  if (!ptr)
+    return arena_alloc(arena, new_size);
+
+  struct ArenaChunk *chunk = arena->chunk;
+  old_size = ARENA_ALIGN(old_size);
+  new_size = ARENA_ALIGN(new_size);
+  if (new_size <= old_size)
+    return ptr;
+
+  // Oversized allocations have a chunk to themselves, which can simply be
+  // resized. This keeps big arrays from leaving a trail of copies behind.
+  if (old_size > ARENA_CHUNK_SIZE) {
+    struct ArenaChunk **link = &arena->chunk;
+    while ((*link)->data != ptr)
+      link = &(*link)->next;
+
+    struct ArenaChunk *resized = realloc(*link, sizeof(*resized) + new_size);
+    if (!resized)
+      abort();
+    resized->used = resized->capacity = new_size;
+    *link = resized;
+    return resized->data;
+  }
+
+  // Is this the last thing we allocated?
+  if ((char *)ptr + old_size == chunk->data + chunk->used &&
+      chunk->capacity - chunk->used >= new_size - old_size) {
+    chunk->used += new_size - old_size;
+    return ptr;
+  }
+
+  void *new_ptr = arena_alloc(arena, new_size);
+  memcpy(new_ptr, ptr, old_size);
+  return new_ptr;
+}
+
+void arena_merge(struct Arena *dst, struct Arena *src) {
+  if (!src->chunk)
+    return;
+
+  if (dst->chunk) {
+    // Put src's chunks behind dst's current chunk, so dst keeps allocating
+    // where it left off.
+    struct ArenaChunk *last = src->chunk;
+    while (last->next)
+      last = last->next;
+
+    last->next = dst->chunk->next;
+    dst->chunk->next = src->chunk;
+  } else {
+    dst->chunk = src->chunk;
+  }
+
+  src->chunk = NULL;
+}
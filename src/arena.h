@@ -0,0 +1,43 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+struct ArenaChunk {
+  struct ArenaChunk *next;
+  size_t used;
+  size_t capacity;
+  _Alignas(max_align_t) char data[];
+};
+
+// A bump-pointer allocator. Allocations are carved out of large chunks and
+// are never freed one by one; everything goes away at once in arena_deinit.
+// The parser puts every AST node in one, so a whole tree is contiguous and
+// is released with a single call.
+//
+// An arena isn't thread-safe. Each thread fills its own, and arena_merge
+// hands the contents over to another one afterwards.
+struct Arena {
+  // The chunk being allocated from. Older chunks follow it.
+  struct ArenaChunk *chunk;
+};
+
+void arena_init(struct Arena *arena);
+void arena_deinit(struct Arena *arena);
+
+// Returns memory suitably aligned for any object.
+void *arena_alloc(struct Arena *arena, size_t size);
+void *arena_calloc(struct Arena *arena, size_t count, size_t size);
+// Resizes an allocation like realloc. The most recent allocation grows in
+// place when there's room, and allocations bigger than a chunk are
+// reallocated. Anything else is copied and the old memory is wasted until
+// the arena is released.
+void *arena_grow(struct Arena *arena, void *ptr, size_t old_size,
+                 size_t new_size);
+
+// Moves all the memory of src into dst. src is left empty.
+void arena_merge(struct Arena *dst, struct Arena *src);
+
+#endif /* ARENA_H */
@@ -0,0 +1,494 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+
+void ast_init(struct Ast *ast) {
+  *ast = (struct Ast){0};
+  arena_init(&ast->arena);
+}
+
+void ast_deinit(struct Ast *ast) {
+  free(ast->leaves);
+  arena_deinit(&ast->arena);
+  *ast = (struct Ast){0};
+}
+
+// Makes room for extra more elements in one of the arrays, doubling its
+// capacity as needed.
+static void *ast_reserve(struct Ast *ast, void *array, uint32_t length,
+                         uint32_t *capacity, uint32_t extra, size_t size) {
+  if (length + extra <= *capacity)
+    return array;
+
+  uint32_t new_capacity = *capacity ? *capacity * 2 : 16;
+  while (new_capacity < length + extra)
+    new_capacity *= 2;
+
+  array = arena_grow(&ast->arena, array, *capacity * size,
+                     new_capacity * size);
+  *capacity = new_capacity;
+  return array;
+}
+
+#define AST_RESERVE(ast, name, singular, extra)                               \
+  ((ast)->name =                                                              \
+       ast_reserve((ast), (ast)->name, (ast)->singular##_count,               \
+                   &(ast)->singular##_capacity, (extra), sizeof(*(ast)->name)))
+
+// Returns false, and marks the AST full, if there are AST_MAX_EXPRS
+// expressions of a type already.
+static bool ast_room(struct Ast *ast, uint32_t count) {
+  if (count < AST_MAX_EXPRS)
+    return true;
+  ast->full = true;
+  return false;
+}
+
+ExprRef ast_add_message(struct Ast *ast, struct MessageExpr message) {
+  if (!ast_room(ast, ast->message_count))
+    return 0;
+  AST_RESERVE(ast, messages, message, 1);
+  ast->messages[ast->message_count] = message;
+  return EXPR_REF(EMessage, ast->message_count++);
+}
+
+// An identifier or number, as a key of the leaf table.
+struct Leaf {
+  enum ExprType type;
+  const struct Symbol *ident;
+  struct NumberExpr number;
+};
+
+static uint64_t leaf_hash(const struct Leaf *leaf) {
+  if (leaf->type == EIdent)
+    return leaf->ident->hash;
+
+  uint64_t bits;
+  memcpy(&bits, &leaf->number.integer, sizeof(bits));
+  return (bits ^ leaf->number.type) * 0x9E3779B97F4A7C15ULL;
+}
+
+// Returns the leaf ref points to, or a leaf of type ENone if the entry is
+// stale.
+static struct Leaf leaf_at(const struct Ast *ast, ExprRef ref) {
+  uint32_t index = EXPR_INDEX(ref);
+  if (EXPR_TYPE(ref) == EIdent && index < ast->ident_count)
+    return (struct Leaf){.type = EIdent, .ident = ast->idents[index].ident};
+  if (EXPR_TYPE(ref) == ENumber && index < ast->number_count)
+    return (struct Leaf){.type = ENumber, .number = ast->numbers[index]};
+  return (struct Leaf){.type = ENone};
+}
+
+static bool leaf_equal(const struct Leaf *a, const struct Leaf *b) {
+  if (a->type != b->type)
+    return false;
+  if (a->type == EIdent)
+    return a->ident == b->ident;
+  return a->number.type == b->number.type &&
+         memcmp(&a->number.integer, &b->number.integer,
+                sizeof(a->number.integer)) == 0;
+}
+
+// Returns the entry of the leaf table which holds the leaf, or the empty one
+// it should go in.
+static struct LeafEntry *leaf_entry(struct Ast *ast, const struct Leaf *leaf,
+                                    uint64_t hash) {
+  uint32_t mask = ast->leaf_capacity - 1;
+  uint32_t i = hash & mask;
+  uint32_t tag = hash >> 32;
+
+  for (;; i = (i + 1) & mask) {
+    struct LeafEntry *entry = &ast->leaves[i];
+    if (!entry->ref)
+      return entry;
+    if (entry->hash != tag)
+      continue;
+
+    struct Leaf other = leaf_at(ast, entry->ref);
+    if (leaf_equal(&other, leaf))
+      return entry;
+  }
+}
+
+// Keeps the leaf table at most half full, dropping stale entries when it
+// grows.
+static void leaves_reserve(struct Ast *ast) {
+  if (2 * (ast->leaf_count + 1) <= ast->leaf_capacity)
+    return;
+
+  struct LeafEntry *old = ast->leaves;
+  uint32_t old_capacity = ast->leaf_capacity;
+
+  ast->leaf_capacity = old_capacity ? old_capacity * 2 : 64;
+  ast->leaves = calloc(ast->leaf_capacity, sizeof(*ast->leaves));
+  if (!ast->leaves)
+    abort();
+  ast->leaf_count = 0;
+
+  for (uint32_t i = 0; i < old_capacity; i++) {
+    struct Leaf leaf = leaf_at(ast, old[i].ref);
+    if (leaf.type == ENone)
+      continue;
+
+    uint64_t hash = leaf_hash(&leaf);
+    struct LeafEntry *entry = leaf_entry(ast, &leaf, hash);
+    if (!entry->ref) {
+      *entry = (struct LeafEntry){.ref = old[i].ref, .hash = hash >> 32};
+      ast->leaf_count++;
+    }
+  }
+  free(old);
+}
+
+// Returns the node of the leaf, adding it if it isn't in the AST yet.
+static ExprRef ast_add_leaf(struct Ast *ast, const struct Leaf *leaf) {
+  leaves_reserve(ast);
+  uint64_t hash = leaf_hash(leaf);
+  struct LeafEntry *entry = leaf_entry(ast, leaf, hash);
+  if (entry->ref)
+    return entry->ref;
+  if (!ast_room(ast, leaf->type == EIdent ? ast->ident_count
+                                          : ast->number_count))
+    return 0;
+
+  if (leaf->type == EIdent) {
+    AST_RESERVE(ast, idents, ident, 1);
+    ast->idents[ast->ident_count] = (struct IdentExpr){.ident = leaf->ident};
+    entry->ref = EXPR_REF(EIdent, ast->ident_count++);
+  } else {
+    AST_RESERVE(ast, numbers, number, 1);
+    ast->numbers[ast->number_count] = leaf->number;
+    entry->ref = EXPR_REF(ENumber, ast->number_count++);
+  }
+  entry->hash = hash >> 32;
+  ast->leaf_count++;
+  return entry->ref;
+}
+
+ExprRef ast_add_ident(struct Ast *ast, const struct Symbol *ident) {
+  struct Leaf leaf = {.type = EIdent, .ident = ident};
+  return ast_add_leaf(ast, &leaf);
+}
+
+ExprRef ast_add_number(struct Ast *ast, struct NumberExpr number) {
+  struct Leaf leaf = {.type = ENumber, .number = number};
+  return ast_add_leaf(ast, &leaf);
+}
+
+ExprRef ast_add_object(struct Ast *ast, struct ObjectExpr object) {
+  if (!ast_room(ast, ast->object_count))
+    return 0;
+  AST_RESERVE(ast, objects, object, 1);
+  ast->objects[ast->object_count] = object;
+  return EXPR_REF(EObject, ast->object_count++);
+}
+
+uint32_t ast_add_annotation(struct Ast *ast, struct Annotation annotation) {
+  if (ast->annotation_count > 0) {
+    struct Annotation *last = &ast->annotations[ast->annotation_count - 1];
+    if (last->category == annotation.category &&
+        last->comment == annotation.comment &&
+        last->module == annotation.module)
+      return ast->annotation_count - 1;
+  }
+
+  AST_RESERVE(ast, annotations, annotation, 1);
+  ast->annotations[ast->annotation_count] = annotation;
+  return ast->annotation_count++;
+}
+
+uint32_t ast_add_slots(struct Ast *ast, const struct Slot *slots,
+                       uint32_t length) {
+  if (length == 0)
+    return ast->slot_count;
+
+  AST_RESERVE(ast, slots, slot, length);
+  memcpy(ast->slots + ast->slot_count, slots, length * sizeof(*slots));
+  ast->slot_count += length;
+  return ast->slot_count - length;
+}
+
+uint32_t ast_add_stmts(struct Ast *ast, const struct Stmt *stmts,
+                       uint32_t length) {
+  if (length == 0)
+    return ast->stmt_count;
+
+  AST_RESERVE(ast, stmts, stmt, length);
+  memcpy(ast->stmts + ast->stmt_count, stmts, length * sizeof(*stmts));
+  ast->stmt_count += length;
+  return ast->stmt_count - length;
+}
+
+uint32_t ast_add_args(struct Ast *ast, const ExprRef *args, uint32_t length) {
+  if (length == 0)
+    return ast->arg_count;
+
+  AST_RESERVE(ast, args, arg, length);
+  memcpy(ast->args + ast->arg_count, args, length * sizeof(*args));
+  ast->arg_count += length;
+  return ast->arg_count - length;
+}
+
+struct AstMark ast_mark(const struct Ast *ast) {
+  return (struct AstMark){.messages = ast->message_count,
+                          .idents = ast->ident_count,
+                          .numbers = ast->number_count,
+                          .objects = ast->object_count,
+                          .slots = ast->slot_count,
+                          .stmts = ast->stmt_count,
+                          .args = ast->arg_count,
+                          .annotations = ast->annotation_count};
+}
+
+void ast_rollback(struct Ast *ast, struct AstMark mark) {
+  ast->message_count = mark.messages;
+  ast->ident_count = mark.idents;
+  ast->number_count = mark.numbers;
+  ast->object_count = mark.objects;
+  ast->slot_count = mark.slots;
+  ast->stmt_count = mark.stmts;
+  ast->arg_count = mark.args;
+  ast->annotation_count = mark.annotations;
+  ast->full = false;
+}
+
+// Where each type of expression from the appended AST starts in the
+// destination. Identifiers and numbers are hash-consed into the ones already
+// there, so they are mapped one by one.
+struct AstBase {
+  uint32_t exprs[EObject + 1];
+  uint32_t slots, stmts, args, annotations;
+  ExprRef *idents, *numbers;
+};
+
+static ExprRef relocate_expr(const struct AstBase *base, ExprRef ref) {
+  switch (EXPR_TYPE(ref)) {
+  case EIdent:
+    return base->idents[EXPR_INDEX(ref)];
+  case ENumber:
+    return base->numbers[EXPR_INDEX(ref)];
+  default:
+    return ref + base->exprs[EXPR_TYPE(ref)];
+  }
+}
+
+static uint32_t relocate_annotation(const struct AstBase *base,
+                                    uint32_t annotation) {
+  return annotation == AST_NONE ? AST_NONE : annotation + base->annotations;
+}
+
+bool ast_append(struct Ast *dst, const struct Ast *src, struct StmtList *root) {
+  if (src->message_count > AST_MAX_EXPRS - dst->message_count ||
+      src->ident_count > AST_MAX_EXPRS - dst->ident_count ||
+      src->number_count > AST_MAX_EXPRS - dst->number_count ||
+      src->object_count > AST_MAX_EXPRS - dst->object_count)
+    return false;
+
+  struct AstBase base = {
+      .exprs = {[EMessage] = dst->message_count,
+                [EObject] = dst->object_count},
+      .slots = dst->slot_count,
+      .stmts = dst->stmt_count,
+      .args = dst->arg_count,
+      .annotations = dst->annotation_count,
+      .idents = malloc(src->ident_count * sizeof(ExprRef)),
+      .numbers = malloc(src->number_count * sizeof(ExprRef)),
+  };
+
+  // These have to be mapped before anything refers to them.
+  for (uint32_t i = 0; i < src->ident_count; i++)
+    base.idents[i] = ast_add_ident(dst, src->idents[i].ident);
+  for (uint32_t i = 0; i < src->number_count; i++)
+    base.numbers[i] = ast_add_number(dst, src->numbers[i]);
+
+  AST_RESERVE(dst, messages, message, src->message_count);
+  for (uint32_t i = 0; i < src->message_count; i++) {
+    struct MessageExpr message = src->messages[i];
+    message.receiver = relocate_expr(&base, message.receiver);
+    message.args += base.args;
+    dst->messages[dst->message_count++] = message;
+  }
+
+  AST_RESERVE(dst, objects, object, src->object_count);
+  for (uint32_t i = 0; i < src->object_count; i++) {
+    struct ObjectExpr object = src->objects[i];
+    object.slots.start += base.slots;
+    object.stmts.start += base.stmts;
+    object.annotation = relocate_annotation(&base, object.annotation);
+    dst->objects[dst->object_count++] = object;
+  }
+
+  AST_RESERVE(dst, slots, slot, src->slot_count);
+  for (uint32_t i = 0; i < src->slot_count; i++) {
+    struct Slot slot = src->slots[i];
+    slot.value = relocate_expr(&base, slot.value);
+    slot.annotation = relocate_annotation(&base, slot.annotation);
+    dst->slots[dst->slot_count++] = slot;
+  }
+
+  AST_RESERVE(dst, stmts, stmt, src->stmt_count);
+  for (uint32_t i = 0; i < src->stmt_count; i++) {
+    struct Stmt stmt = {.expr = relocate_expr(&base, src->stmts[i].expr),
+                        .span = src->stmts[i].span};
+    dst->stmts[dst->stmt_count++] = stmt;
+  }
+
+  AST_RESERVE(dst, args, arg, src->arg_count);
+  for (uint32_t i = 0; i < src->arg_count; i++)
+    dst->args[dst->arg_count++] = relocate_expr(&base, src->args[i]);
+
+  if (src->annotation_count > 0) {
+    AST_RESERVE(dst, annotations, annotation, src->annotation_count);
+    memcpy(dst->annotations + dst->annotation_count, src->annotations,
+           src->annotation_count * sizeof(*src->annotations));
+    dst->annotation_count += src->annotation_count;
+  }
+
+  free(base.idents);
+  free(base.numbers);
+  *root = (struct StmtList){.start = src->root.start + base.stmts,
+                            .length = src->root.length};
+  return true;
+}
+
+size_t ast_size(const struct Ast *ast) {
+  return ast->message_count * sizeof(*ast->messages) +
+         ast->ident_count * sizeof(*ast->idents) +
+         ast->number_count * sizeof(*ast->numbers) +
+         ast->object_count * sizeof(*ast->objects) +
+         ast->slot_count * sizeof(*ast->slots) +
+         ast->stmt_count * sizeof(*ast->stmts) +
+         ast->arg_count * sizeof(*ast->args) +
+         ast->annotation_count * sizeof(*ast->annotations);
+}
+
+void ast_walk_init(struct AstWalk *walk, const struct Ast *ast) {
+  walk->ast = ast;
+  walk->start = AST_NONE;
+  vec_init(&walk->stack);
+}
+
+void ast_walk_deinit(struct AstWalk *walk) { vec_deinit(&walk->stack); }
+
+static void walk_stmts(struct AstWalk *walk, struct StmtList stmts,
+                       uint32_t offset) {
+  vec_push(&walk->stack, ((struct AstWalkFrame){.expr = AST_NONE,
+                                                .start = stmts.start,
+                                                .length = stmts.length,
+                                                .offset = offset}));
+}
+
+void ast_walk_stmts(struct AstWalk *walk, struct StmtList stmts) {
+  walk_stmts(walk, stmts, 0);
+}
+
+void ast_walk_expr(struct AstWalk *walk, ExprRef expr) { walk->start = expr; }
+
+// Steps to the expression, which is part of the current frame and in the
+// statement or slot at offset. Only messages and objects have more steps, so
+// only they get a frame.
+static void walk_into(struct AstWalk *walk, ExprRef expr, enum AstRole role,
+                      uint32_t offset) {
+  walk->step = WExpr;
+  walk->expr = expr;
+  walk->role = role;
+
+  if (EXPR_TYPE(expr) == EMessage) {
+    struct MessageExpr *message = ast_message(walk->ast, expr);
+    vec_push(&walk->stack, ((struct AstWalkFrame){.expr = expr,
+                                                  .start = message->args,
+                                                  .length = message->length,
+                                                  .offset = offset}));
+  } else if (EXPR_TYPE(expr) == EObject) {
+    struct ObjectExpr *object = ast_object(walk->ast, expr);
+    uint32_t start = offset + object->span.offset;
+    walk->object_span = (struct SourceSpan){start, object->span.length};
+    struct AstWalkFrame frame = {.expr = expr,
+                                 .start = object->slots.start,
+                                 .length = object->slots.length,
+                                 .offset = start,
+                                 .base = start};
+    vec_push(&walk->stack, frame);
+  }
+}
+
+// Messages take a step for the receiver, one after it and one for each
+// argument. Objects take one for each slot and one after them, and then
+// their statement list follows.
+bool ast_walk_next(struct AstWalk *walk) {
+  if (walk->start != AST_NONE) {
+    walk_into(walk, walk->start, RNone, 0);
+    walk->start = AST_NONE;
+    return true;
+  }
+  if (!walk->stack.length)
+    return false;
+
+  const struct Ast *ast = walk->ast;
+  // The frame can move once walk_into pushes another one, so it isn't used
+  // after that.
+  struct AstWalkFrame *frame = &vec_last(&walk->stack);
+  uint32_t step = frame->steps++;
+  ExprRef expr = frame->expr;
+
+  walk->parent = expr;
+  if (expr == AST_NONE) {
+    walk->stmts = (struct StmtList){frame->start, frame->length};
+    walk->index = step - 1;
+    if (step == 0) {
+      walk->step = WStmts;
+    } else if (walk->index < frame->length) {
+      const struct Stmt *stmt = &ast->stmts[frame->start + walk->index];
+      frame->offset += stmt->span.offset;
+      walk->span = (struct SourceSpan){frame->offset, stmt->span.length};
+      walk_into(walk, stmt->expr, RStmt, frame->offset);
+    } else {
+      walk->step = WStmtsEnd;
+      walk->stack.length--;
+    }
+  } else if (EXPR_TYPE(expr) == EMessage) {
+    walk->index = step - 2;
+    if (step == 0) {
+      walk_into(walk, ast_message(ast, expr)->receiver, RReceiver,
+                frame->offset);
+    } else if (step == 1) {
+      walk->step = WReceiverEnd;
+      walk->expr = expr;
+    } else if (walk->index < frame->length) {
+      walk_into(walk, ast->args[frame->start + walk->index], RArg,
+                frame->offset);
+    } else {
+      walk->step = WExprEnd;
+      walk->expr = expr;
+      walk->stack.length--;
+    }
+  } else {
+    walk->index = step;
+    if (walk->index < frame->length) {
+      // Argument slots aren't in the chain of the others.
+      const struct Slot *slot = &ast->slots[frame->start + walk->index];
+      uint32_t offset =
+          (slot->arg_index ? frame->base : frame->offset) + slot->span.offset;
+      if (!slot->arg_index)
+        frame->offset = offset;
+      walk->span = (struct SourceSpan){offset, slot->span.length};
+      walk_into(walk, slot->value, RSlot, offset);
+    } else if (walk->index == frame->length) {
+      walk->step = WSlotsEnd;
+      walk->expr = expr;
+      walk_stmts(walk, ast_object(ast, expr)->stmts, frame->base);
+    } else {
+      walk->step = WExprEnd;
+      walk->expr = expr;
+      walk->stack.length--;
+    }
+  }
+  return true;
+}
+
+void ast_walk_skip(struct AstWalk *walk) {
+  enum ExprType type = EXPR_TYPE(walk->expr);
+  if (walk->step == WExpr && (type == EMessage || type == EObject))
+    walk->stack.length--;
+}
@@ -0,0 +1,327 @@
+#ifndef AST_H
+#define AST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "symbol.h"
+#include "vec.h"
+
+// The AST is stored flat. Every kind of node sits in its own array in
+// struct Ast, and nodes refer to each other by 32-bit indices into those
+// arrays instead of by pointer. Lists (slots, statements, message arguments)
+// are contiguous ranges of their array, so walking a list, or all the nodes
+// of one kind, is a linear scan.
+//
+// Identifiers and numbers can't change once they are added, so they are
+// hash-consed: adding one which is already in the AST returns the existing
+// node. There is a single nil, self, true and false node per AST, and every
+// occurrence of the same literal or name is the same node.
+
+enum ExprType {
+  ENone,    // No expression (invalid)
+  EMessage, // Message sending expression
+  EIdent,   // Identifier expression
+  ENumber,  // Number expression (integer or floating point)
+  EBinary,  // Binary expression
+  EObject,  // Object expression (activation record)
+};
+
+// A reference to an expression: its type in the top bits and its index in
+// the array for that type in the rest.
+typedef uint32_t ExprRef;
+
+#define EXPR_INDEX_BITS 29
+#define EXPR_REF(type, index) (((uint32_t)(type) << EXPR_INDEX_BITS) | (index))
+#define EXPR_TYPE(ref) ((enum ExprType)((ref) >> EXPR_INDEX_BITS))
+#define EXPR_INDEX(ref) ((ref) & ((UINT32_C(1) << EXPR_INDEX_BITS) - 1))
+
+// The most expressions of one type an AST can hold, since that's as far as
+// the index of a ref goes.
+#define AST_MAX_EXPRS (UINT32_C(1) << EXPR_INDEX_BITS)
+
+// The index of an absent annotation.
+#define AST_NONE UINT32_MAX
+
+// A range of bytes in the source a node was parsed from. The offset is from
+// where the node it is relative to starts, see below, so that an edit only
+// moves the spans around it and the next one after each of them, and not
+// everything after it in the source. It can wrap around, for spans before
+// the node they are relative to. AstWalk works out where spans are in the
+// source.
+struct SourceSpan {
+  uint32_t offset;
+  uint32_t length;
+};
+
+struct MessageExpr {
+  const struct Symbol *message;
+  ExprRef receiver;
+
+  // The arguments are args[args, args + length) in the AST.
+  uint32_t args;
+  uint32_t length;
+};
+
+struct IdentExpr {
+  const struct Symbol *ident;
+};
+
+enum NumberType {
+  NNone,    // Invalid
+  NInteger, // Integer
+  NFloat,   // Floating-point
+};
+
+struct NumberExpr {
+  enum NumberType type;
+  union {
+    long integer;
+    double flt;
+  };
+};
+
+enum AnnotationType { ACategory, AComment, AModule };
+
+// Annotation carries metadata for a particular slot or object.
+struct Annotation {
+  const struct Symbol *category;
+  const struct Symbol *comment;
+  const struct Symbol *module;
+};
+
+struct Slot {
+  const struct Symbol *name;
+  ExprRef value;
+  // Index in the annotations of the AST, or AST_NONE.
+  uint32_t annotation;
+  // From the name to the end of the value, relative to the previous slot of
+  // the object, or the object for the first one. The span of an argument
+  // slot is its name in the selector, relative to the object.
+  struct SourceSpan span;
+
+  // If this is non-zero, then it is the index in the arguments list this slot
+  // takes when the method is called.
+  int arg_index;
+
+  // Whether this slot will be searched in the message chain.
+  bool parent;
+  // If this slot is mutable, then it will receive messages to change its
+  // value. For instance, if foo is mutable, it will receive foo: which will
+  // replace the value it contains.
+  bool mutable;
+};
+
+// slots[start, start + length) in the AST.
+struct SlotList {
+  uint32_t start;
+  uint32_t length;
+};
+
+struct Stmt {
+  ExprRef expr;
+  // From the start of the expression to its end, relative to the previous
+  // statement of the list, or for the first one to the object it is in, or
+  // the start of the source.
+  struct SourceSpan span;
+};
+
+// stmts[start, start + length) in the AST.
+struct StmtList {
+  uint32_t start;
+  uint32_t length;
+};
+
+struct ObjectExpr {
+  struct SlotList slots;
+  struct StmtList stmts;
+  // Index in the annotations of the AST, or AST_NONE.
+  uint32_t annotation;
+  // From the opening parenthesis to the closing one, relative to the
+  // statement or slot the object is in.
+  struct SourceSpan span;
+};
+
+struct LeafEntry {
+  ExprRef ref; // 0 if the entry is empty.
+  // Part of the hash of the leaf, so that most mismatches don't have to look
+  // at the node.
+  uint32_t hash;
+};
+
+struct Ast {
+  struct MessageExpr *messages;
+  struct IdentExpr *idents;
+  struct NumberExpr *numbers;
+  struct ObjectExpr *objects;
+  struct Slot *slots;
+  struct Stmt *stmts;
+  ExprRef *args;
+  struct Annotation *annotations;
+
+  uint32_t message_count, ident_count, number_count, object_count;
+  uint32_t slot_count, stmt_count, arg_count, annotation_count;
+
+  uint32_t message_capacity, ident_capacity, number_capacity,
+      object_capacity;
+  uint32_t slot_capacity, stmt_capacity, arg_capacity, annotation_capacity;
+
+  // An open-addressing table of the identifiers and numbers, for finding
+  // the existing node when one is added again. The entries are only hints,
+  // and are checked against the node they point to, so rolling the AST back
+  // can leave them behind.
+  struct LeafEntry *leaves;
+  uint32_t leaf_count, leaf_capacity;
+
+  // The top-level statements.
+  struct StmtList root;
+
+  // Set when an expression couldn't be added because there were already
+  // AST_MAX_EXPRS of its type. The ref it got is 0, which refers to nothing,
+  // so the AST is unusable until it is rolled back.
+  bool full;
+
+  // All the arrays are allocated here.
+  struct Arena arena;
+};
+
+void ast_init(struct Ast *ast);
+void ast_deinit(struct Ast *ast);
+
+// These return 0 and set full if the AST has no room for the expression.
+ExprRef ast_add_message(struct Ast *ast, struct MessageExpr message);
+// These return the existing node if there is one.
+ExprRef ast_add_ident(struct Ast *ast, const struct Symbol *ident);
+ExprRef ast_add_number(struct Ast *ast, struct NumberExpr number);
+ExprRef ast_add_object(struct Ast *ast, struct ObjectExpr object);
+// Returns the index of the annotation. Consecutive slots usually share one,
+// so adding the same annotation twice in a row stores it once.
+uint32_t ast_add_annotation(struct Ast *ast, struct Annotation annotation);
+
+// These append a whole list and return where it starts.
+uint32_t ast_add_slots(struct Ast *ast, const struct Slot *slots,
+                       uint32_t length);
+uint32_t ast_add_stmts(struct Ast *ast, const struct Stmt *stmts,
+                       uint32_t length);
+uint32_t ast_add_args(struct Ast *ast, const ExprRef *args, uint32_t length);
+
+// The number of nodes of each kind, which is enough to undo everything added
+// after it was taken.
+struct AstMark {
+  uint32_t messages, idents, numbers, objects;
+  uint32_t slots, stmts, args, annotations;
+};
+
+struct AstMark ast_mark(const struct Ast *ast);
+void ast_rollback(struct Ast *ast, struct AstMark mark);
+
+// Appends all the nodes of src to dst and sets root to where src's top-level
+// statements ended up. dst's root is left alone. Returns false, without
+// changing dst, if dst could end up with more than AST_MAX_EXPRS expressions
+// of one type, counting src's identifiers and numbers as if dst had none of
+// them yet.
+bool ast_append(struct Ast *dst, const struct Ast *src, struct StmtList *root);
+
+// The number of bytes the nodes take up.
+size_t ast_size(const struct Ast *ast);
+
+// A depth-first walk over expressions which keeps its own stack instead of
+// recursing, so nesting is only limited by memory. Each ast_walk_next moves
+// to the next step of the walk and says what it is about. Identifiers and
+// numbers only have a WExpr step. Messages and objects start with WExpr and
+// end with WExprEnd, with the steps for their parts in between.
+enum AstStep {
+  WStmts,       // The statement list stmts starts
+  WStmtsEnd,    // The statement list stmts is done
+  WExpr,        // The expression expr starts; role says where it is
+  WReceiverEnd, // The receiver of message expr is done; its arguments follow
+  WSlotsEnd,    // The slot values of object expr are done; its statements
+                // follow
+  WExprEnd,     // The message or object expr is done
+};
+
+// Where an expression is in the one it is part of. The previous part of the
+// same list is done when the next one starts.
+enum AstRole {
+  RNone,     // It's what the walk started from
+  RStmt,     // Statement index of stmts
+  RReceiver, // The receiver of message parent
+  RArg,      // Argument index of message parent
+  RSlot,     // The value of slot index of object parent
+};
+
+// A statement list or expression with parts which haven't been walked yet.
+struct AstWalkFrame {
+  ExprRef expr; // AST_NONE for a statement list.
+  // The steps already taken for it.
+  uint32_t steps;
+  // Its list of statements, arguments or slots.
+  uint32_t start, length;
+  // Where in the source the spans of its parts are relative to: the previous
+  // statement of a list or slot of an object, or the statement or slot a
+  // message is in. base is where an object starts.
+  uint32_t offset, base;
+};
+
+struct AstWalk {
+  const struct Ast *ast;
+
+  // The current step.
+  enum AstStep step;
+  ExprRef expr;
+  struct StmtList stmts;
+  // For WExpr steps.
+  enum AstRole role;
+  ExprRef parent;
+  uint32_t index;
+  // For WExpr steps, where in the source the statement or slot is for RStmt
+  // and RSlot, and where the expression is if it is an object. A walk from a
+  // statement list counts from the start of the source, and one from an
+  // expression from the statement or slot it is in.
+  struct SourceSpan span, object_span;
+
+  // The expression to start from, or AST_NONE.
+  ExprRef start;
+  VEC(struct AstWalkFrame, 32) stack;
+};
+
+// A walk is started from either a statement list or an expression.
+void ast_walk_init(struct AstWalk *walk, const struct Ast *ast);
+void ast_walk_deinit(struct AstWalk *walk);
+void ast_walk_stmts(struct AstWalk *walk, struct StmtList stmts);
+void ast_walk_expr(struct AstWalk *walk, ExprRef expr);
+// Returns false once the walk is over.
+bool ast_walk_next(struct AstWalk *walk);
+// Skips the parts of the expression the walk just stepped to, and its
+// WExprEnd, so that the walk goes on after it.
+void ast_walk_skip(struct AstWalk *walk);
+
+static inline struct MessageExpr *ast_message(const struct Ast *ast,
+                                              ExprRef ref) {
+  return &ast->messages[EXPR_INDEX(ref)];
+}
+
+static inline struct IdentExpr *ast_ident(const struct Ast *ast, ExprRef ref) {
+  return &ast->idents[EXPR_INDEX(ref)];
+}
+
+static inline struct NumberExpr *ast_number(const struct Ast *ast,
+                                            ExprRef ref) {
+  return &ast->numbers[EXPR_INDEX(ref)];
+}
+
+static inline struct ObjectExpr *ast_object(const struct Ast *ast,
+                                            ExprRef ref) {
+  return &ast->objects[EXPR_INDEX(ref)];
+}
+
+// Returns a possibly absent annotation, for printing.
+static inline struct Annotation ast_annotation(const struct Ast *ast,
+                                               uint32_t index) {
+  if (index == AST_NONE)
+    return (struct Annotation){0};
+  return ast->annotations[index];
+}
+
+#endif /* AST_H */
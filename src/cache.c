@@ -0,0 +1,558 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "hash.h"
+#include "symbol.h"
+#include "vec.h"
+
+#define CACHE_MAGIC "mySelfC"
+// Symbol index of an absent annotation.
+#define CACHE_NO_SYMBOL UINT32_MAX
+
+// Every section of the file starts at a multiple of this.
+#define CACHE_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  // CACHE_BYTE_ORDER, so that a file written on a machine with another byte
+  // order doesn't load.
+  uint32_t byte_order;
+
+  uint64_t source_hash;
+  uint64_t source_size;
+  // The hash of everything after the header. Decoding checks that indices are
+  // in range, but a flipped bit could still make a node its own child.
+  uint64_t checksum;
+
+  uint32_t symbol_count, symbol_bytes;
+  uint32_t message_count, ident_count, number_count, object_count;
+  uint32_t slot_count, stmt_count, arg_count, annotation_count;
+  uint32_t root_start, root_length;
+};
+
+#define CACHE_BYTE_ORDER 0x01020304
+
+// The on-disk forms of the nodes. Symbols are indices into the string
+// table; everything else is as it is in memory.
+
+struct CachedMessage {
+  uint32_t message;
+  uint32_t receiver;
+  uint32_t args;
+  uint32_t length;
+};
+
+struct CachedNumber {
+  uint32_t type;
+  uint32_t padding;
+  union {
+    int64_t integer;
+    double flt;
+  };
+};
+
+struct CachedObject {
+  uint32_t slots_start, slots_length;
+  uint32_t stmts_start, stmts_length;
+  uint32_t annotation;
+  uint32_t span_offset, span_length;
+};
+
+struct CachedSlot {
+  uint32_t name;
+  uint32_t value;
+  uint32_t annotation;
+  int32_t arg_index;
+  uint32_t span_offset, span_length;
+  uint8_t parent;
+  uint8_t mutable;
+  uint8_t padding[2];
+};
+
+struct CachedStmt {
+  uint32_t expr;
+  uint32_t span_offset, span_length;
+};
+
+struct CachedAnnotation {
+  uint32_t category, comment, module;
+};
+
+// Where each section is, given the header.
+struct CacheLayout {
+  size_t symbol_lengths, symbol_data;
+  size_t messages, idents, numbers, objects;
+  size_t slots, stmts, args, annotations;
+  size_t size;
+};
+
+static struct CacheLayout cache_layout(const struct CacheHeader *h) {
+  struct CacheLayout l;
+  size_t offset = CACHE_ALIGN(sizeof(*h));
+
+#define SECTION(field, bytes)                                                 \
+  l.field = offset;                                                           \
+  offset = CACHE_ALIGN(offset + (size_t)(bytes))
+
+  SECTION(symbol_lengths, h->symbol_count * sizeof(uint32_t));
+  SECTION(symbol_data, h->symbol_bytes);
+  SECTION(messages, h->message_count * sizeof(struct CachedMessage));
+  SECTION(idents, h->ident_count * sizeof(uint32_t));
+  SECTION(numbers, h->number_count * sizeof(struct CachedNumber));
+  SECTION(objects, h->object_count * sizeof(struct CachedObject));
+  SECTION(slots, h->slot_count * sizeof(struct CachedSlot));
+  SECTION(stmts, h->stmt_count * sizeof(struct CachedStmt));
+  SECTION(args, h->arg_count * sizeof(uint32_t));
+  SECTION(annotations, h->annotation_count * sizeof(struct CachedAnnotation));
+
+#undef SECTION
+
+  l.size = offset;
+  return l;
+}
+
+static char *cache_path(const char *source_path) {
+  char *path;
+  if (asprintf(&path, "%sc", source_path) < 0)
+    abort();
+  return path;
+}
+
+uint64_t cache_hash(const char *data, long size) {
+  return hash_bytes(data, size);
+}
+
+// Loading
+
+struct CacheReader {
+  const struct CacheHeader *header;
+  const char *base;
+  struct CacheLayout layout;
+
+  const struct Symbol **symbols;
+  bool valid;
+};
+
+static const struct Symbol *read_symbol(struct CacheReader *r,
+                                        uint32_t index) {
+  if (index >= r->header->symbol_count) {
+    r->valid = false;
+    return NULL;
+  }
+  return r->symbols[index];
+}
+
+static const struct Symbol *read_optional_symbol(struct CacheReader *r,
+                                                 uint32_t index) {
+  return index == CACHE_NO_SYMBOL ? NULL : read_symbol(r, index);
+}
+
+static ExprRef read_expr(struct CacheReader *r, ExprRef ref) {
+  uint32_t count;
+  switch (EXPR_TYPE(ref)) {
+  case EMessage:
+    count = r->header->message_count;
+    break;
+  case EIdent:
+    count = r->header->ident_count;
+    break;
+  case ENumber:
+    count = r->header->number_count;
+    break;
+  case EObject:
+    count = r->header->object_count;
+    break;
+  default:
+    count = 0;
+  }
+
+  if (EXPR_INDEX(ref) >= count)
+    r->valid = false;
+  return ref;
+}
+
+static uint32_t read_range(struct CacheReader *r, uint32_t start,
+                           uint32_t length, uint32_t count) {
+  if ((uint64_t)start + length > count)
+    r->valid = false;
+  return start;
+}
+
+static uint32_t read_annotation(struct CacheReader *r, uint32_t index) {
+  if (index != AST_NONE && index >= r->header->annotation_count)
+    r->valid = false;
+  return index;
+}
+
+// Allocates one of the arrays of the AST with exactly count elements.
+#define AST_ALLOC(ast, name, singular, count)                                 \
+  ((ast)->singular##_count = (ast)->singular##_capacity = (count),            \
+   (ast)->name = arena_alloc(&(ast)->arena, (count) * sizeof(*(ast)->name)))
+
+static bool cache_decode(struct CacheReader *r, struct Ast *ast) {
+  const struct CacheHeader *h = r->header;
+
+  // Intern the string table.
+  const uint32_t *lengths =
+      (const uint32_t *)(r->base + r->layout.symbol_lengths);
+  const char *data = r->base + r->layout.symbol_data;
+  uint64_t offset = 0;
+
+  r->symbols = malloc(h->symbol_count * sizeof(*r->symbols));
+  for (uint32_t i = 0; i < h->symbol_count; i++) {
+    if (offset + lengths[i] > h->symbol_bytes)
+      return false;
+    r->symbols[i] = symbol_intern(data + offset, lengths[i]);
+    offset += lengths[i];
+  }
+
+  const struct CachedMessage *messages =
+      (const void *)(r->base + r->layout.messages);
+  AST_ALLOC(ast, messages, message, h->message_count);
+  for (uint32_t i = 0; i < h->message_count; i++) {
+    ast->messages[i] = (struct MessageExpr){
+        .message = read_symbol(r, messages[i].message),
+        .receiver = read_expr(r, messages[i].receiver),
+        .args = read_range(r, messages[i].args, messages[i].length,
+                           h->arg_count),
+        .length = messages[i].length};
+  }
+
+  const uint32_t *idents = (const void *)(r->base + r->layout.idents);
+  AST_ALLOC(ast, idents, ident, h->ident_count);
+  for (uint32_t i = 0; i < h->ident_count; i++)
+    ast->idents[i].ident = read_symbol(r, idents[i]);
+
+  const struct CachedNumber *numbers =
+      (const void *)(r->base + r->layout.numbers);
+  AST_ALLOC(ast, numbers, number, h->number_count);
+  for (uint32_t i = 0; i < h->number_count; i++) {
+    struct NumberExpr *number = &ast->numbers[i];
+    number->type = numbers[i].type;
+    if (number->type == NInteger)
+      number->integer = numbers[i].integer;
+    else if (number->type == NFloat)
+      number->flt = numbers[i].flt;
+    else
+      r->valid = false;
+  }
+
+  const struct CachedObject *objects =
+      (const void *)(r->base + r->layout.objects);
+  AST_ALLOC(ast, objects, object, h->object_count);
+  for (uint32_t i = 0; i < h->object_count; i++) {
+    const struct CachedObject *object = &objects[i];
+    ast->objects[i] = (struct ObjectExpr){
+        .slots = {.start = read_range(r, object->slots_start,
+                                      object->slots_length, h->slot_count),
+                  .length = object->slots_length},
+        .stmts = {.start = read_range(r, object->stmts_start,
+                                      object->stmts_length, h->stmt_count),
+                  .length = object->stmts_length},
+        .annotation = read_annotation(r, object->annotation),
+        .span = {object->span_offset, object->span_length}};
+  }
+
+  const struct CachedSlot *slots = (const void *)(r->base + r->layout.slots);
+  AST_ALLOC(ast, slots, slot, h->slot_count);
+  for (uint32_t i = 0; i < h->slot_count; i++) {
+    ast->slots[i] = (struct Slot){
+        .name = read_symbol(r, slots[i].name),
+        .value = read_expr(r, slots[i].value),
+        .annotation = read_annotation(r, slots[i].annotation),
+        .arg_index = slots[i].arg_index,
+        .span = {slots[i].span_offset, slots[i].span_length},
+        .parent = slots[i].parent,
+        .mutable = slots[i].mutable};
+  }
+
+  const struct CachedStmt *stmts = (const void *)(r->base + r->layout.stmts);
+  AST_ALLOC(ast, stmts, stmt, h->stmt_count);
+  for (uint32_t i = 0; i < h->stmt_count; i++) {
+    ast->stmts[i] = (struct Stmt){
+        .expr = read_expr(r, stmts[i].expr),
+        .span = {stmts[i].span_offset, stmts[i].span_length}};
+  }
+
+  const uint32_t *args = (const void *)(r->base + r->layout.args);
+  AST_ALLOC(ast, args, arg, h->arg_count);
+  for (uint32_t i = 0; i < h->arg_count; i++)
+    ast->args[i] = read_expr(r, args[i]);
+
+  const struct CachedAnnotation *annotations =
+      (const void *)(r->base + r->layout.annotations);
+  AST_ALLOC(ast, annotations, annotation, h->annotation_count);
+  for (uint32_t i = 0; i < h->annotation_count; i++) {
+    ast->annotations[i] = (struct Annotation){
+        .category = read_optional_symbol(r, annotations[i].category),
+        .comment = read_optional_symbol(r, annotations[i].comment),
+        .module = read_optional_symbol(r, annotations[i].module)};
+  }
+
+  ast->root.start =
+      read_range(r, h->root_start, h->root_length, h->stmt_count);
+  ast->root.length = h->root_length;
+
+  return r->valid;
+}
+
+bool cache_load(const char *source_path, uint64_t hash, long size,
+                struct Ast *ast) {
+  char *path = cache_path(source_path);
+  int fd = open(path, O_RDONLY);
+  free(path);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct CacheHeader)) {
+    close(fd);
+    return false;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return false;
+
+  struct CacheReader r = {.header = map, .base = map, .valid = true};
+  const struct CacheHeader *h = r.header;
+
+  bool loaded = false;
+  if (memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) == 0 &&
+      h->version == CACHE_VERSION && h->byte_order == CACHE_BYTE_ORDER &&
+      h->source_hash == hash && h->source_size == (uint64_t)size) {
+    r.layout = cache_layout(h);
+    size_t body = CACHE_ALIGN(sizeof(*h));
+    if (r.layout.size == (size_t)st.st_size &&
+        cache_hash(r.base + body, r.layout.size - body) == h->checksum)
+      loaded = cache_decode(&r, ast);
+  }
+
+  free(r.symbols);
+  munmap(map, st.st_size);
+
+  if (!loaded) {
+    ast_deinit(ast);
+    ast_init(ast);
+  }
+  return loaded;
+}
+
+// Storing
+
+// Maps the symbols of the AST to their index in the string table.
+struct SymbolIndex {
+  const struct Symbol **keys;
+  uint32_t *values;
+  uint32_t capacity;
+
+  VEC(const struct Symbol *, 0) symbols;
+};
+
+static uint32_t symbol_index(struct SymbolIndex *index,
+                             const struct Symbol *symbol) {
+  if (!symbol)
+    return CACHE_NO_SYMBOL;
+
+  // Symbols are unique, so their address is their identity.
+  uint32_t mask = index->capacity - 1;
+  uint32_t i = (uint32_t)(((uintptr_t)symbol >> 4) * 0x9E3779B1u) & mask;
+  while (index->keys[i] && index->keys[i] != symbol)
+    i = (i + 1) & mask;
+
+  if (!index->keys[i]) {
+    index->keys[i] = symbol;
+    index->values[i] = index->symbols.length;
+    vec_push(&index->symbols, symbol);
+  }
+  return index->values[i];
+}
+
+bool cache_store(const char *source_path, uint64_t hash, long size,
+                 const struct Ast *ast) {
+  // There can't be more distinct symbols than references to them, so this
+  // keeps the index at most half full.
+  uint32_t symbol_refs = ast->message_count + ast->ident_count +
+                         ast->slot_count + 3 * ast->annotation_count;
+  struct SymbolIndex index = {.capacity = 16};
+  while (index.capacity < 2 * symbol_refs)
+    index.capacity *= 2;
+  index.keys = calloc(index.capacity, sizeof(*index.keys));
+  index.values = malloc(index.capacity * sizeof(*index.values));
+  vec_init(&index.symbols);
+
+  struct CachedMessage *messages =
+      malloc(ast->message_count * sizeof(*messages));
+  for (uint32_t i = 0; i < ast->message_count; i++) {
+    const struct MessageExpr *message = &ast->messages[i];
+    messages[i] = (struct CachedMessage){
+        .message = symbol_index(&index, message->message),
+        .receiver = message->receiver,
+        .args = message->args,
+        .length = message->length,
+    };
+  }
+
+  uint32_t *idents = malloc(ast->ident_count * sizeof(*idents));
+  for (uint32_t i = 0; i < ast->ident_count; i++)
+    idents[i] = symbol_index(&index, ast->idents[i].ident);
+
+  struct CachedNumber *numbers = calloc(ast->number_count, sizeof(*numbers));
+  for (uint32_t i = 0; i < ast->number_count; i++) {
+    numbers[i].type = ast->numbers[i].type;
+    if (ast->numbers[i].type == NInteger)
+      numbers[i].integer = ast->numbers[i].integer;
+    else
+      numbers[i].flt = ast->numbers[i].flt;
+  }
+
+  struct CachedObject *objects = malloc(ast->object_count * sizeof(*objects));
+  for (uint32_t i = 0; i < ast->object_count; i++) {
+    const struct ObjectExpr *object = &ast->objects[i];
+    objects[i] = (struct CachedObject){.slots_start = object->slots.start,
+                                       .slots_length = object->slots.length,
+                                       .stmts_start = object->stmts.start,
+                                       .stmts_length = object->stmts.length,
+                                       .annotation = object->annotation,
+                                       .span_offset = object->span.offset,
+                                       .span_length = object->span.length};
+  }
+
+  struct CachedSlot *slots = calloc(ast->slot_count, sizeof(*slots));
+  for (uint32_t i = 0; i < ast->slot_count; i++) {
+    const struct Slot *slot = &ast->slots[i];
+    slots[i] = (struct CachedSlot){.name = symbol_index(&index, slot->name),
+                                   .value = slot->value,
+                                   .annotation = slot->annotation,
+                                   .arg_index = slot->arg_index,
+                                   .span_offset = slot->span.offset,
+                                   .span_length = slot->span.length,
+                                   .parent = slot->parent,
+                                   .mutable = slot->mutable};
+  }
+
+  struct CachedStmt *stmts = malloc(ast->stmt_count * sizeof(*stmts));
+  for (uint32_t i = 0; i < ast->stmt_count; i++) {
+    const struct Stmt *stmt = &ast->stmts[i];
+    stmts[i] = (struct CachedStmt){.expr = stmt->expr,
+                                   .span_offset = stmt->span.offset,
+                                   .span_length = stmt->span.length};
+  }
+
+  struct CachedAnnotation *annotations =
+      malloc(ast->annotation_count * sizeof(*annotations));
+  for (uint32_t i = 0; i < ast->annotation_count; i++) {
+    const struct Annotation *annotation = &ast->annotations[i];
+    annotations[i] = (struct CachedAnnotation){
+        .category = symbol_index(&index, annotation->category),
+        .comment = symbol_index(&index, annotation->comment),
+        .module = symbol_index(&index, annotation->module)};
+  }
+
+  // The string table.
+  uint32_t *lengths = malloc(index.symbols.length * sizeof(*lengths));
+  uint32_t symbol_bytes = 0;
+  for (int i = 0; i < index.symbols.length; i++) {
+    lengths[i] = index.symbols.data[i]->length;
+    symbol_bytes += lengths[i];
+  }
+
+  char *symbol_data = malloc(symbol_bytes);
+  for (int i = 0, offset = 0; i < index.symbols.length; i++) {
+    memcpy(symbol_data + offset, index.symbols.data[i]->name, lengths[i]);
+    offset += lengths[i];
+  }
+
+  struct CacheHeader header = {
+      .magic = CACHE_MAGIC,
+      .version = CACHE_VERSION,
+      .byte_order = CACHE_BYTE_ORDER,
+      .source_hash = hash,
+      .source_size = size,
+      .symbol_count = index.symbols.length,
+      .symbol_bytes = symbol_bytes,
+      .message_count = ast->message_count,
+      .ident_count = ast->ident_count,
+      .number_count = ast->number_count,
+      .object_count = ast->object_count,
+      .slot_count = ast->slot_count,
+      .stmt_count = ast->stmt_count,
+      .arg_count = ast->arg_count,
+      .annotation_count = ast->annotation_count,
+      .root_start = ast->root.start,
+      .root_length = ast->root.length,
+  };
+
+  // Lay the whole file out in memory, so that it can be checksummed.
+  struct CacheLayout layout = cache_layout(&header);
+  char *file = calloc(1, layout.size);
+#define SECTION(field, data, count)                                           \
+  if (count)                                                                  \
+    memcpy(file + layout.field, data, (count) * sizeof(*(data)))
+
+  SECTION(symbol_lengths, lengths, header.symbol_count);
+  SECTION(symbol_data, symbol_data, symbol_bytes);
+  SECTION(messages, messages, ast->message_count);
+  SECTION(idents, idents, ast->ident_count);
+  SECTION(numbers, numbers, ast->number_count);
+  SECTION(objects, objects, ast->object_count);
+  SECTION(slots, slots, ast->slot_count);
+  SECTION(stmts, stmts, ast->stmt_count);
+  SECTION(args, ast->args, ast->arg_count);
+  SECTION(annotations, annotations, ast->annotation_count);
+
+#undef SECTION
+
+  size_t body = CACHE_ALIGN(sizeof(header));
+  header.checksum = cache_hash(file + body, layout.size - body);
+  memcpy(file, &header, sizeof(header));
+
+  // Write to a temporary file and rename it into place, so that a reader
+  // never sees half a cache. The file gets a name nothing else has, since
+  // threads of the same process can be writing the cache of the same source.
+  char *path = cache_path(source_path);
+  char *tmp_path;
+  if (asprintf(&tmp_path, "%s.XXXXXX", path) < 0)
+    abort();
+
+  bool ok = false;
+  int fd = mkstemp(tmp_path);
+  // mkstemp only lets the owner read it.
+  FILE *out = fd >= 0 && fchmod(fd, 0644) == 0 ? fdopen(fd, "wb") : NULL;
+  if (out) {
+    ok = fwrite(file, 1, layout.size, out) == layout.size;
+    ok = fclose(out) == 0 && ok;
+    ok = ok && rename(tmp_path, path) == 0;
+  } else if (fd >= 0) {
+    close(fd);
+  }
+  if (fd >= 0 && !ok)
+    unlink(tmp_path);
+
+  free(path);
+  free(tmp_path);
+  free(file);
+  free(lengths);
+  free(symbol_data);
+  free(messages);
+  free(idents);
+  free(numbers);
+  free(objects);
+  free(slots);
+  free(stmts);
+  free(annotations);
+  free(index.keys);
+  free(index.values);
+  vec_deinit(&index.symbols);
+
+  return ok;
+}
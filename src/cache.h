@@ -0,0 +1,33 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ast.h"
+
+// Parsed sources are cached next to them, foo.self in foo.selfc. A cache file
+// holds the flat AST with symbols replaced by indices into a string table, so
+// it doesn't depend on where anything is in memory. It is keyed by the hash
+// and size of the source it was built from, so an edited source simply
+// misses.
+//
+// Loading maps the file and decodes it into the AST arrays in a single pass,
+// which also checks every index. A stale, truncated or otherwise bad cache is
+// ignored.
+
+#define CACHE_VERSION 3
+
+// Returns the key of a source.
+uint64_t cache_hash(const char *data, long size);
+
+// Loads the cached AST of the source into ast, which must be empty. Returns
+// false if there is no usable cache.
+bool cache_load(const char *source_path, uint64_t hash, long size,
+                struct Ast *ast);
+// Writes the AST of the source to its cache. This is best-effort: failing to
+// write (to a read-only directory, say) just returns false.
+bool cache_store(const char *source_path, uint64_t hash, long size,
+                 const struct Ast *ast);
+
+#endif /* CACHE_H */
@@ -0,0 +1,444 @@
+#include <limits.h>
+#include <stdlib.h>
+
+#include "chash.h"
+
+// Control bytes, as in hash.c, and one for a slot which a writer has claimed
+// but not filled in yet. Full slots have the high bit set, and hold the low 7
+// bits of their hash in the others.
+#define CONTROL_EMPTY 0
+#define CONTROL_DELETED 1
+#define CONTROL_CLAIMED 2
+
+// A group is one 64-bit word of control bytes.
+#define GROUP_SIZE 8
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+struct CHashEntry {
+  // Written before the slot is full, and never changed afterwards.
+  uint64_t hash;
+  void *key;
+  _Atomic(void *) value;
+};
+
+// Allocated in one block, followed by the control words and the entries.
+struct CHashArrays {
+  int capacity;
+  // How many more slots can be claimed. Deleted ones stay claimed.
+  atomic_int growth_left;
+  _Atomic uint64_t *control;
+  struct CHashEntry *entries;
+};
+
+struct CHashRetired {
+  void *pointer;
+  // The epoch it was retired in.
+  unsigned long epoch;
+  struct CHashRetired *next;
+};
+
+// Epochs
+
+// Every thread which uses a table gets one of these, on its own cache line so
+// that lookups on different threads don't slow each other down. While it
+// reads, epoch is the global epoch from when it started, and 0 otherwise.
+// Memory which was retired in an epoch can be freed once no thread is in that
+// epoch or an earlier one.
+//
+// The records are never freed. A thread which exits gives its record back,
+// and the next new thread takes it, so there are only as many as there were
+// threads at once.
+struct CHashThread {
+  _Alignas(64) atomic_ulong epoch;
+  atomic_bool taken;
+  // How deeply chash_read_begin is nested.
+  int depth;
+  // Set before the record is added to g_threads, and never changed.
+  struct CHashThread *next;
+};
+
+// The list of every record, newest first. Records are only ever added at the
+// head.
+static _Atomic(struct CHashThread *) g_threads;
+static atomic_ulong g_epoch = 1;
+
+static _Thread_local struct CHashThread *t_thread;
+// Gives threads back when they exit.
+static pthread_key_t g_thread_key;
+static pthread_once_t g_thread_key_once = PTHREAD_ONCE_INIT;
+
+static void release_thread(void *thread) {
+  atomic_store(&((struct CHashThread *)thread)->taken, false);
+}
+
+static void make_thread_key(void) {
+  pthread_key_create(&g_thread_key, release_thread);
+}
+
+static struct CHashThread *this_thread(void) {
+  if (t_thread)
+    return t_thread;
+
+  pthread_once(&g_thread_key_once, make_thread_key);
+  struct CHashThread *thread = atomic_load(&g_threads);
+  for (; thread; thread = thread->next) {
+    bool taken = false;
+    if (atomic_compare_exchange_strong(&thread->taken, &taken, true))
+      break;
+  }
+
+  if (!thread) {
+    thread = aligned_alloc(_Alignof(struct CHashThread), sizeof(*thread));
+    if (!thread)
+      abort();
+    atomic_init(&thread->epoch, 0);
+    atomic_init(&thread->taken, true);
+    thread->depth = 0;
+
+    // A reclaim which doesn't see the record yet started before the thread
+    // can read, so it can't free anything the thread reads either.
+    thread->next = atomic_load(&g_threads);
+    while (!atomic_compare_exchange_weak(&g_threads, &thread->next, thread))
+      ;
+  }
+
+  t_thread = thread;
+  pthread_setspecific(g_thread_key, t_thread);
+  return t_thread;
+}
+
+// Frees what no thread can be reading any more. Called with retired_lock
+// held.
+static void reclaim(struct CHashTable *t) {
+  unsigned long oldest = ULONG_MAX;
+  for (struct CHashThread *thread = atomic_load(&g_threads); thread;
+       thread = thread->next) {
+    unsigned long epoch = atomic_load(&thread->epoch);
+    if (epoch && epoch < oldest)
+      oldest = epoch;
+  }
+
+  struct CHashRetired **link = &t->retired;
+  while (*link) {
+    struct CHashRetired *retired = *link;
+    if (retired->epoch < oldest) {
+      *link = retired->next;
+      free(retired->pointer);
+      free(retired);
+    } else {
+      link = &retired->next;
+    }
+  }
+}
+
+// Like chash_retire, with a record which is already allocated.
+static void retire(struct CHashTable *t, struct CHashRetired *retired,
+                   void *pointer) {
+  retired->pointer = pointer;
+
+  pthread_mutex_lock(&t->retired_lock);
+  // Lookups which start from now on are in a later epoch, and can't find the
+  // pointer any more.
+  retired->epoch = atomic_fetch_add(&g_epoch, 1);
+  retired->next = t->retired;
+  t->retired = retired;
+  reclaim(t);
+  pthread_mutex_unlock(&t->retired_lock);
+}
+
+bool chash_retire(struct CHashTable *t, void *pointer) {
+  struct CHashRetired *retired = malloc(sizeof(*retired));
+  if (!retired)
+    return false;
+  retire(t, retired, pointer);
+  return true;
+}
+
+// Arrays
+
+static int max_load(int capacity) {
+  return capacity - capacity / 8;
+}
+
+static size_t hash_group(uint64_t hash) { return hash >> 7; }
+static uint8_t hash_control(uint64_t hash) { return hash | 0x80; }
+
+// Returns a mask with the high bit of byte i set if control byte i of the
+// group is control. Bytes above one which matches can also be set if they are
+// control ^ 1, which for full slots is another full slot, and for empty ones
+// a deleted slot: so the lowest match is always a real one, and only full
+// slots match full ones.
+static inline uint64_t group_match(uint64_t group, uint8_t control) {
+  uint64_t x = group ^ (ONES * control);
+  return (x - ONES) & ~x & HIGHS;
+}
+
+static struct CHashArrays *allocate(int capacity) {
+  struct CHashArrays *a =
+      calloc(1, sizeof(*a) + capacity + capacity * sizeof(struct CHashEntry));
+  if (!a)
+    return NULL;
+
+  a->capacity = capacity;
+  atomic_init(&a->growth_left, max_load(capacity));
+  a->control = (_Atomic uint64_t *)(a + 1);
+  a->entries = (struct CHashEntry *)((char *)a->control + capacity);
+  return a;
+}
+
+// Returns the full slot with the key, or -1 if there is none.
+static int find(const struct CHashTable *t, struct CHashArrays *a, void *key,
+                uint64_t hash) {
+  size_t mask = a->capacity / GROUP_SIZE - 1;
+  size_t group = hash_group(hash) & mask;
+  uint8_t control = hash_control(hash);
+
+  for (size_t step = 1;; step++) {
+    // Pairs with the release in set_control, so that the entries of the full
+    // slots are filled in.
+    uint64_t word =
+        atomic_load_explicit(&a->control[group], memory_order_acquire);
+    for (uint64_t match = group_match(word, control); match;
+         match &= match - 1) {
+      int slot = group * GROUP_SIZE + __builtin_ctzll(match) / 8;
+      struct CHashEntry *entry = &a->entries[slot];
+      if (entry->hash == hash && t->equal(key, entry->key))
+        return slot;
+    }
+    if (group_match(word, CONTROL_EMPTY))
+      return -1;
+
+    group = (group + step) & mask;
+  }
+}
+
+// Claims an empty slot where the hash is probed for, or returns -1 if the
+// arrays are full.
+static int claim(struct CHashArrays *a, uint64_t hash) {
+  if (atomic_fetch_sub(&a->growth_left, 1) <= 0) {
+    atomic_fetch_add(&a->growth_left, 1);
+    return -1;
+  }
+
+  size_t mask = a->capacity / GROUP_SIZE - 1;
+  size_t group = hash_group(hash) & mask;
+
+  for (size_t step = 1;; step++) {
+    uint64_t word =
+        atomic_load_explicit(&a->control[group], memory_order_relaxed);
+    uint64_t empty;
+    while ((empty = group_match(word, CONTROL_EMPTY))) {
+      int byte = __builtin_ctzll(empty) / 8;
+      uint64_t claimed = word | (uint64_t)CONTROL_CLAIMED << (8 * byte);
+      if (atomic_compare_exchange_weak_explicit(&a->control[group], &word,
+                                                claimed, memory_order_relaxed,
+                                                memory_order_relaxed))
+        return group * GROUP_SIZE + byte;
+    }
+
+    group = (group + step) & mask;
+  }
+}
+
+static void set_control(struct CHashArrays *a, int slot, uint8_t control) {
+  _Atomic uint64_t *word = &a->control[slot / GROUP_SIZE];
+  int shift = slot % GROUP_SIZE * 8;
+
+  uint64_t old = atomic_load_explicit(word, memory_order_relaxed);
+  uint64_t new;
+  do {
+    new = (old & ~(0xffULL << shift)) | (uint64_t)control << shift;
+  } while (!atomic_compare_exchange_weak_explicit(
+      word, &old, new, memory_order_release, memory_order_relaxed));
+}
+
+// Fills in a claimed slot, and makes it visible to lookups.
+static void fill(struct CHashArrays *a, int slot, uint64_t hash, void *key,
+                 void *value) {
+  struct CHashEntry *entry = &a->entries[slot];
+  entry->hash = hash;
+  entry->key = key;
+  atomic_store_explicit(&entry->value, value, memory_order_relaxed);
+  set_control(a, slot, hash_control(hash));
+}
+
+// Replaces the arrays which were full, unless another writer did so first.
+// The arrays double, unless most of them went to deleted slots.
+static bool grow(struct CHashTable *t, struct CHashArrays *old) {
+  for (int i = 0; i < CHASH_STRIPES; i++)
+    pthread_mutex_lock(&t->stripes[i]);
+
+  bool ok = true;
+  struct CHashArrays *a = atomic_load(&t->arrays);
+  struct CHashRetired *retired = NULL;
+  if (a == old) {
+    int capacity = a->capacity;
+    if (atomic_load(&t->size) >= max_load(capacity) / 2)
+      capacity *= 2;
+
+    // The old arrays can only be swapped out if they can be retired.
+    struct CHashArrays *grown = NULL;
+    retired = malloc(sizeof(*retired));
+    if (retired)
+      grown = allocate(capacity);
+    if (grown) {
+      for (int group = 0; group < a->capacity / GROUP_SIZE; group++) {
+        uint64_t word = atomic_load(&a->control[group]);
+        for (uint64_t live = word & HIGHS; live; live &= live - 1) {
+          struct CHashEntry *entry =
+              &a->entries[group * GROUP_SIZE + __builtin_ctzll(live) / 8];
+          fill(grown, claim(grown, entry->hash), entry->hash, entry->key,
+               atomic_load(&entry->value));
+        }
+      }
+      atomic_store(&t->arrays, grown);
+    } else {
+      free(retired);
+      ok = false;
+    }
+  }
+
+  for (int i = CHASH_STRIPES - 1; i >= 0; i--)
+    pthread_mutex_unlock(&t->stripes[i]);
+  if (ok && a == old)
+    retire(t, retired, a);
+  return ok;
+}
+
+static pthread_mutex_t *stripe(struct CHashTable *t, uint64_t hash) {
+  return &t->stripes[(hash >> 32) % CHASH_STRIPES];
+}
+
+// Sets the value of the key, or only adds it if replace is false. Returns
+// false if allocating failed. Otherwise *result is the value it replaced, or
+// NULL, if replace is true, and the value in the table if it is false.
+static bool put(struct CHashTable *t, void *key, void *value, bool replace,
+                void **result) {
+  uint64_t hash = t->hash(key);
+  pthread_mutex_t *lock = stripe(t, hash);
+
+  for (;;) {
+    // Growing takes every stripe, so the arrays stay while one is held.
+    pthread_mutex_lock(lock);
+    struct CHashArrays *a = atomic_load(&t->arrays);
+
+    int slot = find(t, a, key, hash);
+    if (slot >= 0) {
+      struct CHashEntry *entry = &a->entries[slot];
+      if (replace)
+        *result = atomic_exchange_explicit(&entry->value, value,
+                                           memory_order_acq_rel);
+      else
+        *result = atomic_load(&entry->value);
+      pthread_mutex_unlock(lock);
+      return true;
+    }
+
+    slot = claim(a, hash);
+    if (slot >= 0) {
+      fill(a, slot, hash, key, value);
+      atomic_fetch_add(&t->size, 1);
+      pthread_mutex_unlock(lock);
+      *result = replace ? NULL : value;
+      return true;
+    }
+
+    pthread_mutex_unlock(lock);
+    if (!grow(t, a))
+      return false;
+  }
+}
+
+bool chash_init(struct CHashTable *t, int capacity, hashtable_hash_func hash,
+                hashtable_equal_func equal) {
+  int size = 2 * GROUP_SIZE;
+  while (max_load(size) < capacity)
+    size *= 2;
+
+  struct CHashArrays *a = allocate(size);
+  if (!a)
+    return false;
+
+  atomic_init(&t->arrays, a);
+  atomic_init(&t->size, 0);
+  t->hash = hash;
+  t->equal = equal;
+  for (int i = 0; i < CHASH_STRIPES; i++)
+    pthread_mutex_init(&t->stripes[i], NULL);
+  pthread_mutex_init(&t->retired_lock, NULL);
+  t->retired = NULL;
+  return true;
+}
+
+void chash_deinit(struct CHashTable *t) {
+  free(atomic_load(&t->arrays));
+
+  struct CHashRetired *retired = t->retired;
+  while (retired) {
+    struct CHashRetired *next = retired->next;
+    free(retired->pointer);
+    free(retired);
+    retired = next;
+  }
+
+  for (int i = 0; i < CHASH_STRIPES; i++)
+    pthread_mutex_destroy(&t->stripes[i]);
+  pthread_mutex_destroy(&t->retired_lock);
+}
+
+void chash_read_begin(void) {
+  struct CHashThread *thread = this_thread();
+  if (thread->depth++ == 0)
+    atomic_store(&thread->epoch, atomic_load(&g_epoch));
+}
+
+void chash_read_end(void) {
+  if (--t_thread->depth == 0)
+    atomic_store_explicit(&t_thread->epoch, 0, memory_order_release);
+}
+
+void *chash_get(struct CHashTable *t, void *key) {
+  uint64_t hash = t->hash(key);
+
+  // The epoch is stored, and the arrays loaded, sequentially consistently:
+  // either reclaim sees the epoch, or this sees the arrays which replaced the
+  // ones it would free.
+  chash_read_begin();
+  struct CHashArrays *a = atomic_load(&t->arrays);
+
+  int slot = find(t, a, key, hash);
+  void *value = NULL;
+  if (slot >= 0)
+    value = atomic_load_explicit(&a->entries[slot].value, memory_order_acquire);
+
+  chash_read_end();
+  return value;
+}
+
+bool chash_set(struct CHashTable *t, void *key, void *value, void **old) {
+  return put(t, key, value, true, old);
+}
+
+void *chash_add(struct CHashTable *t, void *key, void *value) {
+  void *result;
+  return put(t, key, value, false, &result) ? result : NULL;
+}
+
+void *chash_remove(struct CHashTable *t, void *key) {
+  uint64_t hash = t->hash(key);
+  pthread_mutex_t *lock = stripe(t, hash);
+
+  pthread_mutex_lock(lock);
+  struct CHashArrays *a = atomic_load(&t->arrays);
+  int slot = find(t, a, key, hash);
+  void *value = NULL;
+  if (slot >= 0) {
+    value = atomic_load(&a->entries[slot].value);
+    set_control(a, slot, CONTROL_DELETED);
+    atomic_fetch_sub(&t->size, 1);
+  }
+  pthread_mutex_unlock(lock);
+
+  return value;
+}
@@ -0,0 +1,76 @@
+#ifndef CHASH_H
+#define CHASH_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hash.h"
+
+// A hashtable which several threads can use at once, for the tables they
+// share, like the symbol table.
+//
+// Lookups take no locks. They probe an open addressing index like the one of
+// struct HashTable, loading its control bytes eight at a time with atomic
+// loads. Writers lock one of CHASH_STRIPES mutexes, picked by the hash, so they
+// only wait for writers of keys in the same stripe. Writers of different
+// stripes can still probe the same groups, so a new entry claims its slot
+// with a compare-and-swap on the control bytes, and only shows up in lookups
+// once it is filled in. Removed entries leave their slots deleted until the
+// arrays are replaced, so a slot never changes its key under a lookup.
+//
+// Once the arrays fill up, a writer locks every stripe, copies the live
+// entries to new arrays and swaps them in. Lookups which are still in the old
+// arrays go on reading them: they are only freed once every thread which was
+// reading at that point has finished (epoch-based reclamation). chash_retire
+// frees other memory, like removed keys and values, the same way.
+
+#define CHASH_STRIPES 64
+
+struct CHashArrays;
+struct CHashRetired;
+
+struct CHashTable {
+  _Atomic(struct CHashArrays *) arrays;
+  atomic_int size;
+
+  hashtable_hash_func hash;
+  hashtable_equal_func equal;
+
+  pthread_mutex_t stripes[CHASH_STRIPES];
+  // Memory which is waiting to be freed.
+  pthread_mutex_t retired_lock;
+  struct CHashRetired *retired;
+};
+
+// The table starts with room for at least capacity entries. Returns false if
+// allocating failed.
+bool chash_init(struct CHashTable *t, int capacity, hashtable_hash_func hash,
+                hashtable_equal_func equal);
+// No other thread may be using the table any more.
+void chash_deinit(struct CHashTable *t);
+
+void *chash_get(struct CHashTable *t, void *key);
+// Returns false if the table had to grow, and allocating failed. Otherwise
+// the value it replaced, or NULL if there was none, goes in *old. Lookups may
+// still be reading it, see chash_retire.
+bool chash_set(struct CHashTable *t, void *key, void *value, void **old);
+// Adds the entry unless there already is one for the key. Returns the value
+// which is in the table afterwards, or NULL if allocating failed.
+void *chash_add(struct CHashTable *t, void *key, void *value);
+// Returns the value of the removed entry, or NULL if there was none. Lookups
+// may still be reading its key and value, see chash_retire.
+void *chash_remove(struct CHashTable *t, void *key);
+
+// Frees the pointer once no thread which is reading now can still be reading
+// it. Returns false if allocating failed, and then it is never freed.
+bool chash_retire(struct CHashTable *t, void *pointer);
+
+// A lookup is a read by itself. Threads which go on to use the values they
+// looked up, while other threads might retire them, read from before the
+// lookup until they are done with them. Reads can be nested.
+void chash_read_begin(void);
+void chash_read_end(void);
+
+#endif /* CHASH_H */
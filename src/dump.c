@@ -0,0 +1,830 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dump.h"
+
+#define DUMP_BUFFER_SIZE (1 << 20)
+
+// The JSON and binary forms are written by loops of their own, see
+// json_stmts, with a stack of these for the lists they are partway through.
+struct DumpFrame {
+  // The statements of expr, which is an object or AST_NONE, or else the
+  // arguments of a message or slots of an object.
+  ExprRef expr;
+  bool stmts;
+  // The parts written so far, out of length. Messages count their receiver
+  // and the start of their arguments as the first two.
+  uint32_t next, length;
+  // Where its statements, arguments or slots start.
+  uint32_t start;
+  // Where the spans of its parts are relative to, as in AstWalkFrame.
+  uint32_t offset, base;
+};
+
+struct Dumper {
+  int fd;
+  bool failed;
+
+  char *buffer;
+  size_t length;
+
+  const struct Ast *ast;
+  int indent;
+
+  // The binary form numbers symbols in the order they first appear. This
+  // maps them to their number, with open addressing.
+  const struct Symbol **symbols;
+  uint32_t *symbol_numbers;
+  uint32_t symbol_count, symbol_capacity;
+  VEC(struct DumpFrame, 32) frames;
+};
+
+// Output
+
+static void flush(struct Dumper *d) {
+  size_t written = 0;
+  while (written < d->length && !d->failed) {
+    ssize_t n = write(d->fd, d->buffer + written, d->length - written);
+    if (n < 0 && errno != EINTR)
+      d->failed = true;
+    else if (n > 0)
+      written += n;
+  }
+  d->length = 0;
+}
+
+// Returns where the next size bytes go, which must be at most the size of
+// the buffer.
+static char *reserve(struct Dumper *d, size_t size) {
+  if (d->length + size > DUMP_BUFFER_SIZE)
+    flush(d);
+  return d->buffer + d->length;
+}
+
+static void put_bytes(struct Dumper *d, const char *data, size_t size) {
+  while (size > 0) {
+    if (d->length == DUMP_BUFFER_SIZE)
+      flush(d);
+
+    size_t chunk = DUMP_BUFFER_SIZE - d->length;
+    if (chunk > size)
+      chunk = size;
+    memcpy(d->buffer + d->length, data, chunk);
+    d->length += chunk;
+    data += chunk;
+    size -= chunk;
+  }
+}
+
+static void put(struct Dumper *d, const char *string) {
+  put_bytes(d, string, strlen(string));
+}
+
+static void put_byte(struct Dumper *d, char c) {
+  *reserve(d, 1) = c;
+  d->length++;
+}
+
+static void put_long(struct Dumper *d, long value) {
+  char digits[24];
+  char *p = digits + sizeof(digits);
+  unsigned long magnitude = value;
+  if (value < 0)
+    magnitude = -magnitude;
+
+  do {
+    *--p = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude);
+  if (value < 0)
+    *--p = '-';
+
+  put_bytes(d, p, digits + sizeof(digits) - p);
+}
+
+static void put_double(struct Dumper *d, const char *format, double value) {
+  // Enough for any double with %f.
+  char *p = reserve(d, 512);
+  d->length += snprintf(p, 512, format, value);
+}
+
+static void put_indent(struct Dumper *d) {
+  for (int left = d->indent; left > 0;) {
+    if (d->length == DUMP_BUFFER_SIZE)
+      flush(d);
+
+    int chunk = DUMP_BUFFER_SIZE - d->length;
+    if (chunk > left)
+      chunk = left;
+    memset(d->buffer + d->length, ' ', chunk);
+    d->length += chunk;
+    left -= chunk;
+  }
+}
+
+static void put_indented(struct Dumper *d, const char *string) {
+  put_indent(d);
+  put(d, string);
+}
+
+// Frames
+
+static void push_stmts(struct Dumper *d, ExprRef object, struct StmtList stmts,
+                       uint32_t offset) {
+  vec_push(&d->frames, ((struct DumpFrame){.expr = object,
+                                           .stmts = true,
+                                           .length = stmts.length,
+                                           .start = stmts.start,
+                                           .offset = offset}));
+}
+
+// Pushes a frame for the parts of the message or object, which is in the
+// statement or slot at offset, and returns where an object starts.
+static uint32_t push_parts(struct Dumper *d, ExprRef expr, uint32_t offset) {
+  if (EXPR_TYPE(expr) == EMessage) {
+    struct MessageExpr *message = ast_message(d->ast, expr);
+    vec_push(&d->frames, ((struct DumpFrame){.expr = expr,
+                                             .length = message->length + 2,
+                                             .start = message->args,
+                                             .offset = offset}));
+    return offset;
+  }
+
+  struct ObjectExpr *object = ast_object(d->ast, expr);
+  uint32_t start = offset + object->span.offset;
+  vec_push(&d->frames, ((struct DumpFrame){.expr = expr,
+                                           .length = object->slots.length,
+                                           .start = object->slots.start,
+                                           .offset = start,
+                                           .base = start}));
+  return start;
+}
+
+// Steps to the next slot of the object on top and returns it, with its
+// span in the source. Once they're all done, it turns the frame into the
+// one of the object's statements and returns NULL.
+static const struct Slot *next_slot(struct Dumper *d, struct DumpFrame *top,
+                                    struct SourceSpan *span) {
+  if (top->next == top->length) {
+    ExprRef object = top->expr;
+    uint32_t base = top->base;
+    d->frames.length--;
+    push_stmts(d, object, ast_object(d->ast, object)->stmts, base);
+    return NULL;
+  }
+
+  // Argument slots aren't in the chain of the others.
+  const struct Slot *slot = &d->ast->slots[top->start + top->next++];
+  uint32_t offset =
+      (slot->arg_index ? top->base : top->offset) + slot->span.offset;
+  if (!slot->arg_index)
+    top->offset = offset;
+  *span = (struct SourceSpan){offset, slot->span.length};
+  return slot;
+}
+
+// Human form
+
+static void human_annotation(struct Dumper *d, uint32_t index) {
+  struct Annotation annotation = ast_annotation(d->ast, index);
+  put_indented(d, "annotations = Annotation {\n");
+  d->indent += 2;
+  put_indented(d, "module = ");
+  put(d, symbol_name(annotation.module));
+  put(d, ",\n");
+  put_indented(d, "category = ");
+  put(d, symbol_name(annotation.category));
+  put(d, ",\n");
+  put_indented(d, "comment = ");
+  put(d, symbol_name(annotation.comment));
+  put(d, "\n");
+  d->indent -= 2;
+  put_indented(d, "},\n");
+}
+
+static void human_expr(struct Dumper *d, ExprRef expr) {
+  const struct Ast *ast = d->ast;
+
+  put(d, "Expr {\n");
+  d->indent += 2;
+  put_indented(d, "type = ");
+
+  switch (EXPR_TYPE(expr)) {
+  case EIdent:
+    put(d, "EIdent,\n");
+    put_indented(d, "ident = IdentExpr {\n");
+    d->indent += 2;
+
+    put_indented(d, "ident = \"");
+    put(d, symbol_name(ast_ident(ast, expr)->ident));
+    put(d, "\"\n");
+
+    d->indent -= 2;
+    put_indented(d, "}\n");
+    break;
+  case EMessage:
+    put(d, "EMessage,\n");
+    put_indented(d, "message = MessageExpr {\n");
+    d->indent += 2;
+    put_indented(d, "receiver = ");
+    // The receiver follows.
+    return;
+  case ENumber: {
+    struct NumberExpr *number = ast_number(ast, expr);
+    put(d, "ENumber,\n");
+    put_indented(d, "number = NumberExpr {\n");
+    d->indent += 2;
+
+    put_indented(d, "type = ");
+    put(d, number->type == NInteger ? "NInteger,\n" : "NFloat,\n");
+    if (number->type == NInteger) {
+      put_indented(d, "integer = ");
+      put_long(d, number->integer);
+    } else {
+      put_indented(d, "flt = ");
+      put_double(d, "%f", number->flt);
+    }
+    put(d, "\n");
+
+    d->indent -= 2;
+    put_indented(d, "}\n");
+    break;
+  }
+  case EObject:
+    put(d, "EObject,\n");
+    put_indented(d, "object = ObjectExpr {\n");
+    d->indent += 2;
+    put_indented(d, "slots = SlotList {\n");
+    d->indent += 2;
+    put_indented(d, "length = ");
+    put_long(d, ast_object(ast, expr)->slots.length);
+    put(d, ",\n");
+    put_indented(d, "slots = [\n");
+    d->indent += 2;
+    // The slots follow.
+    return;
+  case ENone:
+    fputs("internal error: ENone reached\n", stderr);
+    abort();
+  case EBinary:
+    fputs("TODO EBinary\n", stderr);
+    abort();
+  }
+
+  d->indent -= 2;
+  put_indented(d, "}");
+}
+
+// Starts the expression where it goes in the one it's part of.
+static void human_role(struct Dumper *d, const struct AstWalk *walk) {
+  const struct Ast *ast = d->ast;
+
+  switch (walk->role) {
+  case RStmt:
+    if (walk->index > 0) {
+      put(d, "\n");
+      d->indent -= 2;
+      put_indented(d, "},\n");
+    }
+    put_indented(d, "Stmt {\n");
+    d->indent += 2;
+    put_indent(d);
+    break;
+  case RArg:
+    if (walk->index > 0)
+      put(d, ",\n");
+    put_indent(d);
+    break;
+  case RSlot: {
+    struct ObjectExpr *object = ast_object(ast, walk->parent);
+    struct Slot *slot = &ast->slots[object->slots.start + walk->index];
+    if (walk->index > 0) {
+      put(d, "\n");
+      d->indent -= 2;
+      put_indented(d, "},\n");
+    }
+    put_indented(d, "Slot {\n");
+    d->indent += 2;
+
+    put_indented(d, "parent = ");
+    put_long(d, slot->parent);
+    put(d, ",\n");
+    put_indented(d, "mutable = ");
+    put_long(d, slot->mutable);
+    put(d, ",\n");
+    put_indented(d, "arg_index = ");
+    put_long(d, slot->arg_index);
+    put(d, ",\n");
+    put_indented(d, "name = \"");
+    put(d, symbol_name(slot->name));
+    put(d, "\",\n");
+    human_annotation(d, slot->annotation);
+    put_indented(d, "value = ");
+    break;
+  }
+  case RNone:
+  case RReceiver:
+    break;
+  }
+}
+
+static void human_step(struct Dumper *d, const struct AstWalk *walk) {
+  const struct Ast *ast = d->ast;
+
+  switch (walk->step) {
+  case WStmts:
+    put(d, "StmtList {\n");
+    d->indent += 2;
+    put_indented(d, "length = ");
+    put_long(d, walk->stmts.length);
+    put(d, ",\n");
+    put_indented(d, "stmts = [\n");
+    d->indent += 2;
+    break;
+  case WStmtsEnd:
+    if (walk->stmts.length > 0) {
+      put(d, "\n");
+      d->indent -= 2;
+      put_indented(d, "}\n");
+    }
+    d->indent -= 2;
+    put_indented(d, "]\n");
+    d->indent -= 2;
+    put_indented(d, "}\n");
+    break;
+  case WExpr:
+    human_role(d, walk);
+    human_expr(d, walk->expr);
+    break;
+  case WReceiverEnd: {
+    struct MessageExpr *message = ast_message(ast, walk->expr);
+    put(d, ",\n");
+    put_indented(d, "message = \"");
+    put(d, symbol_name(message->message));
+    put(d, "\",\n");
+    put_indented(d, "length = ");
+    put_long(d, message->length);
+    put(d, ",\n");
+    put_indented(d, "args = [\n");
+    d->indent += 2;
+    break;
+  }
+  case WSlotsEnd:
+    if (ast_object(ast, walk->expr)->slots.length > 0) {
+      put(d, "\n");
+      d->indent -= 2;
+      put_indented(d, "},\n");
+    }
+    d->indent -= 2;
+    put_indented(d, "]\n");
+    d->indent -= 2;
+    put_indented(d, "},\n");
+    human_annotation(d, ast_object(ast, walk->expr)->annotation);
+    put_indented(d, "stmts = ");
+    break;
+  case WExprEnd:
+    if (EXPR_TYPE(walk->expr) == EMessage) {
+      if (ast_message(ast, walk->expr)->length > 0)
+        put(d, ",\n");
+      d->indent -= 2;
+      put_indented(d, "]\n");
+    }
+    d->indent -= 2;
+    put_indented(d, "}\n");
+    d->indent -= 2;
+    put_indented(d, "}");
+    break;
+  }
+}
+
+// JSON
+
+static void json_string(struct Dumper *d, const struct Symbol *symbol) {
+  if (!symbol) {
+    put(d, "null");
+    return;
+  }
+
+  put_byte(d, '"');
+  const char *p = symbol->name, *end = p + symbol->length;
+  while (p < end) {
+    // Copy everything up to the next character which has to be escaped.
+    const char *run = p;
+    while (p < end && (unsigned char)*p >= 0x20 && *p != '"' && *p != '\\')
+      p++;
+    put_bytes(d, run, p - run);
+
+    if (p < end) {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)*p++);
+      put(d, escape);
+    }
+  }
+  put_byte(d, '"');
+}
+
+static void json_span(struct Dumper *d, struct SourceSpan span) {
+  put(d, ",\"span\":[");
+  put_long(d, span.offset);
+  put_byte(d, ',');
+  put_long(d, span.length);
+  put_byte(d, ']');
+}
+
+static void json_annotation(struct Dumper *d, uint32_t index) {
+  put(d, ",\"annotation\":");
+  if (index == AST_NONE) {
+    put(d, "null");
+    return;
+  }
+
+  struct Annotation annotation = d->ast->annotations[index];
+  put(d, "{\"category\":");
+  json_string(d, annotation.category);
+  put(d, ",\"comment\":");
+  json_string(d, annotation.comment);
+  put(d, ",\"module\":");
+  json_string(d, annotation.module);
+  put_byte(d, '}');
+}
+
+// Writes the expression if it's an identifier or a number, which have no
+// parts.
+static bool json_leaf(struct Dumper *d, ExprRef expr) {
+  const struct Ast *ast = d->ast;
+
+  switch (EXPR_TYPE(expr)) {
+  case EIdent:
+    put(d, "{\"type\":\"ident\",\"name\":");
+    json_string(d, ast_ident(ast, expr)->ident);
+    put_byte(d, '}');
+    return true;
+  case ENumber: {
+    struct NumberExpr *number = ast_number(ast, expr);
+    if (number->type == NInteger) {
+      put(d, "{\"type\":\"integer\",\"value\":");
+      put_long(d, number->integer);
+    } else {
+      // Enough digits to read back the same double.
+      put(d, "{\"type\":\"float\",\"value\":");
+      put_double(d, "%.17g", number->flt);
+    }
+    put_byte(d, '}');
+    return true;
+  }
+  case EMessage:
+  case EObject:
+    return false;
+  case ENone:
+  case EBinary:
+    break;
+  }
+  fputs("internal error: can't dump expression\n", stderr);
+  abort();
+}
+
+// Writes the expression, which is in the statement or slot at offset, up to
+// its parts, and pushes a frame for them if it has any.
+static void json_expr(struct Dumper *d, ExprRef expr, uint32_t offset) {
+  const struct Ast *ast = d->ast;
+  if (json_leaf(d, expr))
+    return;
+
+  uint32_t start = push_parts(d, expr, offset);
+  if (EXPR_TYPE(expr) == EMessage) {
+    put(d, "{\"type\":\"message\",\"selector\":");
+    json_string(d, ast_message(ast, expr)->message);
+    put(d, ",\"receiver\":");
+  } else {
+    struct ObjectExpr *object = ast_object(ast, expr);
+    put(d, "{\"type\":\"object\"");
+    json_span(d, (struct SourceSpan){start, object->span.length});
+    json_annotation(d, object->annotation);
+    put(d, ",\"slots\":[");
+  }
+}
+
+// Writes the parts of the message on top up to the first one with parts of
+// its own, so that only those take a turn of the loop.
+static void json_message(struct Dumper *d, struct DumpFrame *top) {
+  const struct Ast *ast = d->ast;
+
+  if (top->next == 0) {
+    top->next = 1;
+    ExprRef receiver = ast_message(ast, top->expr)->receiver;
+    if (!json_leaf(d, receiver)) {
+      json_expr(d, receiver, top->offset);
+      return;
+    }
+  }
+  if (top->next == 1) {
+    put(d, ",\"args\":[");
+    top->next = 2;
+  }
+  while (top->next < top->length) {
+    if (top->next > 2)
+      put_byte(d, ',');
+    ExprRef arg = ast->args[top->start + top->next++ - 2];
+    if (!json_leaf(d, arg)) {
+      json_expr(d, arg, top->offset);
+      return;
+    }
+  }
+  put(d, "]}");
+  d->frames.length--;
+}
+
+static void json_slot(struct Dumper *d, struct DumpFrame *top) {
+  bool first = top->next == 0;
+  struct SourceSpan span;
+  const struct Slot *slot = next_slot(d, top, &span);
+  if (!slot) {
+    put(d, first ? "],\"stmts\":[" : "}],\"stmts\":[");
+    return;
+  }
+
+  put(d, first ? "{\"name\":" : "},{\"name\":");
+  json_string(d, slot->name);
+  put(d, slot->parent ? ",\"parent\":true" : ",\"parent\":false");
+  put(d, slot->mutable ? ",\"mutable\":true" : ",\"mutable\":false");
+  put(d, ",\"argument\":");
+  put_long(d, slot->arg_index);
+  json_span(d, span);
+  json_annotation(d, slot->annotation);
+  put(d, ",\"value\":");
+  json_expr(d, slot->value, span.offset);
+}
+
+// The JSON and binary forms have only a few bytes to write for most nodes,
+// so they go through the AST with loops of their own instead of an AstWalk,
+// which would take longer to step than the writing does. Identifiers and
+// numbers are written as they come up, and only statement lists, messages
+// and objects get a frame. An object's frame turns into the one of its
+// statements once its slots are written.
+static void json_stmts(struct Dumper *d, struct StmtList stmts) {
+  const struct Ast *ast = d->ast;
+
+  put_byte(d, '[');
+  push_stmts(d, AST_NONE, stmts, 0);
+  while (d->frames.length) {
+    struct DumpFrame *top = &vec_last(&d->frames);
+    if (!top->stmts) {
+      if (EXPR_TYPE(top->expr) == EMessage)
+        json_message(d, top);
+      else
+        json_slot(d, top);
+    } else if (top->next < top->length) {
+      if (top->next > 0)
+        put_byte(d, ',');
+      const struct Stmt *stmt = &ast->stmts[top->start + top->next++];
+      top->offset += stmt->span.offset;
+      json_expr(d, stmt->expr, top->offset);
+    } else {
+      put(d, top->expr == AST_NONE ? "]" : "]}");
+      d->frames.length--;
+    }
+  }
+}
+
+// Binary form
+
+static void put_varint(struct Dumper *d, uint64_t value) {
+  char *p = reserve(d, 10), *start = p;
+  while (value >= 0x80) {
+    *p++ = (char)(value | 0x80);
+    value >>= 7;
+  }
+  *p++ = (char)value;
+  d->length += p - start;
+}
+
+static void binary_symbol(struct Dumper *d, const struct Symbol *symbol) {
+  if (!symbol) {
+    put_varint(d, 0);
+    return;
+  }
+
+  // Keep the map at most half full.
+  if (2 * (d->symbol_count + 1) > d->symbol_capacity) {
+    const struct Symbol **keys = d->symbols;
+    uint32_t *values = d->symbol_numbers;
+    uint32_t capacity = d->symbol_capacity;
+
+    d->symbol_capacity = capacity ? capacity * 2 : 256;
+    d->symbols = calloc(d->symbol_capacity, sizeof(*d->symbols));
+    d->symbol_numbers = malloc(d->symbol_capacity * sizeof(uint32_t));
+    if (!d->symbols || !d->symbol_numbers)
+      abort();
+
+    uint32_t mask = d->symbol_capacity - 1;
+    for (uint32_t i = 0; i < capacity; i++) {
+      if (!keys[i])
+        continue;
+      uint32_t j = keys[i]->hash & mask;
+      while (d->symbols[j])
+        j = (j + 1) & mask;
+      d->symbols[j] = keys[i];
+      d->symbol_numbers[j] = values[i];
+    }
+    free(keys);
+    free(values);
+  }
+
+  uint32_t mask = d->symbol_capacity - 1;
+  uint32_t i = symbol->hash & mask;
+  while (d->symbols[i] && d->symbols[i] != symbol)
+    i = (i + 1) & mask;
+
+  if (d->symbols[i]) {
+    put_varint(d, (uint64_t)d->symbol_numbers[i] << 1);
+    return;
+  }
+
+  d->symbols[i] = symbol;
+  d->symbol_numbers[i] = ++d->symbol_count;
+  put_varint(d, ((uint64_t)symbol->length << 1) | 1);
+  put_bytes(d, symbol->name, symbol->length);
+}
+
+static void binary_annotation(struct Dumper *d, uint32_t index) {
+  struct Annotation annotation = ast_annotation(d->ast, index);
+  binary_symbol(d, annotation.category);
+  binary_symbol(d, annotation.comment);
+  binary_symbol(d, annotation.module);
+}
+
+static void binary_span(struct Dumper *d, struct SourceSpan span) {
+  put_varint(d, span.offset);
+  put_varint(d, span.length);
+}
+
+// Writes the expression if it's an identifier or a number, which have no
+// parts.
+static bool binary_leaf(struct Dumper *d, ExprRef expr) {
+  const struct Ast *ast = d->ast;
+
+  switch (EXPR_TYPE(expr)) {
+  case EIdent:
+    put_byte(d, DUMP_IDENT);
+    binary_symbol(d, ast_ident(ast, expr)->ident);
+    return true;
+  case ENumber: {
+    struct NumberExpr *number = ast_number(ast, expr);
+    if (number->type == NInteger) {
+      put_byte(d, DUMP_INTEGER);
+      uint64_t bits = number->integer;
+      put_varint(d, (bits << 1) ^ -(bits >> 63));
+    } else {
+      put_byte(d, DUMP_FLOAT);
+      uint64_t bits;
+      memcpy(&bits, &number->flt, sizeof(bits));
+      for (int i = 0; i < 8; i++)
+        put_byte(d, (char)(bits >> (8 * i)));
+    }
+    return true;
+  }
+  case EMessage:
+  case EObject:
+    return false;
+  case ENone:
+  case EBinary:
+    break;
+  }
+  fputs("internal error: can't dump expression\n", stderr);
+  abort();
+}
+
+// Writes the expression, which is in the statement or slot at offset, up to
+// its parts, and pushes a frame for them if it has any.
+static void binary_expr(struct Dumper *d, ExprRef expr, uint32_t offset) {
+  const struct Ast *ast = d->ast;
+  if (binary_leaf(d, expr))
+    return;
+
+  uint32_t start = push_parts(d, expr, offset);
+  if (EXPR_TYPE(expr) == EMessage) {
+    put_byte(d, DUMP_MESSAGE);
+    binary_symbol(d, ast_message(ast, expr)->message);
+  } else {
+    struct ObjectExpr *object = ast_object(ast, expr);
+    put_byte(d, DUMP_OBJECT);
+    binary_annotation(d, object->annotation);
+    binary_span(d, (struct SourceSpan){start, object->span.length});
+    put_varint(d, object->slots.length);
+  }
+}
+
+// Like json_message, but nothing is written at the end of an expression.
+static void binary_message(struct Dumper *d, struct DumpFrame *top) {
+  const struct Ast *ast = d->ast;
+
+  if (top->next == 0) {
+    top->next = 1;
+    ExprRef receiver = ast_message(ast, top->expr)->receiver;
+    if (!binary_leaf(d, receiver)) {
+      binary_expr(d, receiver, top->offset);
+      return;
+    }
+  }
+  if (top->next == 1) {
+    put_varint(d, top->length - 2);
+    top->next = 2;
+  }
+  while (top->next < top->length) {
+    ExprRef arg = ast->args[top->start + top->next++ - 2];
+    if (!binary_leaf(d, arg)) {
+      binary_expr(d, arg, top->offset);
+      return;
+    }
+  }
+  d->frames.length--;
+}
+
+static void binary_slot(struct Dumper *d, struct DumpFrame *top) {
+  struct SourceSpan span;
+  const struct Slot *slot = next_slot(d, top, &span);
+  if (!slot) {
+    put_varint(d, vec_last(&d->frames).length);
+    return;
+  }
+
+  put_byte(d, (slot->parent ? 1 : 0) | (slot->mutable ? 2 : 0));
+  put_varint(d, slot->arg_index);
+  binary_symbol(d, slot->name);
+  binary_annotation(d, slot->annotation);
+  binary_span(d, span);
+  binary_expr(d, slot->value, span.offset);
+}
+
+static void binary_stmts(struct Dumper *d, struct StmtList stmts) {
+  const struct Ast *ast = d->ast;
+
+  put_varint(d, stmts.length);
+  push_stmts(d, AST_NONE, stmts, 0);
+  while (d->frames.length) {
+    struct DumpFrame *top = &vec_last(&d->frames);
+    if (!top->stmts) {
+      if (EXPR_TYPE(top->expr) == EMessage)
+        binary_message(d, top);
+      else
+        binary_slot(d, top);
+    } else if (top->next < top->length) {
+      const struct Stmt *stmt = &ast->stmts[top->start + top->next++];
+      top->offset += stmt->span.offset;
+      binary_expr(d, stmt->expr, top->offset);
+    } else {
+      d->frames.length--;
+    }
+  }
+}
+
+bool dump_format_parse(const char *name, enum DumpFormat *format) {
+  if (strcmp(name, "human") == 0)
+    *format = DHuman;
+  else if (strcmp(name, "json") == 0)
+    *format = DJson;
+  else if (strcmp(name, "binary") == 0)
+    *format = DBinary;
+  else
+    return false;
+  return true;
+}
+
+bool dump_ast(int fd, enum DumpFormat format, const struct Ast *ast,
+              struct StmtList stmts) {
+  struct Dumper d = {.fd = fd, .ast = ast};
+  d.buffer = malloc(DUMP_BUFFER_SIZE);
+  if (!d.buffer)
+    abort();
+  vec_init(&d.frames);
+
+  switch (format) {
+  case DHuman: {
+    struct AstWalk walk;
+    ast_walk_init(&walk, ast);
+    ast_walk_stmts(&walk, stmts);
+    while (ast_walk_next(&walk))
+      human_step(&d, &walk);
+    ast_walk_deinit(&walk);
+    break;
+  }
+  case DJson:
+    json_stmts(&d, stmts);
+    put_byte(&d, '\n');
+    break;
+  case DBinary:
+    put_bytes(&d, DUMP_MAGIC, sizeof(DUMP_MAGIC) - 1);
+    binary_stmts(&d, stmts);
+    break;
+  }
+  flush(&d);
+
+  free(d.buffer);
+  free(d.symbols);
+  free(d.symbol_numbers);
+  vec_deinit(&d.frames);
+  return !d.failed;
+}
@@ -0,0 +1,48 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include <stdbool.h>
+
+#include "ast.h"
+
+// Dumps ASTs to a file descriptor through a large buffer, so that even huge
+// ones are written at about the speed of the file.
+
+enum DumpFormat {
+  DHuman,  // The indented debug form
+  DJson,   // One JSON array of statements, for tools
+  DBinary, // Compact binary, see below
+};
+
+// The binary form starts with DUMP_MAGIC, followed by the statement list.
+// Numbers are unsigned LEB128 varints unless noted otherwise.
+//
+//   stmts:  count, then count exprs
+//   expr:   a tag byte and then
+//     DUMP_MESSAGE  selector symbol, receiver expr, argument count, exprs
+//     DUMP_IDENT    symbol
+//     DUMP_INTEGER  zigzag-encoded varint
+//     DUMP_FLOAT    8 byte little-endian IEEE 754 double
+//     DUMP_OBJECT   annotation, span, slot count, slots, stmts
+//   slot:   flags (1 parent, 2 mutable), argument index, name symbol,
+//           annotation, span, value expr
+//   annotation: category, comment and module symbols
+//   span:   offset, length
+//   symbol: v = 0 for none; odd v for a new symbol, (v >> 1) bytes of name
+//           following; even v for the (v >> 1)th new symbol, counting from 1.
+#define DUMP_MAGIC "mySelfD\x01"
+#define DUMP_MESSAGE 1
+#define DUMP_IDENT 2
+#define DUMP_INTEGER 3
+#define DUMP_FLOAT 4
+#define DUMP_OBJECT 5
+
+// Returns false, and leaves format alone, if there is no such format.
+bool dump_format_parse(const char *name, enum DumpFormat *format);
+
+// Writes the statements and everything in them. Returns false if writing
+// failed.
+bool dump_ast(int fd, enum DumpFormat format, const struct Ast *ast,
+              struct StmtList stmts);
+
+#endif /* DUMP_H */
@@ -1,27 +1,54 @@
 #include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "failure.h"
 #include "lexer.h"
+#include "scan.h"
+
+void failure(struct Lexer *lexer, const char *fmt, ...) {
+  if (lexer->quiet && lexer->failure_jmp)
+    longjmp(*lexer->failure_jmp, 1);
 
-void failure(const char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
 
-  fprintf(stderr, "%s:%d:%d: ", g_lexer.filename, g_lexer.line, g_lexer.column);
-  vfprintf(stderr, fmt, ap);
-  fputc('\n', stderr);
+  char *report = NULL;
+  size_t report_size = 0;
+  FILE *out = open_memstream(&report, &report_size);
+
+  const char *last_newline;
+  long line = lexer->line + scan_newlines(lexer->data,
+                                          lexer->data + lexer->line_base,
+                                          &last_newline);
+  fprintf(out, "%s:%ld:%d: ", lexer->filename, line, lexer->column);
+  vfprintf(out, fmt, ap);
+  fputc('\n', out);
+  va_end(ap);
 
   // Print the relevant line
-  const char *line_start = g_lexer.data + g_lexer.offset - (g_lexer.column);
-  long line_length = strchr(line_start, '\n') - line_start;
-  fwrite(line_start, 1, line_length + 1, stderr);
+  const char *line_start = lexer->data + lexer->offset - (lexer->column);
+  const char *line_end =
+      memchr(line_start, '\n', lexer->data + lexer->size - line_start);
+  if (!line_end)
+    line_end = lexer->data + lexer->size;
+  fwrite(line_start, 1, line_end - line_start, out);
+  fputc('\n', out);
 
   // Print the pointer
-  for (int i = 0; i < g_lexer.column - 1; i++)
-    fputc(' ', stderr);
-  fputs("^\n", stderr);
+  for (int i = 0; i < lexer->column - 1; i++)
+    fputc(' ', out);
+  fputs("^\n", out);
+
+  fclose(out);
+
+  if (!lexer->failure_jmp) {
+    fputs(report, stderr);
+    exit(1);
+  }
 
-  exit(1);
+  free(lexer->error);
+  lexer->error = report;
+  longjmp(*lexer->failure_jmp, 1);
 }
@@ -3,7 +3,11 @@
 
 #include <stdarg.h>
 
-void __attribute__((format(printf, 1, 2))) failure(const char *fmt, ...)
-    __attribute__((noreturn));
+struct Lexer;
+
+// Reports an error at the current position of the lexer and unwinds to the
+// lexer's failure_jmp. See struct Lexer.
+void __attribute__((format(printf, 2, 3)))
+failure(struct Lexer *lexer, const char *fmt, ...) __attribute__((noreturn));
 
 #endif /* FAILURE_H */
@@ -1,157 +1,385 @@
 #include <stdio.h>
 #include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "hash.h"
 
-#define MAX_HASH_LENGTH 64
-// Python: [(67**i) % 2**64 for i in range(1, 64)]
-static uint64_t hash_multipliers[] = { //
-    1ULL,
-    67ULL,
-    4489ULL,
-    300763ULL,
-    20151121ULL,
-    1350125107ULL,
-    90458382169ULL,
-    6060711605323ULL,
-    406067677556641ULL,
-    27206534396294947ULL,
-    1822837804551761449ULL,
-    11449668462710707387ULL,
-    10811279979525778673ULL,
-    4932739753554658067ULL,
-    16898914235099713017ULL,
-    6975865255398123563ULL,
-    6214370268935488321ULL,
-    10534438397067581955ULL,
-    4831097802565029577ULL,
-    10088903518794604187ULL,
-    11873749105694622353ULL,
-    2331194912028978163ULL,
-    8616106516265123993ULL,
-    5430070304767207435ULL,
-    13326573018921417441ULL,
-    7436676729676490979ULL,
-    195250898167001961ULL,
-    13081810177189131387ULL,
-    9484310407322876977ULL,
-    8259498784508002515ULL,
-    18430840424459171641ULL,
-    17381199573934093291ULL,
-    2395494809882498689ULL,
-    12924199672450999235ULL,
-    17371150663577574409ULL,
-    1722217815995733595ULL,
-    4708129229456841169ULL,
-    1850009120545980851ULL,
-    13270146634323407321ULL,
-    3656108961609812939ULL,
-    5151627469633295905ULL,
-    13117647138658896547ULL,
-    11885386825797142697ULL,
-    3110922158897841211ULL,
-    5517599835350293361ULL,
-    744307494278622867ULL,
-    12975113969248628857ULL,
-    2335664475309207467ULL,
-    8915567256040487361ULL,
-    7047195796007001475ULL,
-    10993516489730308425ULL,
-    17142585937258151451ULL,
-    4855125226303947025ULL,
-    11698740909302073203ULL,
-    9052389827437736729ULL,
-    16214308079622709131ULL,
-    16447485059567518049ULL,
-    13623598642160163939ULL,
-    8890649412962954729ULL,
-    5377700309812315131ULL,
-    9817783356943633073ULL,
-    12155442335389109331ULL,
-    2757897227850054073ULL,
-    311673528858106731ULL};
-
-uint64_t hash_string(void *_string) {
-  const char *string = _string;
-  const int m = (int)1e9 + 9;
-
-  uint64_t sum = 0;
-  int c;
-
-  int length = strlen(string);
-  length = length < MAX_HASH_LENGTH ? length : MAX_HASH_LENGTH;
-
-  for (int i = 0; i < length; i++) {
-    if (isupper(string[i])) {
-      c = string[i] - 'A' + 1;
-    } else if (islower(string[i])) {
-      c = string[i] - 'a' + 27;
-    } else if (isdigit(string[i])) {
-      c = string[i] - '0' + 53;
-    } else if (string[i] == ':') {
-      c = 63;
-    } else if (string[i] == '_') {
-      c = 64;
+// The hash is a chain of multiplications by HASH_K1, one for every 8 bytes,
+// in the style of wyhash. Each folds the 128-bit product back to 64 bits, so
+// that every bit of the input reaches every bit of the hash, the low ones
+// included.
+#define HASH_K0 0xa0761d6478bd642fULL
+#define HASH_K1 0xe7037ed1a0b428dbULL
+#define HASH_K2 0x8ebc6af09c88c6e3ULL
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+  __uint128_t product = (__uint128_t)a * b;
+  return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static inline uint64_t load64(const char *data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static inline uint64_t load32(const char *data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+uint64_t hash_bytes(const char *data, long length) {
+  // Mixing in the length keeps the zero padding of the tail apart from
+  // actual zero bytes.
+  uint64_t hash = hash_mix(length ^ HASH_K0, HASH_K1);
+
+  for (; length >= 8; data += 8, length -= 8)
+    hash = hash_mix(hash ^ load64(data), HASH_K1);
+
+  // The last 1 to 7 bytes, with loads which may overlap.
+  uint64_t tail = 0;
+  if (length >= 4) {
+    tail = load32(data) << 32 | load32(data + length - 4);
+  } else if (length > 0) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    tail = (uint64_t)bytes[0] << 16 | (uint64_t)bytes[length / 2] << 8 |
+           bytes[length - 1];
+  }
+
+  return hash_mix(hash ^ tail, HASH_K2);
+}
+
+uint64_t hash_string(void *string) {
+  return hash_bytes(string, strlen(string));
+}
+
+uint64_t hash_pointer(void *pointer) {
+  return hash_mix((uintptr_t)pointer ^ HASH_K0, HASH_K1);
+}
+
+bool hash_string_equal(void *key, void *entry_key) {
+  return strcmp(key, entry_key) == 0;
+}
+
+bool hash_pointer_equal(void *key, void *entry_key) {
+  return key == entry_key;
+}
+
+// Hashtable implementation
+
+// Control bytes. Full entries have the high bit set, and hold the low 7 bits
+// of their hash in the others. Empty is 0, so that new arrays can come from
+// calloc, which for large ones gets pages the kernel zeroes as they are first
+// used, instead of having to fill them all at once.
+#define CONTROL_EMPTY ((int8_t)0)
+#define CONTROL_DELETED ((int8_t)1)
+
+// At most 7/8 of the entries are in use, so that probing stays short, and
+// always finds an empty entry.
+static int max_load(int capacity) {
+  return capacity - capacity / 8;
+}
+
+// The high bits of a hash pick the group where probing starts, and the low 7
+// bits go into the control byte.
+static size_t hash_group(uint64_t hash) { return hash >> 7; }
+static int8_t hash_control(uint64_t hash) { return hash | 0x80; }
+
+// Each of these returns a mask with bit i set if control byte i of the group
+// matches.
+#ifdef __SSE2__
+static inline uint32_t group_match(const int8_t *group, int8_t control) {
+  __m128i bytes = _mm_loadu_si128((const __m128i *)group);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(control)));
+}
+
+// Empty and deleted entries are the ones with the high bit clear.
+static inline uint32_t group_match_free(const int8_t *group) {
+  return ~_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group)) & 0xffff;
+}
+#else
+static inline uint32_t group_match(const int8_t *group, int8_t control) {
+  uint32_t mask = 0;
+  for (int i = 0; i < HASHTABLE_GROUP_SIZE; i++)
+    mask |= (uint32_t)(group[i] == control) << i;
+  return mask;
+}
+
+static inline uint32_t group_match_free(const int8_t *group) {
+  uint32_t mask = 0;
+  for (int i = 0; i < HASHTABLE_GROUP_SIZE; i++)
+    mask |= (uint32_t)(group[i] >= 0) << i;
+  return mask;
+}
+#endif
+
+static inline uint32_t group_match_empty(const int8_t *group) {
+  return group_match(group, CONTROL_EMPTY);
+}
+
+// Probing visits whole groups, jumping 1, 2, 3, ... groups ahead each time.
+// The number of groups is a power of two, so that reaches all of them.
+//
+// A lookup can stop at the first group with an empty entry, because no
+// insert would have gone past it. Removing an entry keeps that true by only
+// emptying it if its group already had an empty entry, and leaving it
+// deleted otherwise.
+
+// Returns the slot of the index which holds the entry for the key, or -1 if
+// there is none.
+static int find(const struct HashTable *t, const struct HashTableIndex *index,
+                void *key, uint64_t hash) {
+  size_t mask = index->capacity / HASHTABLE_GROUP_SIZE - 1;
+  size_t group = hash_group(hash) & mask;
+  int8_t control = hash_control(hash);
+
+  for (size_t step = 1;; step++) {
+    const int8_t *at = index->control + group * HASHTABLE_GROUP_SIZE;
+    uint32_t match = group_match(at, control);
+    while (match) {
+      int slot = group * HASHTABLE_GROUP_SIZE + __builtin_ctz(match);
+      struct HashTableEntry *entry = &t->entries[index->positions[slot]];
+      if (entry->hash == hash && entry->key && t->equal(key, entry->key))
+        return slot;
+      match &= match - 1;
+    }
+    if (group_match_empty(at))
+      return -1;
+
+    group = (group + step) & mask;
+  }
+}
+
+// Returns the first empty or deleted slot where the hash would be probed for.
+static int find_free(const struct HashTableIndex *index, uint64_t hash) {
+  size_t mask = index->capacity / HASHTABLE_GROUP_SIZE - 1;
+  size_t group = hash_group(hash) & mask;
+
+  for (size_t step = 1;; step++) {
+    const int8_t *at = index->control + group * HASHTABLE_GROUP_SIZE;
+    uint32_t match = group_match_free(at);
+    if (match)
+      return group * HASHTABLE_GROUP_SIZE + __builtin_ctz(match);
+
+    group = (group + step) & mask;
+  }
+}
+
+// Returns true if the slot became empty, and false if it is only marked as
+// deleted.
+static bool erase(struct HashTableIndex *index, int slot) {
+  const int8_t *group =
+      index->control + slot / HASHTABLE_GROUP_SIZE * HASHTABLE_GROUP_SIZE;
+  if (group_match_empty(group)) {
+    index->control[slot] = CONTROL_EMPTY;
+    return true;
+  }
+  index->control[slot] = CONTROL_DELETED;
+  return false;
+}
+
+static bool allocate(struct HashTableIndex *index, int capacity) {
+  int8_t *control = calloc(capacity, 1);
+  uint32_t *positions = malloc(capacity * sizeof(*positions));
+  if (!control || !positions) {
+    free(control);
+    free(positions);
+    return false;
+  }
+
+  index->control = control;
+  index->positions = positions;
+  index->capacity = capacity;
+  return true;
+}
+
+static void release(struct HashTableIndex *index) {
+  free(index->control);
+  free(index->positions);
+  *index = (struct HashTableIndex){NULL, NULL, 0};
+}
+
+// Adds the entry at position to the current index, which must have room for
+// it.
+static void insert(struct HashTable *t, uint64_t hash, uint32_t position) {
+  int slot = find_free(&t->index, hash);
+  if (t->index.control[slot] == CONTROL_EMPTY)
+    t->growth_left--;
+  t->index.control[slot] = hash_control(hash);
+  t->index.positions[slot] = position;
+}
+
+// Returns the slot of the index which holds position.
+static int find_position(const struct HashTableIndex *index, uint64_t hash,
+                         uint32_t position) {
+  size_t mask = index->capacity / HASHTABLE_GROUP_SIZE - 1;
+  size_t group = hash_group(hash) & mask;
+  int8_t control = hash_control(hash);
+
+  for (size_t step = 1;; step++) {
+    const int8_t *at = index->control + group * HASHTABLE_GROUP_SIZE;
+    uint32_t match = group_match(at, control);
+    while (match) {
+      int slot = group * HASHTABLE_GROUP_SIZE + __builtin_ctz(match);
+      if (index->positions[slot] == position)
+        return slot;
+      match &= match - 1;
+    }
+
+    group = (group + step) & mask;
+  }
+}
+
+// Moves up to limit entries over to the new index, packing them together on
+// the way, and frees the old index once they are all there. Entries added
+// while rebuilding are already in the new index, and are only moved down.
+//
+// An entry which is moved down leaves a hole behind. Its slot in the old
+// index then points at a hole, or at another entry which is in the new index
+// too, so the old index never finds anything which the new one doesn't.
+static void move_old(struct HashTable *t, int limit) {
+  if (!t->old.capacity)
+    return;
+
+  int end = t->moved + limit;
+  if (end > t->length)
+    end = t->length;
+  for (; t->moved < end; t->moved++) {
+    struct HashTableEntry *entry = &t->entries[t->moved];
+    if (!entry->key)
+      continue;
+    if (t->moved >= t->move_end) {
+      int slot = find_position(&t->index, entry->hash, t->moved);
+      t->index.positions[slot] = t->packed;
     } else {
-      fprintf(stderr, "internal error: hash got unexpected '%c'", string[i]);
-      abort();
+      insert(t, entry->hash, t->packed);
+      t->old_size--;
+    }
+    if (t->packed != t->moved) {
+      t->entries[t->packed] = *entry;
+      entry->key = NULL;
     }
+    t->packed++;
+  }
 
-    sum = (sum + c * hash_multipliers[i]) % m;
+  if (t->moved < t->length)
+    return;
+  release(&t->old);
+  t->length = t->packed;
+  if (t->length < t->entries_capacity / 4) {
+    int capacity = t->entries_capacity / 2;
+    struct HashTableEntry *entries =
+        realloc(t->entries, capacity * sizeof(*entries));
+    if (entries) {
+      t->entries = entries;
+      t->entries_capacity = capacity;
+    }
   }
+}
 
-  return sum;
+// Starts rebuilding the index with the given capacity. A rebuild which is
+// still going on is finished first, but that only happens if the table grows
+// faster than entries are moved.
+static bool rebuild(struct HashTable *t, int capacity) {
+  move_old(t, t->length);
+
+  struct HashTableIndex index;
+  if (!allocate(&index, capacity))
+    return false;
+
+  t->old = t->index;
+  t->index = index;
+  t->moved = 0;
+  t->packed = 0;
+  t->move_end = t->length;
+  t->old_size = t->size;
+  t->growth_left = max_load(capacity);
+  return true;
 }
 
-// Hashtable implementation
+// Returns the position of the entry for the key, or -1 if there is none.
+static int lookup(struct HashTable *t, void *key, uint64_t hash) {
+  int slot = find(t, &t->index, key, hash);
+  if (slot >= 0)
+    return t->index.positions[slot];
+  if (t->old.capacity) {
+    slot = find(t, &t->old, key, hash);
+    if (slot >= 0)
+      return t->old.positions[slot];
+  }
+  return -1;
+}
 
-void hashtable_init(struct HashTable *t, int capacity,
-                    hashtable_hash_func hash) {
-  t->buckets = calloc(capacity, sizeof(struct HashTableBucket *));
-  t->capacity = capacity;
-  t->bucket_size = 0;
+bool hashtable_init(struct HashTable *t, int capacity,
+                    hashtable_hash_func hash, hashtable_equal_func equal) {
+  int size = HASHTABLE_GROUP_SIZE;
+  while (max_load(size) < capacity)
+    size *= 2;
+
+  t->length = 0;
+  t->entries_capacity = max_load(size);
+  t->entries = malloc(t->entries_capacity * sizeof(*t->entries));
+  t->old = (struct HashTableIndex){NULL, NULL, 0};
+  t->moved = 0;
+  t->packed = 0;
+  t->move_end = 0;
   t->size = 0;
-
+  t->old_size = 0;
+  t->growth_left = max_load(size);
+  t->min_capacity = size;
   t->hash = hash;
+  t->equal = equal;
+  if (!t->entries)
+    return false;
+  if (!allocate(&t->index, size)) {
+    free(t->entries);
+    return false;
+  }
+  return true;
 }
 
 void hashtable_deinit(struct HashTable *t) {
-  hashtable_clear(t);
-  free(t->buckets);
+  free(t->entries);
+  release(&t->index);
+  release(&t->old);
 }
 
 bool hashtable_set(struct HashTable *t, void *key, void *value) {
   uint64_t hash = t->hash(key);
-  int bucket = hash % t->capacity;
-
-  // We "slot" the new bucket into the place.
-  struct HashTableBucket **slot = t->buckets + bucket;
-  if (*slot != NULL) {
-    struct HashTableBucket *current = *slot;
-    while (current->next != NULL) {
-      if (current->entry.hash == hash) {
-        printf("Collision epic\n");
-        // Early exit: if the hash matches then we just set the value.
-        current->entry.value = value;
-        return true;
-      }
-
-      current = current->next;
-    }
-    slot = &current->next;
-  } else {
-    t->bucket_size++;
-  }
+  move_old(t, HASHTABLE_MOVE_STEP);
 
-  struct HashTableBucket *b = malloc(sizeof(*b));
-  if (!b)
-    return false;
+  int position = lookup(t, key, hash);
+  if (position >= 0) {
+    t->entries[position].value = value;
+    return true;
+  }
 
-  b->entry.hash = hash;
-  b->entry.value = value;
-  b->next = NULL;
-  *slot = b;
+  // The entries which are only in the old index need room as well. If this
+  // one would take the last of it, the index is rebuilt, and it doubles
+  // unless most of the room went to deleted slots.
+  if (t->growth_left <= t->old_size) {
+    int capacity = t->index.capacity;
+    if (t->size >= max_load(capacity) / 2)
+      capacity *= 2;
+    if (!rebuild(t, capacity))
+      return false;
+  }
+  if (t->length == t->entries_capacity) {
+    int capacity = t->entries_capacity * 2;
+    struct HashTableEntry *entries =
+        realloc(t->entries, capacity * sizeof(*entries));
+    if (!entries)
+      return false;
+    t->entries = entries;
+    t->entries_capacity = capacity;
+  }
 
+  t->entries[t->length] = (struct HashTableEntry){hash, key, value};
+  insert(t, hash, t->length);
+  t->length++;
   t->size++;
 
   return true;
@@ -162,110 +390,72 @@ bool hashtable_has(struct HashTable *t, void *key) {
 }
 
 void *hashtable_get(struct HashTable *t, void *key) {
-  uint64_t hash = t->hash(key);
-  int bucket = hash % t->capacity;
-
-  struct HashTableBucket *b = t->buckets[bucket];
-  while (b != NULL) {
-    if (b->entry.hash == hash)
-      return b->entry.value;
-    b = b->next;
-  }
-
-  return NULL;
+  int position = lookup(t, key, t->hash(key));
+  return position >= 0 ? t->entries[position].value : NULL;
 }
 
 void hashtable_remove(struct HashTable *t, void *key) {
   uint64_t hash = t->hash(key);
-  int bucket = hash % t->capacity;
-
-  struct HashTableBucket *b = t->buckets[bucket];
-  struct HashTableBucket *previous = NULL;
-  if (b == NULL)
+  move_old(t, HASHTABLE_MOVE_STEP);
+
+  int slot = find(t, &t->index, key, hash);
+  int position;
+  if (slot >= 0) {
+    position = t->index.positions[slot];
+    if (erase(&t->index, slot))
+      t->growth_left++;
+  } else if (t->old.capacity && (slot = find(t, &t->old, key, hash)) >= 0) {
+    position = t->old.positions[slot];
+    erase(&t->old, slot);
+    t->old_size--;
+  } else {
     return;
+  }
+  t->entries[position].key = NULL;
+  t->size--;
 
-  do {
-    if (b->entry.hash == hash) {
-      if (previous) {
-        previous->next = b->next;
-      } else {
-        t->buckets[bucket] = b->next;
-        if (b->next == NULL)
-          t->bucket_size--;
-      }
-
-      t->size--;
-      free(b);
-      return;
-    }
-
-    previous = b;
-    b = b->next;
-  } while (b != NULL);
+  // Shrinking and packing wait for a rebuild which is going on to finish.
+  if (t->old.capacity)
+    return;
+  int capacity = t->index.capacity;
+  if (t->size < capacity / 8 && capacity > t->min_capacity)
+    rebuild(t, capacity / 2);
+  else if (t->length - t->size > t->size + HASHTABLE_MOVE_STEP)
+    rebuild(t, capacity);
 }
 
 void hashtable_clear(struct HashTable *t) {
-  for (int i = 0; i < t->capacity; i++) {
-    if (t->buckets[i] != NULL) {
-      struct HashTableBucket *b = t->buckets[i], *temp;
-      while (b != NULL) {
-        temp = b->next;
-        free(b);
-        b = temp;
-      }
-      t->buckets[i] = NULL;
-    }
-  }
-
-  t->bucket_size = 0;
+  release(&t->old);
+  memset(t->index.control, CONTROL_EMPTY, t->index.capacity);
+  t->length = 0;
   t->size = 0;
-}
-
-struct HashTableIterator *hashtable_iterator_alloc(struct HashTable *t) {
-  struct HashTableIterator *it = malloc(sizeof(*it));
-  hashtable_iterator_init(it, t);
-
-  return it;
+  t->old_size = 0;
+  t->growth_left = max_load(t->index.capacity);
 }
 
 void hashtable_iterator_init(struct HashTableIterator *it,
                              struct HashTable *t) {
   it->t = t;
-  it->bucket_id = 0;
-  it->bucket = NULL;
+  it->index = -1;
   it->end = false;
 
-  it->bucket = t->buckets[0];
-  if (it->bucket == NULL)
-    hashtable_iterator_skip(it);
+  hashtable_iterator_skip(it);
 }
 
-void hashtable_iterator_free(struct HashTableIterator *it) { free(it); }
-
 struct HashTableEntry *hashtable_iterator_next(struct HashTableIterator *it) {
   if (it->end)
     return NULL;
-  struct HashTableEntry *entry = &it->bucket->entry;
+  struct HashTableEntry *entry = &it->t->entries[it->index];
   hashtable_iterator_skip(it);
   return entry;
 }
 
 void hashtable_iterator_skip(struct HashTableIterator *it) {
-  while (!it->end) {
-    if (it->bucket == NULL) {
-      it->bucket_id++;
-      if (it->bucket_id >= it->t->capacity) {
-        it->end = true;
-        return;
-      }
-      it->bucket = it->t->buckets[it->bucket_id];
-    } else {
-      it->bucket = it->bucket->next;
-    }
-
-    if (it->bucket != NULL)
+  while (++it->index < it->t->length) {
+    if (it->t->entries[it->index].key)
       return;
   }
+  it->end = true;
 }
 
 #ifdef HASH_TEST
@@ -278,25 +468,82 @@ struct Integer {
   int i;
 };
 
+#define KEYS 100000
+// The table keeps pointers to the keys it was given, so these have to stay.
+static char keys[KEYS][12];
+
+// Makes every key collide.
+static uint64_t hash_constant(void *key) {
+  (void)key;
+  return 42;
+}
+
 int main() {
   srand(time(NULL));
 
   puts("Initialization");
   struct HashTable t;
-  hashtable_init(&t, HASHTABLE_DEFAULT_CAPACITY * 16, hash_string);
+  hashtable_init(&t, HASHTABLE_DEFAULT_CAPACITY * 16, hash_string,
+                 hash_string_equal);
+  for (int i = 0; i < KEYS; i++)
+    sprintf(keys[i], "hash%06d", i);
 
   puts("Insertion");
   char buf[20];
   for (int i = 0; i < 100000; i++) {
-    sprintf(buf, "hash%06d", i);
     struct Integer *in = malloc(sizeof(*in));
     in->i = i;
 
-    assert(hashtable_set(&t, buf, in) && "Failure during hashtable insert");
+    assert(hashtable_set(&t, keys[i], in) && "Failure during hashtable insert");
   }
 
   assert(t.size == 100000 && "Hashtable did not set all items");
 
+  puts("Insertion with room");
+  struct HashTable sized;
+  hashtable_init(&sized, 100000, hash_string, hash_string_equal);
+  struct HashTableEntry *entries = sized.entries;
+  for (int i = 0; i < 100000; i++)
+    hashtable_set(&sized, keys[i], keys[i]);
+  assert(sized.entries == entries && "Insertion allocated");
+  hashtable_deinit(&sized);
+
+  puts("Collisions");
+  struct HashTable colliding;
+  hashtable_init(&colliding, 0, hash_constant, hash_string_equal);
+  for (int i = 0; i < 1000; i++)
+    hashtable_set(&colliding, keys[i], keys[i]);
+  assert(colliding.size == 1000 && "Colliding keys overwrote each other");
+  for (int i = 0; i < 1000; i++) {
+    sprintf(buf, "hash%06d", i);
+    assert(hashtable_get(&colliding, buf) == keys[i] && "Wrong colliding key");
+  }
+  hashtable_deinit(&colliding);
+
+  puts("Growing and shrinking");
+  struct HashTable growing;
+  hashtable_init(&growing, 0, hash_string, hash_string_equal);
+  double slowest = 0;
+  for (int i = 0; i < KEYS; i++) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    hashtable_set(&growing, keys[i], keys[i]);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double us = (end.tv_sec - start.tv_sec) * 1e6 +
+                (end.tv_nsec - start.tv_nsec) / 1e3;
+    slowest = us > slowest ? us : slowest;
+  }
+  printf("Slowest insert: %.1f us, capacity %d\n", slowest,
+         growing.index.capacity);
+  for (int i = 0; i < KEYS; i++)
+    assert(hashtable_get(&growing, keys[i]) == keys[i] && "Lost in growing");
+  for (int i = 0; i < KEYS; i++)
+    hashtable_remove(&growing, keys[i]);
+  assert(growing.size == 0 && growing.index.capacity <= 64 &&
+         "Table didn't shrink");
+  hashtable_deinit(&growing);
+
   puts("Getting");
   for (int i = 0; i < 100000; i++) {
     sprintf(buf, "hash%06d", i);
@@ -315,25 +562,26 @@ int main() {
 
   puts("Re-insertion");
   for (int i = 0; i < 100000; i++) {
-    sprintf(buf, "hash%06d", i);
     struct Integer *in = malloc(sizeof(*in));
     in->i = i;
 
-    assert(hashtable_set(&t, buf, in) && "Failure during hashtable insert");
+    assert(hashtable_set(&t, keys[i], in) && "Failure during hashtable insert");
   }
 
   puts("Iteration");
-  struct HashTableIterator *it = hashtable_iterator_alloc(&t);
+  struct HashTableIterator it;
+  hashtable_iterator_init(&it, &t);
   int i = 0;
-  while (!it->end) {
-    struct HashTableEntry *entry = hashtable_iterator_next(it);
+  while (!it.end) {
+    struct HashTableEntry *entry = hashtable_iterator_next(&it);
 
-    i++;
     printf("Entry: %d\n", ((struct Integer *)entry->value)->i);
+    assert(((struct Integer *)entry->value)->i == i &&
+           "Iterator did not keep the order");
+    i++;
     free(entry->value);
   }
   assert(i == 100000 && "Iterator did not visit all nodes");
-  hashtable_iterator_free(it);
 
   puts("Clearing");
   hashtable_clear(&t);
@@ -7,60 +7,115 @@
 #include <stdint.h>
 #include <string.h>
 
-// Hash functions
+// Hash functions. They work on any bytes, take 8 of them per step, and mix
+// well enough that the low bits of a hash can index a table by themselves.
+uint64_t hash_bytes(const char *data, long length);
 uint64_t hash_string(void *string);
+uint64_t hash_pointer(void *pointer);
 
-// A hashmap implementation. This is a simple singly-linked list hashmap with
-// buckets. The user selects the capacity of the hashmap, which is then
-// initialized with these buckets. Buckets are lazily initialized when a new
-// object is to be inserted.
+// Key equality, for keys hashed with hash_string and hash_pointer.
+bool hash_string_equal(void *key, void *entry_key);
+bool hash_pointer_equal(void *key, void *entry_key);
+
+// A hashmap implementation. The entries are kept in one dense array, in the
+// order they were added, and found through an open addressing index in the
+// style of Abseil's Swiss tables: a position in the array for each slot, and
+// a control byte which says whether the slot is empty, deleted or full, and
+// if it is full, holds 7 more bits of the hash. Lookups probe a group of 16
+// control bytes at a time, with SSE2 where there is one, and only look at the
+// entries whose bits match.
 
 struct HashTableEntry {
   uint64_t hash;
+  // The table doesn't copy keys, so they have to stay around for as long as
+  // their entries do. Keys can't be NULL, that marks removed entries.
+  void *key;
   // Note that primitives such as integers cannot be directly added here.
   // Instead, they must be added by either writing a structure that holds
   // them (boxing), or by heap-allocating a single integer.
   void *value;
 };
 
-struct HashTableBucket {
-  struct HashTableEntry entry;
-  struct HashTableBucket *next;
-};
-
 typedef uint64_t (*hashtable_hash_func)(void *);
+// Called with the key being looked up, and the key of an entry with the same
+// hash.
+typedef bool (*hashtable_equal_func)(void *key, void *entry_key);
 
-struct HashTable {
-  struct HashTableBucket **buckets;
+#define HASHTABLE_GROUP_SIZE 16
+// How many entries each change to a table which is being resized moves over,
+// at most.
+#define HASHTABLE_MOVE_STEP (2 * HASHTABLE_GROUP_SIZE)
+
+// capacity control bytes and positions of entries. capacity is a power of
+// two and a multiple of HASHTABLE_GROUP_SIZE, or 0 if there are none.
+struct HashTableIndex {
+  int8_t *control;
+  uint32_t *positions;
   int capacity;
-  int bucket_size;
+};
+
+// The index grows once 7/8 of it is in use, and shrinks to half its size once
+// less than 1/8 is. Removed entries leave holes in the array, which are
+// packed together when the index is rebuilt, and the index is also rebuilt
+// when there are more holes than entries.
+//
+// Rebuilding never happens all at once: a new index is allocated, and every
+// change to the table moves a few of the entries over to it, until none are
+// left. Until then lookups look at both.
+struct HashTable {
+  struct HashTableEntry *entries;
+  // Including the holes.
+  int length;
+  int entries_capacity;
+
+  struct HashTableIndex index;
+  struct HashTableIndex old;
+  // While rebuilding, the entries before moved are in the new index, at the
+  // positions before packed. Rebuilding is done when moved gets to the
+  // length. The entries from move_end on were added while rebuilding.
+  int moved;
+  int packed;
+  int move_end;
+
   int size;
+  // How many of them are still only in the old index.
+  int old_size;
+  // How many more entries can be added to the index before it is full.
+  // Deleted slots keep using up space until the next rebuild.
+  int growth_left;
+  // The table never shrinks below the capacity it started with.
+  int min_capacity;
 
   hashtable_hash_func hash;
+  hashtable_equal_func equal;
 };
 
 #define HASHTABLE_DEFAULT_CAPACITY 256
-void hashtable_init(struct HashTable *t, int capacity,
-                    hashtable_hash_func hash);
+// The table starts with room for at least capacity entries. Returns false if
+// allocating failed.
+bool hashtable_init(struct HashTable *t, int capacity,
+                    hashtable_hash_func hash, hashtable_equal_func equal);
 void hashtable_deinit(struct HashTable *t);
 
+// Keeps the key, and the place in the order, of an entry which is already
+// there. Returns false if the table had to grow, and allocating failed.
 bool hashtable_set(struct HashTable *t, void *key, void *value);
 bool hashtable_has(struct HashTable *t, void *key);
 void *hashtable_get(struct HashTable *t, void *key);
 void hashtable_remove(struct HashTable *t, void *key);
 void hashtable_clear(struct HashTable *t);
 
+// Visits the entries in the order they were added. The table must not change
+// in the meantime.
 struct HashTableIterator {
   struct HashTable *t;
 
-  int bucket_id;
-  struct HashTableBucket *bucket;
+  // The next entry.
+  int index;
   bool end;
 };
 
-struct HashTableIterator *hashtable_iterator_alloc(struct HashTable *t);
 void hashtable_iterator_init(struct HashTableIterator *it, struct HashTable *t);
-void hashtable_iterator_free(struct HashTableIterator *it);
 
 struct HashTableEntry *hashtable_iterator_next(struct HashTableIterator *it);
 void hashtable_iterator_skip(struct HashTableIterator *it);
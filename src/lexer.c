@@ -1,15 +1,19 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "failure.h"
 #include "lexer.h"
-
-struct Lexer g_lexer;
+#include "scan.h"
 
 const char *token_to_string(enum Tokens token) {
   switch (token) {
   case TNull:
-    failure("internal error: reached null token");
+    return "null token";
   case TParenOpen:
     return "(";
   case TParenClose:
@@ -73,26 +77,185 @@ const char *token_to_string(enum Tokens token) {
   }
 }
 
-void lexer_init(struct Lexer *lexer, const char *fname) {
-  FILE *f = fopen(fname, "r");
+bool lexer_init(struct Lexer *lexer, const char *fname) {
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0)
+    return false;
 
-  fseek(f, 0, SEEK_END);
-  long length = ftell(f);
-  fseek(f, 0, SEEK_SET);
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return false;
+  }
+  long length = st.st_size;
+
+  // Reserve enough anonymous memory for the file and the padding, then map
+  // the file over the start of it. The bytes after the end of the file are
+  // then guaranteed to be zero, which gives the lexer a sentinel and lets it
+  // read a little past the end without checking.
+  long page_size = sysconf(_SC_PAGESIZE);
+  long map_size = (length + LEXER_PADDING + page_size - 1) & ~(page_size - 1);
+
+  char *data = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1, 0);
+  if (data == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
 
-  char *data = malloc(length);
-  fread(data, 1, length, f);
-  fclose(f);
+  if (length > 0 && mmap(data, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd,
+                         0) == MAP_FAILED) {
+    munmap(data, map_size);
+    close(fd);
+    return false;
+  }
+  close(fd);
 
   lexer->filename = fname;
   lexer->line = 1;
   lexer->column = 0;
+  lexer->line_base = 0;
   lexer->size = length;
+  lexer->map_size = map_size;
   lexer->offset = 0;
   lexer->data = data;
+  lexer->buffer = NULL;
+  lexer->capacity = 0;
+  lexer->gap = 0;
+  lexer->gap_length = 0;
+  lexer->current = (struct Token){0};
+  lexer->failure_jmp = NULL;
+  lexer->error = NULL;
+  lexer->quiet = false;
+
+  return true;
+}
+
+void lexer_deinit(struct Lexer *lexer) {
+  if (lexer->buffer)
+    free(lexer->buffer);
+  else
+    munmap((void *)lexer->data, lexer->map_size);
+  lexer->data = NULL;
+}
+
+// Moves the gap to offset in the source.
+static void move_gap(struct Lexer *lexer, long offset) {
+  char *buffer = lexer->buffer;
+  long gap = lexer->gap, gap_length = lexer->gap_length;
+
+  if (offset < gap)
+    memmove(buffer + offset + gap_length, buffer + offset, gap - offset);
+  else
+    memmove(buffer + gap, buffer + gap + gap_length, offset - gap);
+  lexer->gap = offset;
+}
+
+// Copies the source from from to to into dst.
+static void copy_source(const struct Lexer *lexer, char *dst, long from,
+                        long to) {
+  if (from < lexer->gap) {
+    long end = to < lexer->gap ? to : lexer->gap;
+    memcpy(dst, lexer->buffer + from, end - from);
+    dst += end - from;
+    from = end;
+  }
+  if (from < to)
+    memcpy(dst, lexer->data + from, to - from);
+}
+
+void lexer_seek(struct Lexer *lexer, long offset) {
+  if (offset < lexer->gap)
+    move_gap(lexer, offset);
+
+  // Counting the lines up to here would take as long as the source is big,
+  // so only do it if something fails.
+  long gap = lexer->gap;
+  const char *last_newline =
+      memrchr(lexer->data + gap, '\n', offset - gap);
+  if (last_newline) {
+    lexer->column = lexer->data + offset - last_newline - 1;
+  } else {
+    last_newline = gap ? memrchr(lexer->buffer, '\n', gap) : NULL;
+    lexer->column = last_newline ? offset - (last_newline - lexer->buffer) - 1
+                                 : offset;
+  }
+
+  lexer->line = 1;
+  lexer->line_base = offset;
+  lexer->offset = offset;
   lexer->current = (struct Token){0};
+}
+
+void lexer_edit(struct Lexer *lexer, long offset, long length, const char *text,
+                long text_length) {
+  long size = lexer->size - length + text_length;
+
+  if (!lexer->buffer || size + LEXER_PADDING > lexer->capacity) {
+    long capacity = lexer->capacity ? lexer->capacity : lexer->map_size;
+    while (capacity < size + LEXER_PADDING)
+      capacity *= 2;
+
+    // The gap goes where the edit is, and the padding after the source.
+    char *buffer = malloc(capacity);
+    if (!buffer)
+      abort();
+    long gap_length = capacity - LEXER_PADDING - lexer->size;
+    copy_source(lexer, buffer, 0, offset);
+    copy_source(lexer, buffer + gap_length + offset, offset, lexer->size);
+    memset(buffer + capacity - LEXER_PADDING, 0, LEXER_PADDING);
+
+    if (lexer->buffer)
+      free(lexer->buffer);
+    else
+      munmap((void *)lexer->data, lexer->map_size);
+    lexer->buffer = buffer;
+    lexer->capacity = capacity;
+    lexer->gap = offset;
+    lexer->gap_length = gap_length;
+  } else {
+    move_gap(lexer, offset);
+  }
 
-  lexer_lex(lexer);
+  // The replaced text joins the gap, and the new text takes its start.
+  memcpy(lexer->buffer + offset, text, text_length);
+  lexer->gap = offset + text_length;
+  lexer->gap_length += length - text_length;
+  lexer->data = lexer->buffer + lexer->gap_length;
+  lexer->size = size;
+}
+
+// The token each character starts, so that dispatching on the first
+// character of a token is a single lookup. Characters which start
+// identifiers, numbers and strings map to TIdent, TInteger and TString, and
+// < maps to TLess because it might start a <-. Anything else is TNull.
+static const unsigned char token_starts[256] = {
+    ['('] = TParenOpen,    [')'] = TParenClose, ['['] = TBracketOpen,
+    [']'] = TBracketClose, ['{'] = TBraceOpen,  ['}'] = TBraceClose,
+    ['|'] = TPipe,         [':'] = TColon,      ['.'] = TPeriod,
+    ['+'] = TPlus,         ['-'] = TMinus,      ['*'] = TStar,
+    ['/'] = TSlash,        ['%'] = TPercent,    ['!'] = TBang,
+    ['~'] = TTilde,        ['&'] = TAmp,        ['^'] = TCap,
+    ['='] = TEquals,       ['<'] = TLess,       ['>'] = TGreater,
+    ['_'] = TIdent,        ['a' ... 'z'] = TIdent,
+    ['A' ... 'Z'] = TIdent,
+    ['0' ... '9'] = TInteger,
+    ['\''] = TString,
+};
+
+// Updates the line and column after skipping from start to the current
+// offset.
+static void advance_position(struct Lexer *lexer, long start) {
+  const char *last_newline = NULL;
+  long lines = scan_newlines(lexer->data + start, lexer->data + lexer->offset,
+                             &last_newline);
+
+  if (lines) {
+    lexer->line += lines;
+    lexer->column = lexer->data + lexer->offset - last_newline - 1;
+  } else {
+    lexer->column += lexer->offset - start;
+  }
 }
 
 struct Token lexer_lex(struct Lexer *lexer) {
@@ -107,197 +270,130 @@ struct Token lexer_lex(struct Lexer *lexer) {
   } while (0)
 
   if (lexer->current.type == TEOF)
-    failure("tried to lex after EOF");
+    failure(lexer, "tried to lex after EOF");
 
-  // Identifier buffer.
-  char buf[MAX_IDENT + 1];
+  // Number buffer.
+  char buf[MAX_NUMBER + 1];
   int length = 0;
 
-  // Clear the previous ident if there was any.
-  if (lexer->current.type == TIdent)
-    free((void *)lexer->current.ident);
-
-  // Skip whitespace.
+  // Skip whitespace and comments. Line and column are worked out afterwards
+  // for the whole skipped range.
+  long skip_start = lexer->offset;
   while (1) {
-    if (CUR == ' ') {
-      lexer->offset++;
-      lexer->column++;
-    } else if (CUR == '\t') {
-      lexer->offset++;
-      lexer->column++;
-    } else if (CUR == '\n') {
-      lexer->offset++;
-      lexer->line++;
-      lexer->column = 0;
-    } else if (CUR == '"') {
-      // Comments are syntactically important, but for now let's skip them.
-      lexer->offset++;
-      while (CUR != '"') {
-        if (CUR == '\n') {
-          lexer->line++;
-          lexer->column = 0;
-        } else {
-          lexer->column++;
-        }
-
-        lexer->offset++;
-        EOF_CHECK(failure("EOF while scanning comment"));
-      }
-      lexer->offset++;
-      lexer->column++;
-    } else {
+    lexer->offset = scan_whitespace(lexer->data + lexer->offset) - lexer->data;
+    if (CUR != '"')
       break;
+
+    // Comments are syntactically important, but for now let's skip them.
+    const char *end = scan_comment(lexer->data + lexer->offset + 1);
+    // The scan also stops on NUL bytes, which can appear inside comments.
+    while (*end != '"' && end < lexer->data + lexer->size)
+      end = scan_comment(end + 1);
+
+    if (end >= lexer->data + lexer->size) {
+      lexer->offset = lexer->size;
+      advance_position(lexer, skip_start);
+      failure(lexer, "EOF while scanning comment");
     }
 
-    EOF_CHECK(return TOKEN(EOF));
+    lexer->offset = end + 1 - lexer->data;
   }
+  advance_position(lexer, skip_start);
 
-  // Identifier.
-  if (CUR == '_' || (CUR >= 'a' && CUR <= 'z') || (CUR >= 'A' && CUR <= 'Z')) {
-    goto ident_loop;
-    while (CUR == '_' || (CUR >= 'a' && CUR <= 'z') ||
-           (CUR >= 'A' && CUR <= 'Z') || (CUR >= '0' && CUR <= '9')) {
-      if (length == MAX_IDENT) {
-        failure("maximum identifier length reached");
-      }
-
-    ident_loop:
-      buf[length++] = CUR;
-      lexer->offset++;
-      lexer->column++;
+  // The input might end right after a token.
+  EOF_CHECK(return TOKEN(EOF));
 
-      EOF_CHECK(goto ident_out);
-    }
-  ident_out:;
+  long start = lexer->offset;
+  enum Tokens type = token_starts[(unsigned char)CUR];
 
-    const char *copy = strndup(buf, length);
-    return lexer->current = (struct Token){TIdent, .ident = copy};
-  }
+  switch (type) {
+  case TIdent: {
+    // Identifier.
+    lexer->offset = scan_ident(lexer->data + start + 1) - lexer->data;
+    lexer->column += lexer->offset - start;
 
-  // Number (integer or float).
-  if ((CUR >= '0' && CUR <= '9')) {
-    enum Tokens type = TInteger;
-
-    goto number_loop;
-    while ((CUR >= '0' && CUR <= '9') || CUR == '.') {
-      if (length == MAX_IDENT) {
-        failure("maximum number length reached");
-      }
-
-      if (CUR == '.') {
-        // If the next character after the . is a digit, then we consider it
-        // a floating point number. Otherwise, the . is the statement
-        // terminator.
-
-        // Note that a . after a float is just a regular statement terminator.
-        if (type == TFloat) {
-          goto number_out;
-        }
-
-        if (CAN_PEEK && (PEEK >= '0' && PEEK <= '9')) {
-          type = TFloat;
-        } else {
-          goto number_out;
-        }
-      }
-    number_loop:
-      buf[length++] = CUR;
-      lexer->offset++;
-      lexer->column++;
+    return lexer->current = (struct Token){.type = TIdent,
+                                           .offset = start,
+                                           .length = lexer->offset - start};
+  }
 
-      EOF_CHECK(goto number_out);
+  case TInteger: {
+    // Number (integer or float).
+    const char *end = scan_digits(lexer->data + start + 1);
+
+    // If the next character after the . is a digit, then we consider it
+    // a floating point number. Otherwise, the . is the statement
+    // terminator.
+    //
+    // Note that a . after a float is just a regular statement terminator.
+    if (end[0] == '.' && scan_is_digit(end[1])) {
+      type = TFloat;
+      end = scan_digits(end + 1);
     }
 
-  number_out:;
+    length = end - (lexer->data + start);
+    if (length > MAX_NUMBER) {
+      failure(lexer, "maximum number length reached");
+    }
 
+    memcpy(buf, lexer->data + start, length);
     buf[length] = 0;
+    lexer->offset += length;
+    lexer->column += length;
+
     if (type == TInteger) {
-      return lexer->current =
-                 (struct Token){TInteger, .integer = strtol(buf, NULL, 10)};
+      return lexer->current = (struct Token){.type = TInteger,
+                                             .offset = start,
+                                             .length = length,
+                                             .integer = strtol(buf, NULL, 10)};
     } else {
-      return lexer->current = (struct Token){TFloat, .flt = strtod(buf, NULL)};
+      return lexer->current = (struct Token){.type = TFloat,
+                                             .offset = start,
+                                             .length = length,
+                                             .flt = strtod(buf, NULL)};
     }
   }
 
-  // Strings.
-  if (CUR == '\'') {
-    // TODO: support strings longer than 64 characters.
+  case TString: {
+    // Strings.
     lexer->offset++;
     lexer->column++;
-    do {
-      EOF_CHECK(failure("EOF while scanning string literal"));
-
-      if (length == MAX_IDENT)
-        failure("maximum string length reached");
+    start = lexer->offset;
+    while (CUR != '\'') {
+      EOF_CHECK(failure(lexer, "EOF while scanning string literal"));
 
       if (CUR == '\n')
-        failure("unexpected newline in string literal");
+        failure(lexer, "unexpected newline in string literal");
 
-      buf[length++] = CUR;
       lexer->offset++;
       lexer->column++;
-    } while (CUR != '\'');
+    }
 
+    struct Token t = {
+        .type = TString, .offset = start, .length = lexer->offset - start};
     lexer->offset++;
     lexer->column++;
-    buf[length] = '\0';
-
-    struct Token t = {.type = TString, .ident = strdup(buf)};
     return lexer->current = t;
   }
 
-  // The rest is regular tokens.
-  switch (CUR) {
-  case '(':
-    return TOKEN(ParenOpen);
-  case ')':
-    return TOKEN(ParenClose);
-  case '[':
-    return TOKEN(BracketOpen);
-  case ']':
-    return TOKEN(BracketClose);
-  case '{':
-    return TOKEN(BraceOpen);
-  case '}':
-    return TOKEN(BraceClose);
-  case '|':
-    return TOKEN(Pipe);
-  case ':':
-    return TOKEN(Colon);
-  case '.':
-    return TOKEN(Period);
-  case '+':
-    return TOKEN(Plus);
-  case '-':
-    return TOKEN(Minus);
-  case '*':
-    return TOKEN(Star);
-  case '/':
-    return TOKEN(Slash);
-  case '%':
-    return TOKEN(Percent);
-  case '!':
-    return TOKEN(Bang);
-  case '~':
-    return TOKEN(Tilde);
-  case '&':
-    return TOKEN(Amp);
-  case '^':
-    return TOKEN(Cap);
-  case '=':
-    return TOKEN(Equals);
-  case '<': {
+  case TLess:
     if (CAN_PEEK && PEEK == '-') {
-      lexer->offset++;
-      lexer->column++;
-      return TOKEN(LeftArrow);
+      lexer->offset += 2;
+      lexer->column += 2;
+      return lexer->current = (struct Token){
+                 .type = TLeftArrow, .offset = start, .length = 2};
     }
     return TOKEN(Less);
-  }
-  case '>':
-    return TOKEN(Greater);
+
+  case TNull:
+    failure(lexer, "syntax error: unknown character '%c'", CUR);
+
   default:
-    failure("syntax error: unknown character '%c'", CUR);
+    // The rest is single character tokens.
+    lexer->offset++;
+    lexer->column++;
+    return lexer->current =
+               (struct Token){.type = type, .offset = start, .length = 1};
   }
 
   __builtin_unreachable();
@@ -307,7 +403,3 @@ struct Token lexer_lex(struct Lexer *lexer) {
 #undef CAN_PEEK
 #undef EOF_CHECK
 }
-
-struct Token lex() {
-  return lexer_lex(&g_lexer);
-}
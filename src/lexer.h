@@ -2,6 +2,7 @@
 #define LEXER_H
 
 #include <assert.h>
+#include <setjmp.h>
 #include <stdbool.h>
 #include <stdio.h>
 
@@ -45,36 +46,84 @@ enum Tokens {
 
 struct Token {
   enum Tokens type;
+  // The span of the token in the source. For strings this excludes the
+  // quotes.
+  long offset;
+  int length;
   union {
-    const char *ident;
     long integer;
     double flt;
   };
 };
 
+// A slice of the mapped source. Not NUL-terminated.
+struct Span {
+  const char *data;
+  int length;
+};
+
 #define TOKEN(t)                                                               \
-  (lexer->offset++, lexer->column++, lexer->current = (struct Token){T##t, 0})
-#define MAX_IDENT 64
+  (lexer->offset++, lexer->column++,                                           \
+   lexer->current = (struct Token){                                            \
+       .type = T##t, .offset = lexer->offset - 1, .length = 1})
+#define MAX_NUMBER 64
+// The amount of readable zero bytes guaranteed after the end of the source.
+#define LEXER_PADDING 64
 
 const char *token_to_string(enum Tokens token);
 
 struct Lexer {
   const char *filename;
+  // The line is counted from line_base, where the lexer last seeked to.
+  // failure() works out the lines before it.
   int line;
   int column;
-
-  const char *data;
-  long offset; // Actual offset into the file.
-  long size;   // The size of the input.
+  long line_base;
+
+  const char *data; // The memory-mapped source, followed by zero padding.
+  long offset;      // Actual offset into the file.
+  long size;        // The size of the input.
+  long map_size;    // The size of the mapping, including the padding.
+
+  // Once the source is edited it is copied out of the mapping into this
+  // buffer, which is capacity bytes long, padding included. The space the
+  // source doesn't use is a gap at offset gap in it, gap_length bytes long,
+  // so an edit only has to move the text between the gap and itself. data
+  // points gap_length bytes into the buffer, which makes it good for the
+  // source from the gap on, while what comes before is at the start of the
+  // buffer.
+  char *buffer;
+  long capacity;
+  long gap, gap_length;
 
   struct Token current; // The current token.
+
+  // failure() writes its report here and jumps to failure_jmp. If no jump
+  // target is set, the report goes to stderr and the process exits.
+  jmp_buf *failure_jmp;
+  char *error;
+  // Set while failures are expected and their reports thrown away, so that
+  // failure() doesn't bother counting the lines up to them.
+  bool quiet;
 };
 
-void lexer_init(struct Lexer *lexer, const char *fname);
+bool lexer_init(struct Lexer *lexer, const char *fname);
+void lexer_deinit(struct Lexer *lexer);
 struct Token lexer_lex(struct Lexer *lexer);
 
-extern struct Lexer g_lexer;
-
-struct Token lex();
+// Makes the next token the one at offset, which must not be in the middle of
+// a token, string or comment. Seeking to before the gap moves it there, which
+// copies the text in between, since lexing needs the rest of the source in
+// one piece.
+void lexer_seek(struct Lexer *lexer, long offset);
+// Replaces length bytes at offset with text, after moving the gap there.
+// Nothing is lexed; seek to where lexing should pick up again.
+void lexer_edit(struct Lexer *lexer, long offset, long length, const char *text,
+                long text_length);
+
+// Returns the source text of the given token, which must be after the gap.
+static inline struct Span lexer_span(struct Lexer *lexer, struct Token token) {
+  return (struct Span){lexer->data + token.offset, token.length};
+}
 
 #endif /* LEXER_H */
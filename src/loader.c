@@ -0,0 +1,210 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "loader.h"
+
+// A single source file to be loaded.
+struct LoaderJob {
+  char *filename;
+
+  struct Ast ast;
+  // The error report if the file couldn't be loaded.
+  char *error;
+};
+
+struct LoaderPool {
+  struct LoaderJob *jobs;
+  int length;
+  int capacity;
+
+  // The next job to be picked up by a worker.
+  atomic_int next;
+
+  // Whether parsed files are looked up in and written to their cache.
+  bool use_cache;
+};
+
+static void loader_add_job(struct LoaderPool *pool, char *filename) {
+  if (pool->length == pool->capacity) {
+    pool->capacity = pool->capacity ? pool->capacity * 2 : 64;
+    pool->jobs = realloc(pool->jobs, pool->capacity * sizeof(*pool->jobs));
+  }
+
+  pool->jobs[pool->length++] =
+      (struct LoaderJob){.filename = filename, .error = NULL};
+  ast_init(&pool->jobs[pool->length - 1].ast);
+}
+
+static bool has_self_extension(const char *name) {
+  int length = strlen(name);
+  return length > 5 && strcmp(name + length - 5, ".self") == 0;
+}
+
+static int skip_hidden(const struct dirent *entry) {
+  return entry->d_name[0] != '.';
+}
+
+// Adds the path as a job, or all the .self files below it if it is a
+// directory.
+static void loader_add_path(struct LoaderPool *pool, const char *path) {
+  struct stat st;
+  if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+    // Errors are reported when the file is opened.
+    loader_add_job(pool, strdup(path));
+    return;
+  }
+
+  struct dirent **entries;
+  int count = scandir(path, &entries, skip_hidden, alphasort);
+  if (count < 0) {
+    loader_add_job(pool, strdup(path));
+    return;
+  }
+
+  for (int i = 0; i < count; i++) {
+    char *child;
+    if (asprintf(&child, "%s/%s", path, entries[i]->d_name) < 0)
+      abort();
+
+    if (stat(child, &st) == 0 && S_ISDIR(st.st_mode)) {
+      loader_add_path(pool, child);
+      free(child);
+    } else if (has_self_extension(entries[i]->d_name)) {
+      loader_add_job(pool, child);
+    } else {
+      free(child);
+    }
+
+    free(entries[i]);
+  }
+  free(entries);
+}
+
+static void loader_run_job(struct LoaderPool *pool, struct LoaderJob *job) {
+  struct Parser parser;
+  if (!parser_init(&parser, job->filename)) {
+    if (asprintf(&job->error, "%s: %s\n", job->filename, strerror(errno)) < 0)
+      abort();
+    return;
+  }
+
+  uint64_t hash = 0;
+  if (pool->use_cache) {
+    hash = cache_hash(parser.lexer.data, parser.lexer.size);
+    if (cache_load(job->filename, hash, parser.lexer.size, &job->ast)) {
+      parser_deinit(&parser);
+      return;
+    }
+  }
+
+  if (parser_parse(&parser)) {
+    job->ast = parser.ast;
+    ast_init(&parser.ast);
+
+    if (pool->use_cache)
+      cache_store(job->filename, hash, parser.lexer.size, &job->ast);
+  } else {
+    job->error = parser.lexer.error;
+    parser.lexer.error = NULL;
+  }
+
+  // The AST only refers to interned symbols, so the source can go.
+  parser_deinit(&parser);
+}
+
+static void *loader_worker(void *arg) {
+  struct LoaderPool *pool = arg;
+
+  int i;
+  while ((i = atomic_fetch_add(&pool->next, 1)) < pool->length)
+    loader_run_job(pool, &pool->jobs[i]);
+
+  return NULL;
+}
+
+int loader_load(const char **paths, int path_count, int threads,
+                struct Ast *world) {
+  struct LoaderPool pool = {.jobs = NULL, .length = 0, .capacity = 0};
+  atomic_init(&pool.next, 0);
+
+  const char *cache = getenv("MYSELF_CACHE");
+  pool.use_cache = !cache || strcmp(cache, "0") != 0;
+
+  for (int i = 0; i < path_count; i++)
+    loader_add_path(&pool, paths[i]);
+
+  if (threads > pool.length)
+    threads = pool.length;
+
+  if (threads <= 1) {
+    loader_worker(&pool);
+  } else {
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    for (int i = 0; i < threads; i++)
+      pthread_create(&workers[i], NULL, loader_worker, &pool);
+    for (int i = 0; i < threads; i++)
+      pthread_join(workers[i], NULL);
+    free(workers);
+  }
+
+  // Merge the results in order. The top-level statements of each file are
+  // copied to the end afterwards, so that they form a single list.
+  int failed = 0;
+  struct StmtList *roots = malloc(pool.length * sizeof(struct StmtList));
+  ast_init(world);
+
+  for (int i = 0; i < pool.length; i++) {
+    struct LoaderJob *job = &pool.jobs[i];
+
+    if (job->error) {
+      fputs(job->error, stderr);
+      free(job->error);
+      roots[i] = (struct StmtList){0, 0};
+      failed++;
+    } else if (!ast_append(world, &job->ast, &roots[i])) {
+      fprintf(stderr,
+              "%s: too many expressions to fit in one world, at most %" PRIu32
+              " of each kind\n",
+              job->filename, AST_MAX_EXPRS);
+      roots[i] = (struct StmtList){0, 0};
+      failed++;
+    }
+
+    ast_deinit(&job->ast);
+    free(job->filename);
+  }
+
+  // The span of each top-level statement is relative to the one before it,
+  // but the first one of a file is relative to the start of the file, so it
+  // is moved back by where the statement before it is in its own file.
+  world->root.start = world->stmt_count;
+  uint32_t previous = 0;
+  for (int i = 0; i < pool.length; i++) {
+    for (uint32_t j = 0; j < roots[i].length; j++) {
+      struct Stmt stmt = world->stmts[roots[i].start + j];
+      if (j == 0) {
+        uint32_t offset = stmt.span.offset;
+        stmt.span.offset -= previous;
+        previous = offset;
+      } else {
+        previous += stmt.span.offset;
+      }
+      ast_add_stmts(world, &stmt, 1);
+    }
+    world->root.length += roots[i].length;
+  }
+
+  free(roots);
+  free(pool.jobs);
+
+  return failed;
+}
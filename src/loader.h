@@ -0,0 +1,22 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "parser.h"
+
+// Loads a world split across several source files into a single AST. The
+// files are lexed and parsed on a fixed-size pool of worker threads, and
+// their statements are concatenated in the order the files were given in, so
+// the result doesn't depend on which worker finishes first. Directories are
+// searched recursively for .self files, in alphabetical order.
+//
+// Each file is loaded from its cache (see cache.h) if it has an up-to-date
+// one, and its cache is written otherwise. Setting MYSELF_CACHE=0 in the
+// environment turns caching off.
+//
+// Returns the number of files that failed to load. Their errors are printed
+// to stderr, also in order; the statements of the other files are still
+// returned.
+int loader_load(const char **paths, int path_count, int threads,
+                struct Ast *world);
+
+#endif /* LOADER_H */
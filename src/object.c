@@ -1,3 +1,306 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "object.h"
 
-// TODO
+// Compares name with every inline name. The unused ones are NULL, so they
+// can be compared too.
+#ifdef __SSE2__
+static int find_inline(const struct ObjectMap *map,
+                       const struct Symbol *name) {
+  _Static_assert(OBJECT_INLINE_SLOTS == 8, "find_inline compares 8 names");
+  const __m128i *names = (const __m128i *)map->inline_names;
+  __m128i key = _mm_set1_epi64x((long long)(uintptr_t)name);
+
+  // Each pointer is compared as two 32-bit halves, and the results are packed
+  // down to a byte per half, in order.
+  __m128i halves = _mm_packs_epi16(
+      _mm_packs_epi32(_mm_cmpeq_epi32(_mm_loadu_si128(names), key),
+                      _mm_cmpeq_epi32(_mm_loadu_si128(names + 1), key)),
+      _mm_packs_epi32(_mm_cmpeq_epi32(_mm_loadu_si128(names + 2), key),
+                      _mm_cmpeq_epi32(_mm_loadu_si128(names + 3), key)));
+  uint32_t mask = _mm_movemask_epi8(halves);
+
+  // A name matches if both of its halves do.
+  mask &= mask >> 1;
+  mask &= 0x5555;
+  return mask ? __builtin_ctz(mask) / 2 : -1;
+}
+#else
+static int find_inline(const struct ObjectMap *map,
+                       const struct Symbol *name) {
+  for (int i = 0; i < OBJECT_INLINE_SLOTS; i++)
+    if (map->inline_names[i] == name)
+      return i;
+  return -1;
+}
+#endif
+
+int object_map_find(const struct ObjectMap *map, const struct Symbol *name) {
+  if (!map->slot_map)
+    return find_inline(map, name);
+  return (intptr_t)hashtable_get(map->slot_map, (void *)name) - 1;
+}
+
+static struct ObjectMap *map_create(void) {
+  struct ObjectMap *map = calloc(1, sizeof(*map));
+  if (!map)
+    return NULL;
+
+  map->users = 1;
+  map->slot_capacity = OBJECT_INLINE_SLOTS;
+  map->names = map->inline_names;
+  map->slots = map->inline_slots;
+  return map;
+}
+
+static void map_free_heap(struct ObjectMap *map) {
+  if (map->slot_map) {
+    hashtable_deinit(map->slot_map);
+    free(map->slot_map);
+    free(map->names);
+    free(map->slots);
+  }
+}
+
+static void map_release(struct ObjectMap *map) {
+  if (--map->users > 0)
+    return;
+  map_free_heap(map);
+  free(map);
+}
+
+// Moves the slots of a map to the heap, into arrays with room for capacity
+// of them, and indexes them. The map doesn't change if allocating fails.
+static bool map_move_to_heap(struct ObjectMap *map, int capacity) {
+  struct HashTable *slot_map = malloc(sizeof(*slot_map));
+  const struct Symbol **names = malloc(capacity * sizeof(*names));
+  struct ObjectMapSlot *slots = malloc(capacity * sizeof(*slots));
+  bool ok = slot_map && names && slots &&
+            hashtable_init(slot_map, capacity, hash_pointer,
+                           hash_pointer_equal);
+  if (!ok) {
+    free(slot_map);
+    free(names);
+    free(slots);
+    return false;
+  }
+
+  for (int i = 0; i < map->slot_count; i++) {
+    if (!hashtable_set(slot_map, (void *)map->names[i],
+                       (void *)(intptr_t)(i + 1))) {
+      hashtable_deinit(slot_map);
+      free(slot_map);
+      free(names);
+      free(slots);
+      return false;
+    }
+  }
+
+  memcpy(names, map->names, map->slot_count * sizeof(*names));
+  memcpy(slots, map->slots, map->slot_count * sizeof(*slots));
+  map->names = names;
+  map->slots = slots;
+  map->slot_map = slot_map;
+  map->slot_capacity = capacity;
+  return true;
+}
+
+static bool map_grow(struct ObjectMap *map) {
+  int capacity = map->slot_capacity * 2;
+  if (!map->slot_map)
+    return map_move_to_heap(map, capacity);
+
+  const struct Symbol **names = realloc(map->names, capacity * sizeof(*names));
+  if (!names)
+    return false;
+  map->names = names;
+  struct ObjectMapSlot *slots = realloc(map->slots, capacity * sizeof(*slots));
+  if (!slots)
+    return false;
+  map->slots = slots;
+
+  map->slot_capacity = capacity;
+  return true;
+}
+
+// Returns a copy which nothing uses yet but the caller.
+static struct ObjectMap *map_copy(const struct ObjectMap *map) {
+  struct ObjectMap *copy = malloc(sizeof(*copy));
+  if (!copy)
+    return NULL;
+
+  *copy = *map;
+  copy->users = 1;
+  copy->names = copy->inline_names;
+  copy->slots = copy->inline_slots;
+  copy->slot_map = NULL;
+  copy->slot_capacity = OBJECT_INLINE_SLOTS;
+  if (map->slot_map) {
+    // The inline arrays of a map on the heap aren't used, so the copy's
+    // are garbage. Index the slots again from the original arrays.
+    copy->names = map->names;
+    copy->slots = map->slots;
+    if (!map_move_to_heap(copy, map->slot_capacity)) {
+      free(copy);
+      return NULL;
+    }
+  }
+  return copy;
+}
+
+static struct Object *object_alloc(struct ObjectMap *map, int value_capacity) {
+  struct Object *object =
+      malloc(sizeof(*object) + value_capacity * sizeof(Value));
+  if (!object)
+    return NULL;
+
+  object->map = map;
+  object->values = object->inline_values;
+  object->value_capacity = value_capacity;
+  return object;
+}
+
+struct Object *object_create(void) {
+  struct ObjectMap *map = map_create();
+  if (!map)
+    return NULL;
+
+  struct Object *object = object_alloc(map, 0);
+  if (!object)
+    map_release(map);
+  return object;
+}
+
+struct Object *object_clone(const struct Object *object) {
+  int count = object->map->value_count;
+  struct Object *clone = object_alloc(object->map, count);
+  if (!clone)
+    return NULL;
+
+  memcpy(clone->values, object->values, count * sizeof(*clone->values));
+  object->map->users++;
+  return clone;
+}
+
+struct Object *object_box(const struct Object *prototype, uint64_t bits) {
+  struct Object *box = object_alloc(prototype->map, 1);
+  if (!box)
+    return NULL;
+
+  memcpy(box->inline_values, &bits, sizeof(bits));
+  box->value_capacity = 0;
+  prototype->map->users++;
+  return box;
+}
+
+void object_destroy(struct Object *object) {
+  if (object->values != object->inline_values)
+    free(object->values);
+  map_release(object->map);
+  free(object);
+}
+
+struct ObjectSlot object_slot(const struct Object *object, int index) {
+  const struct ObjectMapSlot *slot = &object->map->slots[index];
+  bool mutable = slot->flags & OBJECT_SLOT_MUTABLE;
+  return (struct ObjectSlot){
+      .name = object->map->names[index],
+      .mutable = mutable,
+      .parent = slot->flags & OBJECT_SLOT_PARENT,
+      .value = mutable ? object->values[slot->offset] : slot->value,
+  };
+}
+
+// Gives the object a map which no other object uses.
+static bool own_map(struct Object *object) {
+  if (object->map->users == 1)
+    return true;
+
+  struct ObjectMap *copy = map_copy(object->map);
+  if (!copy)
+    return false;
+  object->map->users--;
+  object->map = copy;
+  return true;
+}
+
+// Makes room for one more value.
+static bool reserve_value(struct Object *object) {
+  int count = object->map->value_count;
+  if (count < object->value_capacity)
+    return true;
+
+  int capacity = count < 4 ? 4 : count * 2;
+  Value *values;
+  if (object->values == object->inline_values) {
+    values = malloc(capacity * sizeof(*values));
+    if (values)
+      memcpy(values, object->values, count * sizeof(*values));
+  } else {
+    values = realloc(object->values, capacity * sizeof(*values));
+  }
+  if (!values)
+    return false;
+
+  object->values = values;
+  object->value_capacity = capacity;
+  return true;
+}
+
+// Removes the value at offset, and moves the ones after it down to keep the
+// values dense. The object has to be the only user of its map.
+static void remove_value(struct Object *object, int offset) {
+  struct ObjectMap *map = object->map;
+  memmove(object->values + offset, object->values + offset + 1,
+          (map->value_count - offset - 1) * sizeof(*object->values));
+  map->value_count--;
+
+  for (int i = 0; i < map->slot_count; i++) {
+    struct ObjectMapSlot *slot = &map->slots[i];
+    if ((slot->flags & OBJECT_SLOT_MUTABLE) && slot->offset > offset)
+      slot->offset--;
+  }
+}
+
+bool object_add_slot(struct Object *object, struct ObjectSlot slot) {
+  uint8_t flags = (slot.mutable ? OBJECT_SLOT_MUTABLE : 0) |
+                  (slot.parent ? OBJECT_SLOT_PARENT : 0);
+  if (!own_map(object))
+    return false;
+  struct ObjectMap *map = object->map;
+
+  // Everything which can fail happens before anything changes.
+  int index = object_map_find(map, slot.name);
+  bool was_mutable =
+      index >= 0 && (map->slots[index].flags & OBJECT_SLOT_MUTABLE);
+  if (index < 0 && map->slot_count == map->slot_capacity && !map_grow(map))
+    return false;
+  if (slot.mutable && !was_mutable && !reserve_value(object))
+    return false;
+  if (index < 0) {
+    index = map->slot_count;
+    if (map->slot_map &&
+        !hashtable_set(map->slot_map, (void *)slot.name,
+                       (void *)(intptr_t)(index + 1)))
+      return false;
+    map->names[index] = slot.name;
+    map->slot_count++;
+  }
+
+  struct ObjectMapSlot *map_slot = &map->slots[index];
+  if (slot.mutable) {
+    if (!was_mutable)
+      map_slot->offset = map->value_count++;
+    object->values[map_slot->offset] = slot.value;
+  } else {
+    if (was_mutable)
+      remove_value(object, map_slot->offset);
+    map_slot->value = slot.value;
+  }
+  map_slot->flags = flags;
+  return true;
+}
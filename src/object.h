@@ -1,25 +1,135 @@
 #ifndef OBJECT_H
 #define OBJECT_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ast.h"
 #include "hash.h"
+#include "symbol.h"
+#include "value.h"
 
-// A slot within an object. Held in a slot map
+// A slot within an object.
 struct ObjectSlot {
   // The exact name of the slot. Keyword messages look like foo:WithBar:.
-  const char *name;
+  const struct Symbol *name;
   // Whether this slot has an implicit slot accepting a value in order to change
   // the current value.
   bool mutable;
   // Whether the object in slot will be searched for slots.
   bool parent;
   // The value of this slot.
-  struct Object *value;
+  Value value;
+};
+
+// Objects don't describe their own slots. That is done by a map, which
+// clones share: it holds the names and flags of the slots, the values of the
+// constant ones, and where in the object the values of the mutable ones are.
+// An object is its map and the values of its mutable slots, so cloning one
+// copies those values and nothing else, and anything found out about an
+// object's slots holds for every object with the same map.
+
+// Most maps only have a few slots, so up to OBJECT_INLINE_SLOTS of them are
+// stored in arrays inside the map, and a lookup compares the name with all
+// of them at once, with SSE2 where there is one. Names are interned, so
+// comparing the pointers is enough. Maps with more slots move them to the
+// heap and index them by name with a hashtable.
+#define OBJECT_INLINE_SLOTS 8
+
+#define OBJECT_SLOT_MUTABLE 1
+#define OBJECT_SLOT_PARENT 2
+
+struct ObjectMapSlot {
+  // OBJECT_SLOT_* flags.
+  uint8_t flags;
+  union {
+    // For mutable slots, the position of the value in the object.
+    int offset;
+    // For constant ones, the value.
+    Value value;
+  };
+};
+
+// The slots are kept in the order they were added. The names are in a
+// separate array, so that they can be compared all at once.
+//
+// A map which more than one object uses never changes. Changing the slots of
+// one of those objects gives it its own copy of the map first.
+struct ObjectMap {
+  // The objects which use the map.
+  int users;
+
+  int slot_count;
+  int slot_capacity;
+  // The number of mutable slots, which is the number of values every object
+  // with the map has.
+  int value_count;
+
+  // The code of a method, which runs when the method is found by a lookup.
+  // NULL for data objects.
+  const struct ObjectExpr *code;
+
+  // These point to the inline arrays until there are more than
+  // OBJECT_INLINE_SLOTS slots.
+  const struct Symbol **names;
+  struct ObjectMapSlot *slots;
+  // The position of each slot plus one, by name, once the slots are on the
+  // heap. NULL before.
+  struct HashTable *slot_map;
+
+  // Unused names are NULL, which never matches a name being looked up.
+  const struct Symbol *inline_names[OBJECT_INLINE_SLOTS];
+  struct ObjectMapSlot inline_slots[OBJECT_INLINE_SLOTS];
 };
 
 struct Object {
-  struct HashMap *slot_map;
+  struct ObjectMap *map;
+
+  // The values of the mutable slots, in the order of their offsets. They
+  // start out right behind the object, with room for as many as its map had
+  // when it was made, and move to the heap if it gets more.
+  Value *values;
+  int value_capacity;
+  Value inline_values[];
 };
 
-struct Object *create_object(void);
+// Returns the position of the slot called name, or -1 if there is none.
+int object_map_find(const struct ObjectMap *map, const struct Symbol *name);
+
+// These return NULL if allocating failed. A new object has no slots and a map
+// of its own.
+struct Object *object_create(void);
+struct Object *object_clone(const struct Object *object);
+void object_destroy(struct Object *object);
+
+// Boxes hold a number which doesn't fit in a value, as 64 bits right behind
+// the object, where its values would start. They are clones of a prototype
+// without mutable slots, and have no room for values, so if one gets some
+// they go to the heap.
+struct Object *object_box(const struct Object *prototype, uint64_t bits);
+
+static inline uint64_t object_box_bits(const struct Object *box) {
+  uint64_t bits;
+  memcpy(&bits, box->inline_values, sizeof(bits));
+  return bits;
+}
+
+// Replaces the slot with the same name, keeping its place, or adds the slot
+// at the end. Returns false if allocating failed.
+bool object_add_slot(struct Object *object, struct ObjectSlot slot);
+
+static inline int object_find_slot(const struct Object *object,
+                                   const struct Symbol *name) {
+  return object_map_find(object->map, name);
+}
+
+struct ObjectSlot object_slot(const struct Object *object, int index);
+
+// Only for mutable slots. Constant ones are changed with object_add_slot.
+static inline void object_set_value(struct Object *object, int index,
+                                    Value value) {
+  object->values[object->map->slots[index].offset] = value;
+}
 
 #endif /* OBJECT_H */
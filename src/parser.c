@@ -1,229 +1,365 @@
 #include <ctype.h>
+#include <inttypes.h>
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "ast.h"
 #include "failure.h"
 #include "lexer.h"
 #include "parser.h"
-#include "stack.h"
+#include "vec.h"
 
-void _assert_token(int line, struct Token got, enum Tokens expected) {
+static struct Token lex(struct Parser *parser) {
+  parser->previous_end =
+      parser->lexer.current.offset + parser->lexer.current.length;
+  return lexer_lex(&parser->lexer);
+}
+
+// The span from start to the end of the last token parsed.
+static struct SourceSpan span_since(struct Parser *parser, long start) {
+  return (struct SourceSpan){.offset = start,
+                             .length = parser->previous_end - start};
+}
+
+void _assert_token(struct Parser *parser, int line, struct Token got,
+                   enum Tokens expected) {
   if (got.type != expected) {
     // TODO: recover from syntax error?
-    failure("syntax error: expected %s, got %s (%d)", token_to_string(expected),
-            token_to_string(got.type), line);
+    failure(&parser->lexer, "syntax error: expected %s, got %s (%d)",
+            token_to_string(expected), token_to_string(got.type), line);
   }
 }
 
-#define assert_token(got, expected) _assert_token(__LINE__, got, expected)
+#define assert_token(got, expected)                                           \
+  _assert_token(parser, __LINE__, got, expected)
+
+#define CURRENT_SPAN() lexer_span(&parser->lexer, parser->lexer.current)
+
+// Interns the text of the current token.
+static const struct Symbol *intern_current(struct Parser *parser) {
+  struct Span span = CURRENT_SPAN();
+  return symbol_intern(span.data, span.length);
+}
+
+#define MAX_ANNOTATION_DEPTH 32
+
+static void name_append(struct Parser *parser, const char *data, int length) {
+  vec_append(&parser->names, data, length);
+}
 
-struct IdentExpr *parse_ident_expr() {
+// Appends a keyword part followed by a colon to the name being built.
+static void name_append_keyword(struct Parser *parser, struct Span part) {
+  name_append(parser, part.data, part.length);
+  name_append(parser, ":", 1);
+}
+
+// Interns the name built since start and pops it off the buffer.
+static const struct Symbol *name_intern(struct Parser *parser, int start) {
+  const struct Symbol *symbol = symbol_intern(
+      parser->names.data + start, parser->names.length - start);
+  parser->names.length = start;
+  return symbol;
+}
+
+ExprRef parse_ident_expr(struct Parser *parser) {
   // Lexer pre-condition: standing on the ident.
 
-  assert_token(g_lexer.current, TIdent);
-  struct IdentExpr *ident = malloc(sizeof(*ident));
-  ident->ident = strdup(g_lexer.current.ident);
+  assert_token(parser->lexer.current, TIdent);
+  ExprRef ident = ast_add_ident(&parser->ast, intern_current(parser));
 
-  lex();
+  lex(parser);
   return ident;
 }
 
-struct NumberExpr *parse_number_expr() {
+ExprRef parse_number_expr(struct Parser *parser) {
   // Lexer pre-condition: standing on either an integer or float.
-  if (g_lexer.current.type != TInteger && g_lexer.current.type != TFloat)
-    assert_token(g_lexer.current, TInteger);
-
-  struct NumberExpr *number = malloc(sizeof(*number));
-  number->type = g_lexer.current.type == TInteger ? NInteger : NFloat;
-  if (number->type == NInteger) {
-    number->integer = g_lexer.current.integer;
+  if (parser->lexer.current.type != TInteger &&
+      parser->lexer.current.type != TFloat)
+    assert_token(parser->lexer.current, TInteger);
+
+  struct NumberExpr number;
+  number.type = parser->lexer.current.type == TInteger ? NInteger : NFloat;
+  if (number.type == NInteger) {
+    number.integer = parser->lexer.current.integer;
   } else {
-    number->flt = g_lexer.current.flt;
+    number.flt = parser->lexer.current.flt;
   }
 
-  lex();
-  return number;
+  lex(parser);
+  return ast_add_number(&parser->ast, number);
 }
 
-struct Slot parse_slot(struct Stack *annotations) {
-  struct Slot slot = {.parent = false, .mutable = false, .arg_index = 0};
+// A result handed from a frame which is done to the one below it.
+union ParseResult {
+  ExprRef expr;
+  struct Slot slot;
+  struct StmtList stmts;
+};
+
+// Pushes a frame for something which starts at the current token. This can
+// move the frames, so the frame doing the pushing must not be used after.
+static void push_frame(struct Parser *parser, struct ParseFrame frame) {
+  vec_push(&parser->frames, frame);
+}
 
-  char *slot_name = NULL;
-  int name_length = 0;
-  char **param_names = NULL;
-  int param_length = 0;
+static void push_expr(struct Parser *parser) {
+  push_frame(parser, (struct ParseFrame){.type = PExpr});
+}
 
-  // Get the slot name.
-  assert_token(g_lexer.current, TIdent);
+// Makes the spans of the object literals parsed since start relative to the
+// statement or slot they are in, which starts at offset, and pops them.
+static void relocate_objects(struct Parser *parser, int start, long offset) {
+  for (int i = start; i < parser->object_stack.length; i++) {
+    ExprRef object = parser->object_stack.data[i];
+    ast_object(&parser->ast, object)->span.offset -= offset;
+  }
+  parser->object_stack.length = start;
+}
+
+// Statement lists
+
+static bool step_stmts(struct Parser *parser, struct ParseFrame *frame,
+                       union ParseResult *result) {
+  // Lexer pre-condition: standing on the first token of the first statement.
+
+  if (frame->state == SBegin) {
+    frame->stmts.stmt_start = parser->stmt_stack.length;
+    frame->stmts.object_start = parser->object_stack.length;
+  } else {
+    long start = frame->stmts.start;
+    struct Stmt stmt = {.expr = result->expr,
+                        .span = span_since(parser, start)};
+    relocate_objects(parser, frame->stmts.object_start, start);
+    vec_push(&parser->stmt_stack, stmt);
+    if (parser->lexer.current.type != TParenClose) {
+      assert_token(parser->lexer.current, TPeriod);
+      lex(parser);
+    }
+  }
 
-  while (g_lexer.current.type == TIdent) {
-    int ident_len = strlen(g_lexer.current.ident);
-    slot_name = realloc(slot_name, name_length + ident_len + 2);
-    strcpy(slot_name + name_length, g_lexer.current.ident);
-    name_length += ident_len;
+  if (parser->lexer.current.type !=
+      (frame->stmts.eof ? TEOF : TParenClose)) {
+    frame->state = SStmt;
+    frame->stmts.start = parser->lexer.current.offset;
+    push_expr(parser);
+    return false;
+  }
 
-    if (lex().type != TColon) {
-      slot_name[name_length] = '\0';
+  // Each statement is relative to the one before it.
+  int start = frame->stmts.stmt_start;
+  struct Stmt *stmts = parser->stmt_stack.data + start;
+  result->stmts.length = parser->stmt_stack.length - start;
+  for (uint32_t i = result->stmts.length; i-- > 1;)
+    stmts[i].span.offset -= stmts[i - 1].span.offset;
+  if (result->stmts.length)
+    stmts[0].span.offset -= frame->stmts.base;
+
+  result->stmts.start = ast_add_stmts(
+      &parser->ast, parser->stmt_stack.data + start, result->stmts.length);
+  parser->stmt_stack.length = start;
+  return true;
+}
 
-      if (param_length != 0) {
+// Slots
+
+// Parses the slot up to its value.
+static void begin_slot(struct Parser *parser, struct ParseFrame *frame) {
+  struct Slot *slot = &frame->slot.slot;
+  *slot = (struct Slot){.parent = false,
+                        .mutable = false,
+                        .arg_index = 0,
+                        .annotation = AST_NONE};
+  frame->slot.start = parser->lexer.current.offset;
+  frame->slot.name_start = parser->names.length;
+  frame->slot.param_start = parser->param_stack.length;
+  frame->slot.object_start = parser->object_stack.length;
+  int params = 0;
+
+  // Get the slot name.
+  assert_token(parser->lexer.current, TIdent);
+
+  while (parser->lexer.current.type == TIdent) {
+    struct Span part = CURRENT_SPAN();
+
+    if (lex(parser).type != TColon) {
+      if (params != 0) {
         // We need either a unary message or a keyword one.
         // Mixing them is illegal.
-        assert_token(g_lexer.current, TColon);
+        assert_token(parser->lexer.current, TColon);
       } else {
         // Unary message
-        slot.name = slot_name;
+        slot->name = symbol_intern(part.data, part.length);
         break;
       }
     } else {
       // Keyword message. Look for an ident.
-      slot_name[name_length++] = ':';
-      slot_name[name_length] = '\0';
-
-      assert_token(lex(), TIdent);
-      param_names = realloc(param_names, (param_length + 1) * sizeof(char *));
-      param_names[param_length++] = strdup(g_lexer.current.ident);
-      lex();
+      name_append_keyword(parser, part);
+
+      assert_token(lex(parser), TIdent);
+      struct Slot param = {.mutable = false,
+                           .parent = false,
+                           .arg_index = ++params,
+                           .name = intern_current(parser),
+                           .annotation = AST_NONE,
+                           .span = {.offset = parser->lexer.current.offset,
+                                    .length = parser->lexer.current.length}};
+      vec_push(&parser->param_stack, param);
+      lex(parser);
     }
   }
 
-  slot.name = slot_name;
+  if (params > 0)
+    slot->name = name_intern(parser, frame->slot.name_start);
 
   // Assign the slot attributes.
-  if (g_lexer.current.type == TStar) {
-    slot.parent = true;
-    lex();
+  if (parser->lexer.current.type == TStar) {
+    slot->parent = true;
+    lex(parser);
   }
 
-  if (g_lexer.current.type == TLeftArrow) {
-    slot.mutable = true;
-  } else if (g_lexer.current.type != TEquals) {
-    failure("syntax error: expected = or <- for slot assignment, got %s",
-            token_to_string(g_lexer.current.type));
+  if (parser->lexer.current.type == TLeftArrow) {
+    slot->mutable = true;
+  } else if (parser->lexer.current.type != TEquals) {
+    failure(&parser->lexer,
+            "syntax error: expected = or <- for slot assignment, got %s",
+            token_to_string(parser->lexer.current.type));
   }
-  lex();
+  lex(parser);
+}
+
+// Finishes the slot once its value has been parsed.
+static void end_slot(struct Parser *parser, struct ParseFrame *frame,
+                     ExprRef value) {
+  struct Slot *slot = &frame->slot.slot;
+  int param_start = frame->slot.param_start;
+  int params = parser->param_stack.length - param_start;
 
-  slot.value = parse_expr();
-  if (param_length > 0) {
+  slot->value = value;
+  slot->span = span_since(parser, frame->slot.start);
+  if (params > 0) {
     // Keyword slots require an object with code in it.
-    if (slot.value.type != EObject)
-      failure("syntax error: expected an object after keyword slot");
+    if (EXPR_TYPE(slot->value) != EObject)
+      failure(&parser->lexer,
+              "syntax error: expected an object after keyword slot");
 
-    // Inject the parameters.
-    struct ObjectExpr *object = slot.value.object;
+    // Inject the parameters. The object was the last thing to be parsed, so
+    // its slots are the last ones in the AST and can simply be extended.
+    struct ObjectExpr *object = ast_object(&parser->ast, slot->value);
 
     if (!object->stmts.length)
-      failure("syntax error: empty objects cannot have arguments");
-
-    object->slots.slots =
-        realloc(object->slots.slots,
-                (object->slots.length + param_length) * sizeof(struct Slot));
-    for (int i = 0; i < param_length; i++) {
-      // This will cost us one IdentExpr alloc per new slot to initialize
-      // them to nil. TODO: consider adding a NilExpr to avoid allocs?
-      struct IdentExpr *ident = malloc(sizeof(struct IdentExpr));
-      // TODO: owned parameter in identexpr to avoid duplicating constant
-      // strings.
-      ident->ident = strdup("nil");
-
-      object->slots.slots[object->slots.length + i] =
-          (struct Slot){.mutable = false,
-                        .parent = false,
-                        .arg_index = i + 1,
-                        .name = param_names[i],
-                        .value = (struct Expr){.type = EIdent, .ident = ident},
-                        .annotation = {0}};
+      failure(&parser->lexer,
+              "syntax error: empty objects cannot have arguments");
+    if (object->slots.start + object->slots.length != parser->ast.slot_count)
+      failure(&parser->lexer, "internal error: method slots aren't last");
+
+    // Their spans are in the selector, before the object they are
+    // relative to.
+    struct Slot *param = parser->param_stack.data + param_start;
+    for (int i = 0; i < params; i++) {
+      // This will cost us one IdentExpr per new slot to initialize them to
+      // nil. TODO: consider adding a NilExpr?
+      param[i].value = ast_add_ident(&parser->ast, symbol_intern("nil", 3));
+      param[i].span.offset -= object->span.offset;
     }
-    object->slots.length += param_length;
-
-    free(param_names);
+    ast_add_slots(&parser->ast, param, params);
+    // The AST may have moved.
+    ast_object(&parser->ast, slot->value)->slots.length += params;
+    parser->param_stack.length = param_start;
   }
+  relocate_objects(parser, frame->slot.object_start, frame->slot.start);
 
   // Add slot annotations.
-  if (!stack_empty(annotations)) {
+  int annotation_start = frame->slot.annotation_start;
+  if (parser->annotation_stack.length > annotation_start) {
     // We pick up the most recent comment and module, but concatenate
     // all categories. (Right now with \x7f, because that's what Self used,
     // but in the future I'd like to go with something more Unicode-friendly.)
-    struct Annotation *top = stack_top(annotations);
-    if (top->comment)
-      slot.annotation.comment = strdup(top->comment);
-    if (top->module)
-      slot.annotation.module = strdup(top->module);
+    struct Annotation *top = &vec_last(&parser->annotation_stack);
+    struct Annotation annotation = {.comment = top->comment,
+                                    .module = top->module};
 
-    char *category = NULL;
-    int length = 0;
+    const struct Symbol *category = NULL;
+    int categories = 0;
+    int category_start = parser->names.length;
 
-    for (int i = 0; i < annotations->length; i++) {
-      struct Annotation *annot = annotations->data[i];
+    for (int i = annotation_start; i < parser->annotation_stack.length; i++) {
+      struct Annotation *annot = &parser->annotation_stack.data[i];
       if (!annot->category)
         continue;
 
-      int cat_length = strlen(annot->category);
-      category = realloc(category, length + cat_length + 2);
+      if (categories++ > 0)
+        name_append(parser, "\x7f", 1);
+      name_append(parser, annot->category->name, annot->category->length);
+      category = annot->category;
+    }
 
-      strcpy(category + length, annot->category);
-      length += cat_length;
+    // A single category is already interned.
+    if (categories > 1)
+      category = name_intern(parser, category_start);
+    else
+      parser->names.length = category_start;
 
-      category[length++] = 0x7f;
-      category[length] = 0;
-    }
+    annotation.category = category;
+    slot->annotation = ast_add_annotation(&parser->ast, annotation);
+  }
+}
 
-    if (category)
-      category[--length] = 0;
+static bool step_slot(struct Parser *parser, struct ParseFrame *frame,
+                      union ParseResult *result) {
+  // Lexer pre-condition: standing on the slot name.
 
-    slot.annotation.category = category;
+  if (frame->state == SBegin) {
+    begin_slot(parser, frame);
+    frame->state = SValue;
+    push_expr(parser);
+    return false;
   }
 
-  return slot;
+  end_slot(parser, frame, result->expr);
+  result->slot = frame->slot.slot;
+  return true;
 }
 
-enum AnnotationType parse_annotation(char const **annot_str) {
+enum AnnotationType parse_annotation(struct Parser *parser,
+                                     const struct Symbol **annot_str) {
   enum AnnotationType type = AComment;
 
-  if (g_lexer.current.type == TStar) {
+  if (parser->lexer.current.type == TStar) {
     type = ACategory;
-    lex();
-  } else if (g_lexer.current.type == TLeftArrow) {
+    lex(parser);
+  } else if (parser->lexer.current.type == TLeftArrow) {
     type = AModule;
-    lex();
+    lex(parser);
   }
 
-  if (g_lexer.current.type != TString) {
-    failure("syntax error: expected *, <- or string for annotation");
+  if (parser->lexer.current.type != TString) {
+    failure(&parser->lexer,
+            "syntax error: expected *, <- or string for annotation");
   }
 
-  *annot_str = strdup(g_lexer.current.ident);
-  lex();
+  *annot_str = intern_current(parser);
+  lex(parser);
   return type;
 }
 
-struct SlotList parse_slot_list(struct Annotation *object_annot) {
-  // Lexer pre-condition: standing on the opening |.
-
-  assert_token(g_lexer.current, TPipe);
-  lex();
-
-  *object_annot = (struct Annotation){0};
+// Parses the slot list of the object up to its next slot, and returns
+// whether there is one. Otherwise the slot list is over.
+static bool next_slot(struct Parser *parser, struct ParseFrame *frame) {
+  struct Annotation *object_annot = &frame->object.annotation;
+  int annotation_start = frame->object.annotation_start;
 
-  struct SlotList slots = {0};
-
-  struct Stack annotation_stack;
-  stack_init(&annotation_stack, 32);
-
-  while (g_lexer.current.type != TPipe) {
-    slots.slots =
-        realloc(slots.slots, (slots.length + 1) * sizeof(struct Slot));
-
-    if (g_lexer.current.type == TBraceOpen) {
-      puts("Adding to the annotation stack");
+  while (parser->lexer.current.type != TPipe) {
+    if (parser->lexer.current.type == TBraceOpen) {
       // Parse the annotation.
-      if (lex().type == TBraceClose) {
+      if (lex(parser).type == TBraceClose) {
         // We are annotating the object.
-        assert_token(lex(), TEquals);
-        lex();
+        assert_token(lex(parser), TEquals);
+        lex(parser);
 
-        const char *annot_str = NULL;
-        switch (parse_annotation(&annot_str)) {
+        const struct Symbol *annot_str = NULL;
+        switch (parse_annotation(parser, &annot_str)) {
         case ACategory:
           object_annot->category = annot_str;
           break;
@@ -234,297 +370,739 @@ struct SlotList parse_slot_list(struct Annotation *object_annot) {
           object_annot->module = annot_str;
           break;
         }
-        assert_token(g_lexer.current, TPeriod);
-        lex();
+        assert_token(parser->lexer.current, TPeriod);
+        lex(parser);
       } else {
         // We need to see at least one annotation for this annotation block
         // to be valid.
         bool saw_annot = false;
-        struct Annotation *annot = calloc(1, sizeof(struct Annotation));
+        struct Annotation annot = {0};
 
-        while (g_lexer.current.type == TString ||
-               g_lexer.current.type == TStar ||
-               g_lexer.current.type == TLeftArrow) {
+        while (parser->lexer.current.type == TString ||
+               parser->lexer.current.type == TStar ||
+               parser->lexer.current.type == TLeftArrow) {
           saw_annot = true;
 
-          const char *annot_str = NULL;
-          switch (parse_annotation(&annot_str)) {
+          const struct Symbol *annot_str = NULL;
+          switch (parse_annotation(parser, &annot_str)) {
           case ACategory:
-            annot->category = annot_str;
+            annot.category = annot_str;
             break;
           case AComment:
-            annot->comment = annot_str;
+            annot.comment = annot_str;
             break;
           case AModule:
-            annot->module = annot_str;
+            annot.module = annot_str;
             break;
           }
-          assert_token(g_lexer.current, TPeriod);
-          lex();
+          assert_token(parser->lexer.current, TPeriod);
+          lex(parser);
         }
 
         if (!saw_annot) {
-          failure("syntax error: annotation block with no annotations");
+          failure(&parser->lexer,
+                  "syntax error: annotation block with no annotations");
         }
 
-        if (!stack_push(&annotation_stack, annot)) {
-          failure("maximum annotation depth exceeded");
+        if (parser->annotation_stack.length - annotation_start ==
+            MAX_ANNOTATION_DEPTH) {
+          failure(&parser->lexer, "maximum annotation depth exceeded");
         }
+        vec_push(&parser->annotation_stack, annot);
       }
 
       // Reset back the loop.
-    } else if (g_lexer.current.type == TBraceClose) {
-      puts("Removing from the annotation stack");
+    } else if (parser->lexer.current.type == TBraceClose) {
       // Removing an annotation node.
-      struct Annotation *annot = stack_top(&annotation_stack);
-      if (!stack_pop(&annotation_stack))
-        failure("internal error: unbalanced annotation stack");
-      free(annot);
+      if (parser->annotation_stack.length == annotation_start)
+        failure(&parser->lexer, "internal error: unbalanced annotation stack");
+      parser->annotation_stack.length--;
 
-      lex();
-    } else if (g_lexer.current.type == TIdent) {
+      lex(parser);
+    } else if (parser->lexer.current.type == TIdent) {
       // The only thing we can expect at this point is that we have regular
       // slots, so anything else is illegal.
-
-      slots.slots[slots.length++] = parse_slot(&annotation_stack);
-
-      if (g_lexer.current.type == TPeriod) {
-        lex();
-      } else if (g_lexer.current.type != TPipe &&
-                 g_lexer.current.type != TBraceClose) {
-        failure("expected . or | after slot, got %s",
-                token_to_string(g_lexer.current.type));
-      }
+      return true;
     } else {
-      failure("syntax error: expected annotation block or slot name");
+      failure(&parser->lexer,
+              "syntax error: expected annotation block or slot name");
     }
   }
 
-  stack_deinit(&annotation_stack);
+  // Unclosed annotation blocks end with the slot list.
+  parser->annotation_stack.length = annotation_start;
 
-  lex();
-  return slots;
+  lex(parser);
+  return false;
 }
 
-// Keyword argument, tee hee
-enum ObjectExprSubexpr { ObjectIsntSubexpr = false, ObjectIsSubexpr };
-struct ObjectExpr *parse_object_expr(enum ObjectExprSubexpr is_subexpr) {
-  // Lexer pre-condition: standing on the first parenthesis.
+// Object literals
 
-  assert_token(g_lexer.current, TParenOpen);
+// Adds the object once its statements have been parsed.
+static ExprRef end_object(struct Parser *parser, struct ParseFrame *frame,
+                          struct StmtList stmts) {
+  struct ObjectExpr expr = {.stmts = stmts};
+  struct Annotation annotation = frame->object.annotation;
+  int slot_start = frame->object.slot_start;
 
-  // An object consists of (optional) slots, followed by code which is a list
-  // of statements. The last statement/slot does not have to have a period
-  // following it.
+  expr.span = span_since(parser, frame->object.start);
+  expr.slots.length = frame->object.slot_count;
 
-  struct ObjectExpr *expr = malloc(sizeof(*expr));
-  expr->annotation = (struct Annotation){0};
+  // Each slot is relative to the one before it.
+  struct Slot *slots = parser->slot_stack.data + slot_start;
+  for (uint32_t i = expr.slots.length; i-- > 1;)
+    slots[i].span.offset -= slots[i - 1].span.offset;
+  if (expr.slots.length)
+    slots[0].span.offset -= expr.span.offset;
 
-  // Check for slots.
-  if (lex().type == TPipe) {
-    expr->slots = parse_slot_list(&expr->annotation);
-  } else {
-    expr->slots = (struct SlotList){.length = 0, .slots = NULL};
-  }
+  expr.slots.start = ast_add_slots(&parser->ast, slots, expr.slots.length);
+  parser->slot_stack.length = slot_start;
+
+  if (annotation.category || annotation.comment || annotation.module)
+    expr.annotation = ast_add_annotation(&parser->ast, annotation);
+  else
+    expr.annotation = AST_NONE;
+
+  ExprRef ref = ast_add_object(&parser->ast, expr);
+  vec_push(&parser->object_stack, ref);
+  return ref;
+}
 
+// Moves on to the code of the object once its slot list has been parsed.
+static bool begin_object_code(struct Parser *parser, struct ParseFrame *frame,
+                              union ParseResult *result) {
   // TODO: disallow the usage of slot list delimiters inside sub-exprs.
   // Sub-exprs are treated by Self as anonymous objects that are immediately
   // executed. They are crippled a bit so it's not immediately obvious that
   // they're really objects, but you can make the ugly guts show by prepending
   // | | before the inner expression.
-  if (expr->slots.length && is_subexpr && g_lexer.current.type != TParenClose) {
-    failure("slots and code cannot be used together in sub-exprs");
+  if (frame->object.slot_count && frame->object.subexpr &&
+      parser->lexer.current.type != TParenClose) {
+    failure(&parser->lexer,
+            "slots and code cannot be used together in sub-exprs");
   }
 
-  if (g_lexer.current.type == TParenClose) {
-    expr->stmts = (struct StmtList){.length = 0, .stmts = NULL};
-    lex();
-  } else {
-    expr->stmts = parse_stmt_list(stmt_list_eoo);
-    lex();
-
-    if (is_subexpr && expr->stmts.length > 1) {
-      failure("sub-expression cannot contain multiple expressions");
-    }
+  if (parser->lexer.current.type == TParenClose) {
+    lex(parser);
+    result->expr = end_object(
+        parser, frame,
+        (struct StmtList){.start = parser->ast.stmt_count, .length = 0});
+    return true;
   }
 
-  return expr;
+  frame->state = SStmts;
+  push_frame(parser, (struct ParseFrame){
+                         .type = PStmts,
+                         .stmts = {.base = frame->object.start}});
+  return false;
 }
 
-struct Expr parse_primary() {
-  // Lexer pre-condition: standing on the first token of the primary expr.
+static bool step_object(struct Parser *parser, struct ParseFrame *frame,
+                        union ParseResult *result) {
+  // An object consists of (optional) slots, followed by code which is a list
+  // of statements. The last statement/slot does not have to have a period
+  // following it.
 
-  struct Expr primary;
-  switch (g_lexer.current.type) {
-  case TParenOpen: {
-    struct ObjectExpr *expr = parse_object_expr(ObjectIsSubexpr);
-    primary = (struct Expr){.type = EObject, .object = expr};
+  switch (frame->state) {
+  case SBegin:
+    // Lexer pre-condition: standing on the first parenthesis.
+    assert_token(parser->lexer.current, TParenOpen);
+    frame->object.start = parser->lexer.current.offset;
+    frame->object.annotation = (struct Annotation){0};
+
+    // Check for slots. They are only stored once the whole object has been
+    // parsed, so that keyword slots can add their parameters to the end.
+    frame->object.slot_start = parser->slot_stack.length;
+    frame->object.slot_count = 0;
+    if (lex(parser).type != TPipe)
+      return begin_object_code(parser, frame, result);
+
+    lex(parser);
+    // The annotation blocks of enclosing slot lists don't apply to this one.
+    frame->object.annotation_start = parser->annotation_stack.length;
     break;
-  }
-  case TBracketOpen:
-    failure("TODO support blocks");
-  case TIdent: {
-    struct IdentExpr *expr = parse_ident_expr();
-    primary = (struct Expr){.type = EIdent, .ident = expr};
-    break;
-  }
-  case TInteger:
-  case TFloat: {
-    struct NumberExpr *expr = parse_number_expr();
-    primary = (struct Expr){.type = ENumber, .number = expr};
+  case SSlot:
+    vec_push(&parser->slot_stack, result->slot);
+    frame->object.slot_count++;
+
+    if (parser->lexer.current.type == TPeriod) {
+      lex(parser);
+    } else if (parser->lexer.current.type != TPipe &&
+               parser->lexer.current.type != TBraceClose) {
+      failure(&parser->lexer, "expected . or | after slot, got %s",
+              token_to_string(parser->lexer.current.type));
+    }
     break;
-  }
+  case SStmts:
+    lex(parser);
+    if (frame->object.subexpr && result->stmts.length > 1) {
+      failure(&parser->lexer,
+              "sub-expression cannot contain multiple expressions");
+    }
+
+    result->expr = end_object(parser, frame, result->stmts);
+    return true;
   default:
-    failure("syntax error: expected primary expression, got %s",
-            token_to_string(g_lexer.current.type));
+    failure(&parser->lexer, "internal error: bad object state");
   }
 
-  // Handle message expressions.
-  //
-  // Message expressions are listed as ident ident: expr OtherIdent: expr.
-  // However we need to make sure to not take message keywords that start
-  // with capital letters because they belong to the parent expression.
-  // So self msg: 1 + 2 WithThree: 3 complement would be parsed as:
-  // [self msg: [1 + 2] WithThree: [3 complement]]
-  // (with each bracket representing a separate expression).
-  //
-  // Note that nested unary messages (as single idents next to each other)
-  // are left-associative, while expressions after keywords are
-  // right-associative.
+  if (!next_slot(parser, frame))
+    return begin_object_code(parser, frame, result);
+
+  int annotation_start = frame->object.annotation_start;
+  frame->state = SSlot;
+  push_frame(parser, (struct ParseFrame){
+                         .type = PSlot,
+                         .slot = {.annotation_start = annotation_start}});
+  return false;
+}
+
+// Expressions
+
+// Handles message expressions.
+//
+// Message expressions are listed as ident ident: expr OtherIdent: expr.
+// However we need to make sure to not take message keywords that start
+// with capital letters because they belong to the parent expression.
+// So self msg: 1 + 2 WithThree: 3 complement would be parsed as:
+// [self msg: [1 + 2] WithThree: [3 complement]]
+// (with each bracket representing a separate expression).
+//
+// Note that nested unary messages (as single idents next to each other)
+// are left-associative, while expressions after keywords are
+// right-associative.
+//
+// For example, self negate print becomes [[self negate] print], while
+// self add: 2 negate becomes [self add: [2 negate]].
+static bool parse_messages(struct Parser *parser, struct ParseFrame *frame,
+                           union ParseResult *result) {
+  // This message belongs to us, so keep parsing until we don't have
+  // a legible message.
   //
-  // For example, self negate print becomes [[self negate] print], while
-  // self add: 2 negate becomes [self add: [2 negate]].
+  // FIXME: is this the right way to do it?
+  while (parser->lexer.current.type == TIdent) {
+    struct Span msg = CURRENT_SPAN();
+    lex(parser);
 
-  char *message_name = NULL;
-  int length = 0;
-  // TODO: better way than realloc'ing everytime.
-  struct Expr *args = NULL;
-  int argc = 0;
+    // Standing on either a colon, an ident or something else.
+    if (parser->lexer.current.type == TColon) {
+      // Keyword argument.
+      name_append_keyword(parser, msg);
 
-  if (g_lexer.current.type == TColon) {
-    // This is a keyword message with an implicit receiver of "self".
-    // Update it as such.
+      lex(parser);
+      frame->state = SArgument;
+      push_expr(parser);
+      return false;
+    } else {
+      // Unary message. Fold the current identifier into a message and
+      // wait for the next iteration.
+
+      struct MessageExpr message = {
+          .message = symbol_intern(msg.data, msg.length),
+          .receiver = frame->expr.primary,
+          .args = parser->ast.arg_count,
+          .length = 0};
+      frame->expr.primary = ast_add_message(&parser->ast, message);
+    }
+  }
+
+  if (frame->expr.argc > 0) {
+    // We did actually have a keyword message.
+    int args_start = frame->expr.args_start;
+    struct MessageExpr message = {
+        .message = name_intern(parser, frame->expr.name_start),
+        .receiver = frame->expr.primary,
+        .args = ast_add_args(&parser->ast,
+                             parser->arg_stack.data + args_start,
+                             frame->expr.argc),
+        .length = frame->expr.argc};
+    parser->arg_stack.length = args_start;
+
+    result->expr = ast_add_message(&parser->ast, message);
+  } else {
+    // No keyword message, just return.
+    result->expr = frame->expr.primary;
+  }
+  return true;
+}
 
-    struct IdentExpr *ident = malloc(sizeof(*ident));
-    ident->ident = strdup("self");
+// Starts on the messages once the primary expression has been parsed.
+static bool begin_messages(struct Parser *parser, struct ParseFrame *frame,
+                           ExprRef primary, union ParseResult *result) {
+  frame->expr.primary = primary;
+  frame->expr.name_start = parser->names.length;
+  frame->expr.args_start = parser->arg_stack.length;
+  frame->expr.argc = 0;
 
-    if (primary.type != EIdent)
-      failure("expected identifier before self keyword message");
+  if (parser->lexer.current.type == TColon) {
+    // This is a keyword message with an implicit receiver of "self".
+    // Update it as such.
 
-    int ident_len = strlen(primary.ident->ident);
-    message_name = realloc(message_name, ident_len + 2);
-    strcpy(message_name, primary.ident->ident);
-    length = ident_len;
-    message_name[length++] = ':';
-    message_name[length] = '\0';
+    if (EXPR_TYPE(primary) != EIdent)
+      failure(&parser->lexer,
+              "expected identifier before self keyword message");
 
-    // Clean up the identifier
-    free((void *)primary.ident->ident);
-    free(primary.ident);
-    primary.ident = ident;
+    const struct Symbol *keyword = ast_ident(&parser->ast, primary)->ident;
+    name_append(parser, keyword->name, keyword->length);
+    name_append(parser, ":", 1);
 
-    lex();
+    // The identifier may be shared, so it can't be turned into the receiver.
+    frame->expr.primary =
+        ast_add_ident(&parser->ast, symbol_intern("self", 4));
 
-    args = realloc(args, sizeof(struct Expr));
-    args[0] = parse_expr();
-    argc++;
+    lex(parser);
+    frame->state = SArgument;
+    push_expr(parser);
+    return false;
   }
+
   // Check if this message is for us.
-  else if (g_lexer.current.type != TIdent || isupper(g_lexer.current.ident[0]))
+  if (parser->lexer.current.type != TIdent ||
+      isupper(CURRENT_SPAN().data[0])) {
     // This message isn't for us, it's another keyword for the parent
     // expression. Or it's just not a message.
-    return primary;
-
-  // This message belongs to us, so keep parsing until we don't have
-  // a legible message.
-  //
-  // FIXME: is this the right way to do it?
-  while (g_lexer.current.type == TIdent) {
-    char *msg_copy = strdup(g_lexer.current.ident);
-    lex();
-
-    // Standing on either a colon, an ident or something else.
-    if (g_lexer.current.type == TColon) {
-      // Keyword argument.
+    result->expr = primary;
+    return true;
+  }
 
-      int ident_len = strlen(msg_copy);
-      message_name = realloc(message_name, length + ident_len + 2);
-      strncpy(message_name + length, msg_copy, ident_len + 1);
+  return parse_messages(parser, frame, result);
+}
 
-      length += ident_len;
-      message_name[length++] = ':';
-      message_name[length] = '\0';
+static bool step_expr(struct Parser *parser, struct ParseFrame *frame,
+                      union ParseResult *result) {
+  // Lexer pre-condition: standing on the first token of the primary expr.
 
-      args = realloc(args, (argc + 1) * sizeof(struct Expr));
-      lex();
-      args[argc++] = parse_expr();
-    } else {
-      // Unary message. Fold the current identifier into a message and
-      // wait for the next iteration.
+  switch (frame->state) {
+  case SBegin:
+    switch (parser->lexer.current.type) {
+    case TParenOpen:
+      frame->state = SPrimary;
+      push_frame(parser, (struct ParseFrame){.type = PObject,
+                                             .object = {.subexpr = true}});
+      return false;
+    case TBracketOpen:
+      failure(&parser->lexer, "TODO support blocks");
+    case TIdent:
+      return begin_messages(parser, frame, parse_ident_expr(parser), result);
+    case TInteger:
+    case TFloat:
+      return begin_messages(parser, frame, parse_number_expr(parser),
+                            result);
+    default:
+      failure(&parser->lexer,
+              "syntax error: expected primary expression, got %s",
+              token_to_string(parser->lexer.current.type));
+    }
+  case SPrimary:
+    return begin_messages(parser, frame, result->expr, result);
+  case SArgument:
+    vec_push(&parser->arg_stack, result->expr);
+    frame->expr.argc++;
+    return parse_messages(parser, frame, result);
+  default:
+    failure(&parser->lexer, "internal error: bad expression state");
+  }
+}
 
-      struct MessageExpr *message = malloc(sizeof(*message));
-      message->message = strdup(msg_copy);
-      message->args = NULL;
-      message->length = 0;
-      message->receiver = primary;
-      primary = (struct Expr){.type = EMessage, .message = message};
+// Pushes the frame and steps it, and everything it pushes in turn, until it
+// is done. Returns its result.
+static union ParseResult parse_frame(struct Parser *parser,
+                                     struct ParseFrame frame) {
+  int base = parser->frames.length;
+  union ParseResult result;
+  push_frame(parser, frame);
+
+  while (parser->frames.length > base) {
+    struct ParseFrame *top = &vec_last(&parser->frames);
+    bool done = false;
+    switch (top->type) {
+    case PStmts:
+      done = step_stmts(parser, top, &result);
+      break;
+    case PObject:
+      done = step_object(parser, top, &result);
+      break;
+    case PSlot:
+      done = step_slot(parser, top, &result);
+      break;
+    case PExpr:
+      done = step_expr(parser, top, &result);
+      break;
     }
 
-    free(msg_copy);
+    // A frame which isn't done has pushed another one.
+    if (done)
+      parser->frames.length--;
+    if (parser->ast.full)
+      failure(&parser->lexer,
+              "too many expressions, at most %" PRIu32 " of each kind",
+              AST_MAX_EXPRS);
   }
 
-  if (argc > 0) {
-    // We did actually have a keyword message.
-    struct MessageExpr *message = malloc(sizeof(*message));
-    message->message = message_name;
-    message->length = argc;
-    message->args = args;
-    message->receiver = primary;
+  return result;
+}
 
-    return (struct Expr){.type = EMessage, .message = message};
-  } else {
-    // No keyword message, just return.
-    return primary;
+bool parser_init(struct Parser *parser, const char *fname) {
+  *parser = (struct Parser){0};
+  ast_init(&parser->ast);
+  vec_init(&parser->names);
+  vec_init(&parser->stmt_stack);
+  vec_init(&parser->arg_stack);
+  vec_init(&parser->slot_stack);
+  vec_init(&parser->annotation_stack);
+  vec_init(&parser->param_stack);
+  vec_init(&parser->object_stack);
+  vec_init(&parser->frames);
+  return lexer_init(&parser->lexer, fname);
+}
+
+void parser_deinit(struct Parser *parser) {
+  ast_deinit(&parser->ast);
+  vec_deinit(&parser->names);
+  vec_deinit(&parser->stmt_stack);
+  vec_deinit(&parser->arg_stack);
+  vec_deinit(&parser->slot_stack);
+  vec_deinit(&parser->annotation_stack);
+  vec_deinit(&parser->param_stack);
+  vec_deinit(&parser->object_stack);
+  vec_deinit(&parser->frames);
+  free(parser->lexer.error);
+  lexer_deinit(&parser->lexer);
+}
+
+// Empties the scratch stacks after a failed parse left things on them.
+static void reset_stacks(struct Parser *parser) {
+  parser->names.length = 0;
+  parser->stmt_stack.length = 0;
+  parser->arg_stack.length = 0;
+  parser->slot_stack.length = 0;
+  parser->annotation_stack.length = 0;
+  parser->param_stack.length = 0;
+  parser->object_stack.length = 0;
+  parser->frames.length = 0;
+}
+
+bool parser_parse(struct Parser *parser) {
+  jmp_buf failure_jmp;
+  if (setjmp(failure_jmp)) {
+    parser->lexer.failure_jmp = NULL;
+    reset_stacks(parser);
+    return false;
   }
+  parser->lexer.failure_jmp = &failure_jmp;
+
+  // Lexer pre-condition for every parse function: standing on the first
+  // token.
+  lex(parser);
+  parser->ast.root =
+      parse_frame(parser, (struct ParseFrame){.type = PStmts,
+                                              .stmts = {.eof = true}})
+          .stmts;
+
+  parser->lexer.failure_jmp = NULL;
+  parser->parsed_size = ast_size(&parser->ast);
+  return true;
 }
 
-struct Expr parse_expr() {
-  // Lexer pre-condition: standing on the first token of the LHS expression.
+// Incremental reparsing
+
+// A statement, slot or object literal around an edit, which can be parsed
+// again on its own.
+struct EditSite {
+  enum ParseFrameType type; // PExpr for a statement.
+  uint32_t index;
+  // Where it is in the source once edited.
+  long start, end;
+  // The statement or slot after it, which is relative to it, or AST_NONE.
+  uint32_t next;
+};
+
+// An edit which replaced [offset, end) of the source, changing its length by
+// delta, and the sites found around it, outermost first.
+struct Edit {
+  long offset, end, delta;
+  VEC(struct EditSite, 16) sites;
+};
+
+// The edit is around a statement or slot if it is in it or just touches it,
+// while it is only around an object if it is between the parentheses.
+static bool around_edit(const struct Edit *edit, long start, uint32_t length,
+                        bool inclusive) {
+  return inclusive ? start <= edit->offset && edit->end <= start + length
+                   : start < edit->offset && edit->end < start + length;
+}
 
-  struct Expr lhs = parse_primary();
+static void add_edit_site(struct Edit *edit, enum ParseFrameType type,
+                          uint32_t index, long start, uint32_t length,
+                          uint32_t next) {
+  vec_push(&edit->sites, ((struct EditSite){type, index, start,
+                                            start + length, next}));
+}
 
-  // TODO: binary expressions.
-  return lhs;
-  // return parse_binary(lhs, 1);
+// Stretches the statement of the list around the edit, if there is one, and
+// moves the next one along. The list is relative to *start, which is set to
+// where the statement starts.
+static bool edit_stmt(struct Ast *ast, struct Edit *edit,
+                      struct StmtList list, long *start, ExprRef *expr) {
+  long at = *start;
+  for (uint32_t i = 0; i < list.length; i++) {
+    struct Stmt *stmt = &ast->stmts[list.start + i];
+    at += stmt->span.offset;
+    if (at > edit->offset)
+      return false;
+    if (!around_edit(edit, at, stmt->span.length, true))
+      continue;
+
+    uint32_t next = AST_NONE;
+    stmt->span.length += edit->delta;
+    if (i + 1 < list.length) {
+      stmt[1].span.offset += edit->delta;
+      next = list.start + i + 1;
+    }
+    add_edit_site(edit, PExpr, list.start + i, at, stmt->span.length, next);
+    *start = at;
+    *expr = stmt->expr;
+    return true;
+  }
+  return false;
 }
 
-struct Stmt parse_stmt() {
-  // Lexer pre-condition: standing on the first token of the statement.
+// The same for the slots of the object, which starts at *start. Argument
+// slots are in the selector outside of it, and can't be parsed alone.
+static bool edit_slot(struct Ast *ast, struct Edit *edit,
+                      const struct ObjectExpr *object, long *start,
+                      ExprRef *value) {
+  struct Slot *slots = ast->slots + object->slots.start;
+  long at = *start;
+  for (uint32_t i = 0; i < object->slots.length && !slots[i].arg_index;
+       i++) {
+    struct Slot *slot = &slots[i];
+    at += slot->span.offset;
+    if (at > edit->offset)
+      return false;
+    if (!around_edit(edit, at, slot->span.length, true))
+      continue;
+
+    uint32_t next = AST_NONE;
+    slot->span.length += edit->delta;
+    if (i + 1 < object->slots.length && !slot[1].arg_index) {
+      slot[1].span.offset += edit->delta;
+      next = object->slots.start + i + 1;
+    }
+    add_edit_site(edit, PSlot, object->slots.start + i, at, slot->span.length,
+                  next);
+    *start = at;
+    *value = slot->value;
+    return true;
+  }
+  return false;
+}
 
-  struct Stmt stmt = {.expr = parse_expr()};
+// Stretches the object literal in the expression around the edit, if there
+// is one. The expression is in the statement or slot at *start, which the
+// objects in it are relative to, so the ones after the edit move along. *start
+// is set to where the object starts.
+static bool edit_object(struct Ast *ast, struct Edit *edit, ExprRef expr,
+                        long *start, ExprRef *found) {
+  struct AstWalk walk;
+  ast_walk_init(&walk, ast);
+  ast_walk_expr(&walk, expr);
+
+  long found_at = -1;
+  while (ast_walk_next(&walk)) {
+    if (walk.step != WExpr || EXPR_TYPE(walk.expr) != EObject)
+      continue;
+    ast_walk_skip(&walk);
+
+    struct ObjectExpr *object = ast_object(ast, walk.expr);
+    long at = *start + object->span.offset;
+    if (at >= edit->end) {
+      object->span.offset += edit->delta;
+    } else if (around_edit(edit, at, object->span.length, false)) {
+      object->span.length += edit->delta;
+      add_edit_site(edit, PObject, EXPR_INDEX(walk.expr), at,
+                    object->span.length, AST_NONE);
+      found_at = at;
+      *found = walk.expr;
+    }
+  }
+  ast_walk_deinit(&walk);
 
-  if (g_lexer.current.type != TParenClose) {
-    assert_token(g_lexer.current, TPeriod);
-    lex();
+  if (found_at < 0)
+    return false;
+  *start = found_at;
+  return true;
+}
+
+// Goes down from the top-level statements to the innermost site around the
+// edit, adding the sites on the way and moving their spans.
+static void find_edit_sites(struct Ast *ast, struct Edit *edit) {
+  struct StmtList stmts = ast->root;
+  long start = 0;
+  ExprRef expr, object;
+
+  while (edit_stmt(ast, edit, stmts, &start, &expr)) {
+    // Down the objects and their slots until the edit is in the statements
+    // of one.
+    do {
+      if (!edit_object(ast, edit, expr, &start, &object))
+        return;
+    } while (edit_slot(ast, edit, ast_object(ast, object), &start, &expr));
+    stmts = ast_object(ast, object)->stmts;
   }
+}
 
-  return stmt;
+// A statement or slot which was parsed again starts later than its site if
+// the edit was just before it. Whatever is relative to it then moves back.
+
+static bool reparse_stmt(struct Parser *parser, struct EditSite site) {
+  struct Ast *ast = &parser->ast;
+  long start = parser->lexer.current.offset;
+  int object_start = parser->object_stack.length;
+  ExprRef expr = parse_frame(parser, (struct ParseFrame){.type = PExpr}).expr;
+  relocate_objects(parser, object_start, start);
+  if (parser->previous_end != site.end)
+    return false;
+
+  struct Stmt *stmt = &ast->stmts[site.index];
+  uint32_t moved = start - site.start;
+  stmt->expr = expr;
+  stmt->span.offset += moved;
+  stmt->span.length -= moved;
+  if (site.next != AST_NONE)
+    ast->stmts[site.next].span.offset -= moved;
+  return true;
 }
 
-struct StmtList parse_stmt_list(stmt_list_pred pred) {
-  // Lexer pre-condition: standing on the first token of the first statement.
+static bool reparse_slot(struct Parser *parser, struct EditSite site) {
+  int annotation_start = parser->annotation_stack.length;
+  struct Slot slot =
+      parse_frame(parser,
+                  (struct ParseFrame){
+                      .type = PSlot,
+                      .slot = {.annotation_start = annotation_start}})
+          .slot;
+  if (slot.span.offset + slot.span.length != site.end)
+    return false;
+
+  // The annotation blocks around it are outside of it.
+  struct Slot *old = &parser->ast.slots[site.index];
+  uint32_t moved = slot.span.offset - site.start;
+  slot.span.offset = old->span.offset + moved;
+  slot.annotation = old->annotation;
+  *old = slot;
+  if (site.next != AST_NONE)
+    parser->ast.slots[site.next].span.offset -= moved;
+  return true;
+}
+
+static bool reparse_object(struct Parser *parser, struct EditSite site) {
+  struct Ast *ast = &parser->ast;
+  ExprRef ref = parse_frame(parser, (struct ParseFrame){
+                                        .type = PObject,
+                                        .object = {.subexpr = true}})
+                    .expr;
+  parser->object_stack.length--;
+  struct ObjectExpr object = *ast_object(ast, ref);
+  if (object.span.offset + object.span.length != site.end)
+    return false;
+
+  // A method keeps its arguments, which come from the selector outside of it.
+  // They are at the end of its slots, and the new slots are the last ones in
+  // the AST, so they can be appended. Their spans are relative to the
+  // object, which starts where it did.
+  struct ObjectExpr *old = &ast->objects[site.index];
+  const struct Slot *old_slots = ast->slots + old->slots.start;
+  int args = 0;
+  while (args < (int)old->slots.length &&
+         old_slots[old->slots.length - 1 - args].arg_index)
+    args++;
+
+  if (args) {
+    // Let the slot the method is in report this.
+    if (!object.stmts.length)
+      return false;
+
+    vec_append(&parser->slot_stack, old_slots + old->slots.length - args,
+               args);
+    ast_add_slots(ast, parser->slot_stack.data, args);
+    parser->slot_stack.length = 0;
+    object.slots.length += args;
+  }
 
-  // TODO: more efficient resizing of the statement list. Realloc after every
-  // statement is slow.
-  struct StmtList stmts = {0};
+  object.span.offset = old->span.offset;
+  ast->objects[site.index] = object;
+  // The new object was the last one added, and only it refers to itself.
+  ast->object_count--;
+  return true;
+}
 
-  while (!pred()) {
-    stmts.stmts = realloc(stmts.stmts, ++stmts.length * sizeof(struct Stmt));
-    stmts.stmts[stmts.length - 1] = parse_stmt();
+// Parses the site again from where it starts and splices the result into the
+// AST, if it ends where the site does. Otherwise the AST is left as it was.
+static bool reparse_site(struct Parser *parser, struct EditSite site) {
+  struct AstMark mark = ast_mark(&parser->ast);
+
+  jmp_buf failure_jmp;
+  if (setjmp(failure_jmp)) {
+    parser->lexer.failure_jmp = NULL;
+    parser->lexer.quiet = false;
+    reset_stacks(parser);
+    ast_rollback(&parser->ast, mark);
+    return false;
+  }
+  parser->lexer.failure_jmp = &failure_jmp;
+  // Failing only means a wider site has to be tried.
+  parser->lexer.quiet = true;
+
+  lexer_seek(&parser->lexer, site.start);
+  lex(parser);
+  bool spliced;
+  switch (site.type) {
+  case PExpr:
+    spliced = reparse_stmt(parser, site);
+    break;
+  case PSlot:
+    spliced = reparse_slot(parser, site);
+    break;
+  default:
+    spliced = reparse_object(parser, site);
+    break;
   }
 
-  return stmts;
+  parser->lexer.failure_jmp = NULL;
+  parser->lexer.quiet = false;
+  if (!spliced)
+    ast_rollback(&parser->ast, mark);
+  return spliced;
 }
 
-bool stmt_list_eof() { return g_lexer.current.type == TEOF; }
-bool stmt_list_eoo() { return g_lexer.current.type == TParenClose; }
+bool parser_edit(struct Parser *parser, long offset, long length,
+                 const char *text, long text_length) {
+  struct Ast *ast = &parser->ast;
+  lexer_edit(&parser->lexer, offset, length, text, text_length);
+
+  if (parser->parsed_size) {
+    struct Edit edit = {.offset = offset,
+                        .end = offset + length,
+                        .delta = text_length - length};
+    vec_init(&edit.sites);
+    find_edit_sites(ast, &edit);
+
+    // Try the innermost site first, and widen it until one parses.
+    bool spliced = false;
+    for (int i = edit.sites.length - 1; i >= 0 && !spliced; i--)
+      spliced = reparse_site(parser, edit.sites.data[i]);
+    vec_deinit(&edit.sites);
+
+    // Once too much of the AST has been replaced, get rid of the old nodes
+    // by starting over.
+    if (spliced && ast_size(ast) < 2 * parser->parsed_size)
+      return true;
+  }
+
+  ast_deinit(ast);
+  ast_init(ast);
+  lexer_seek(&parser->lexer, 0);
+  parser->parsed_size = 0;
+  return parser_parse(parser);
+}
@@ -3,111 +3,122 @@
 
 #include <stdbool.h>
 
-enum ExprType {
-  ENone,    // No expression (invalid)
-  EMessage, // Message sending expression
-  EIdent,   // Identifier expression
-  ENumber,  // Number expression (integer or floating point)
-  EBinary,  // Binary expression
-  EObject,  // Object expression (activation record)
+#include "ast.h"
+#include "lexer.h"
+#include "vec.h"
+
+// Nested constructs are parsed with a stack of frames instead of recursion,
+// so the nesting of a source is only limited by memory. The frame on top is
+// stepped until it either pushes a frame for something nested in it, or is
+// done and hands its result to the frame below.
+enum ParseFrameType {
+  PStmts,  // A statement list, up to the end of the file or object
+  PObject, // An object literal
+  PSlot,   // A slot in the slot list of an object literal
+  PExpr,   // A primary expression and the messages sent to it
 };
 
-struct Expr {
-  enum ExprType type;
-  union {
-    struct MessageExpr *message;
-    struct IdentExpr *ident;
-    struct NumberExpr *number;
-    struct BinaryExpr *binary;
-    struct ObjectExpr *object;
-  };
-};
-
-struct MessageExpr {
-  struct Expr receiver;
-  const char *message;
-
-  int length;
-  struct Expr *args;
-};
-
-struct IdentExpr {
-  const char *ident;
+// Where a frame carries on the next time it is stepped.
+enum ParseState {
+  SBegin,    // Nothing has been parsed yet
+  SStmt,     // A statement of the list was parsed
+  SSlots,    // In the slot list of the object
+  SSlot,     // A slot of the object was parsed
+  SStmts,    // The statements of the object were parsed
+  SValue,    // The value of the slot was parsed
+  SPrimary,  // The object literal the expression starts with was parsed
+  SArgument, // A keyword argument of the expression was parsed
 };
 
-enum NumberType {
-  NNone,    // Invalid
-  NInteger, // Integer
-  NFloat,   // Floating-point
-};
-
-struct NumberExpr {
-  enum NumberType type;
+struct ParseFrame {
+  enum ParseFrameType type;
+  enum ParseState state;
   union {
-    long integer;
-    double flt;
+    struct {
+      bool eof; // Whether the list ends at the end of the file.
+      int stmt_start, object_start;
+      // Where the spans of the list are relative to, and where the statement
+      // being parsed starts.
+      long base, start;
+    } stmts;
+    struct {
+      bool subexpr;
+      long start;
+      struct Annotation annotation;
+      int annotation_start;
+      int slot_start, slot_count;
+    } object;
+    struct {
+      struct Slot slot;
+      long start;
+      // The annotation blocks the slot is in, on the annotation stack.
+      int annotation_start;
+      int name_start, param_start, object_start;
+    } slot;
+    struct {
+      ExprRef primary;
+      int name_start, args_start, argc;
+    } expr;
   };
 };
 
-struct BinaryExpr {
-  const char *op;
-  struct Expr lhs, rhs;
+// The state of a single parse. Parsers don't share any state, so several
+// sources can be parsed at the same time on different threads.
+struct Parser {
+  struct Lexer lexer;
+  // The AST being built. It is freed by parser_deinit, so move it out (or
+  // ast_append it somewhere else) to keep it.
+  struct Ast ast;
+
+  // Scratch space for names which aren't contiguous in the source, such as
+  // keyword selectors. It is used like a stack: a builder remembers the
+  // length it started at and truncates back to it once it interns the name,
+  // so the selectors of nested keyword messages can be built at the same
+  // time.
+  VEC(char, 256) names;
+
+  // Lists are only stored in the AST once they are complete, since nested
+  // lists are parsed in the middle of them. Until then their elements live
+  // on these stacks, each list above the lists enclosing it.
+  VEC(struct Stmt, 64) stmt_stack;
+  VEC(ExprRef, 64) arg_stack;
+  VEC(struct Slot, 32) slot_stack;
+  // The annotation blocks the current slot is in.
+  VEC(struct Annotation, 8) annotation_stack;
+  // The parameters in the selectors of the keyword slots being parsed.
+  VEC(struct Slot, 8) param_stack;
+  // The object literals in the statements and slots being parsed, which get
+  // their spans made relative to them once they are done.
+  VEC(ExprRef, 32) object_stack;
+  VEC(struct ParseFrame, 32) frames;
+
+  // Where the token before the current one ended.
+  long previous_end;
+  // The size of the AST right after the last full parse, or 0 if it failed.
+  // Edits leave the nodes they replace behind, so once the AST is twice this
+  // size it is parsed from scratch again.
+  size_t parsed_size;
 };
 
-enum AnnotationType { ACategory, AComment, AModule };
-
-// Annotation carries metadata for a particular slot or object.
-struct Annotation {
-  const char *category;
-  const char *comment;
-  const char *module;
-};
-
-struct Slot {
-  // Whether this slot will be searched in the message chain.
-  bool parent;
-  // If this slot is mutable, then it will receive messages to change its
-  // value. For instance, if foo is mutable, it will receive foo: which will
-  // replace the value it contains.
-  bool mutable;
-
-  // If this is non-zero, then it is the index in the arguments list this slot
-  // takes when the method is called.
-  int arg_index;
-
-  const char *name;
-  struct Expr value;
-
-  struct Annotation annotation;
-};
-
-struct SlotList {
-  struct Slot *slots;
-  int length;
-};
-
-struct Stmt {
-  // More stuff in the future perhaps?
-  struct Expr expr;
-};
-
-struct StmtList {
-  struct Stmt *stmts;
-  int length;
-};
-
-struct ObjectExpr {
-  struct SlotList slots;
-  struct StmtList stmts;
-  struct Annotation annotation;
-};
-
-typedef bool (*stmt_list_pred)(void);
-
-struct Expr parse_expr(void);
-
-struct StmtList parse_stmt_list(stmt_list_pred pred);
-bool stmt_list_eof(void); // End of file
-bool stmt_list_eoo(void); // End of object
+bool parser_init(struct Parser *parser, const char *fname);
+void parser_deinit(struct Parser *parser);
+
+// Parses the whole source into parser->ast. On a syntax error this returns
+// false, and the error report is in parser->lexer.error.
+bool parser_parse(struct Parser *parser);
+
+// Replaces length bytes at offset in the source with text and brings the AST
+// up to date. Only the smallest statement, slot or object literal around the
+// edit which still parses to the same extent is parsed again, and spliced
+// into the AST in place of the old one. It is found by going down from the
+// top-level statements, and since spans are relative, only the spans on the
+// way down and the one after each of them move. What is left grows with the
+// source, though slowly: going down a list adds up the offsets of the
+// statements or slots before the one with the edit, and the lexer moves its
+// gap from the last edit to this one. If no node parses, the whole source is
+// parsed again, which can fail like parser_parse. Until an edit parses, the
+// AST is incomplete.
+bool parser_edit(struct Parser *parser, long offset, long length,
+                 const char *text, long text_length);
 
 #endif /* PARSER_H */
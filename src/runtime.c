@@ -0,0 +1,976 @@
+#include <inttypes.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "runtime.h"
+#include "vec.h"
+
+// The code being run. Methods run in a frame of their own, and so does code
+// with slots in the middle of an expression, which can also see the slots of
+// the code around it.
+struct Frame {
+  Value self;
+  // The method, and the values of its mutable slots: the arguments first,
+  // then the mutable locals. NULL at the top level.
+  const struct Object *method;
+  Value *locals;
+  // The frame of the code around this one, or NULL.
+  struct Frame *lexical;
+};
+
+struct Primitive;
+
+typedef Value (*primitive_func)(struct Runtime *rt,
+                                const struct Primitive *primitive,
+                                Value receiver, Value *args);
+
+// The operations of the number primitives.
+enum NumberOp {
+  OAdd,
+  OSub,
+  OMul,
+  ODiv,
+  OMod,
+  OLess,
+  OLessEqual,
+  OGreater,
+  OGreaterEqual,
+  OEqual,
+};
+
+struct Primitive {
+  const char *name;
+  int argc;
+  primitive_func func;
+  // Which operation, for the number primitives.
+  enum NumberOp op;
+};
+
+static void __attribute__((format(printf, 2, 3), noreturn))
+runtime_error(struct Runtime *rt, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  fputs("mySelf: ", stderr);
+  vfprintf(stderr, fmt, ap);
+  fputc('\n', stderr);
+  va_end(ap);
+
+  if (!rt->failure_jmp)
+    exit(1);
+  longjmp(*rt->failure_jmp, 1);
+}
+
+// The object whose slots a value has: the object itself, or the one which
+// holds the slots of its kind of number.
+static struct Object *slots_of(const struct Runtime *rt, Value value) {
+  if (value_is_object(value))
+    return value_object(value);
+  return value_is_int(value) ? rt->integer_object : rt->float_object;
+}
+
+static bool is_method(Value value) {
+  return value_is_object(value) && value_object(value)->map->code;
+}
+
+// Places expressions occur in
+
+// The AST has one node for every occurrence of a name, so an identifier is
+// told apart from the others by where the reference to its node is: in a
+// statement, the receiver of a message, an argument or the value of a slot.
+// Those places are numbered in that order.
+static uint32_t receiver_place(const struct Ast *ast, uint32_t message) {
+  return ast->stmt_count + message;
+}
+
+static uint32_t arg_place(const struct Ast *ast, uint32_t arg) {
+  return ast->stmt_count + ast->message_count + arg;
+}
+
+static uint32_t slot_place(const struct Ast *ast, uint32_t slot) {
+  return ast->stmt_count + ast->message_count + ast->arg_count + slot;
+}
+
+static ExprRef place_ref(const struct Ast *ast, uint32_t place) {
+  if (place < ast->stmt_count)
+    return ast->stmts[place].expr;
+  place -= ast->stmt_count;
+  if (place < ast->message_count)
+    return ast->messages[place].receiver;
+  place -= ast->message_count;
+  if (place < ast->arg_count)
+    return ast->args[place];
+  return ast->slots[place - ast->arg_count].value;
+}
+
+static Value eval_expr(struct Runtime *rt, struct Frame *frame, ExprRef ref,
+                       uint32_t place);
+
+static Value eval_stmts(struct Runtime *rt, struct Frame *frame,
+                        struct StmtList stmts) {
+  Value result = value_from_object(rt->nil);
+  for (uint32_t i = stmts.start; i < stmts.start + stmts.length; i++)
+    result = eval_expr(rt, frame, rt->ast->stmts[i].expr, i);
+  return result;
+}
+
+static Value activate(struct Runtime *rt, struct Frame *lexical,
+                      const struct Object *method, Value receiver, Value *args,
+                      int argc) {
+  int count = method->map->value_count;
+  if (argc > count)
+    runtime_error(rt, "method takes %d arguments, sent %d", count, argc);
+
+  // The locals live on the stack, so that sends don't allocate.
+  Value locals[count > 0 ? count : 1];
+  memcpy(locals, method->values, count * sizeof(*locals));
+  if (argc > 0)
+    memcpy(locals, args, argc * sizeof(*locals));
+
+  struct Frame frame = {receiver, method, locals, lexical};
+  return eval_stmts(rt, &frame, method->map->code->stmts);
+}
+
+// The selector which assigns a slot is its name followed by a colon.
+static const struct Symbol *assigned_name(struct Runtime *rt,
+                                          const struct Symbol *selector) {
+  const struct Symbol *name = hashtable_get(&rt->assignments, (void *)selector);
+  if (name)
+    return name;
+
+  name = symbol_intern(selector->name, selector->length - 1);
+  if (!hashtable_set(&rt->assignments, (void *)selector, (void *)name))
+    runtime_error(rt, "out of memory");
+  return name;
+}
+
+// Lookup
+
+struct Lookup {
+  const struct Runtime *rt;
+  const struct Symbol *name;
+  struct Object *holder;
+  int index;
+  bool ambiguous;
+  // Whether it looked through a mutable parent slot of the receiver.
+  bool mutable_parent;
+  VEC(struct Object *, 16) visited;
+};
+
+// A slot of the object itself hides the ones of its parents. Otherwise every
+// parent is searched, and finding different slots in more than one of them is
+// ambiguous.
+static void lookup_in(struct Lookup *lookup, struct Object *object,
+                      bool receiver) {
+  vec_push(&lookup->visited, object);
+
+  const struct ObjectMap *map = object->map;
+  int index = object_map_find(map, lookup->name);
+  if (index >= 0) {
+    if (!lookup->holder) {
+      lookup->holder = object;
+      lookup->index = index;
+    } else if (lookup->holder != object || lookup->index != index) {
+      lookup->ambiguous = true;
+    }
+    return;
+  }
+
+  for (int i = 0; i < map->slot_count; i++) {
+    if (!(map->slots[i].flags & OBJECT_SLOT_PARENT))
+      continue;
+    if (receiver && (map->slots[i].flags & OBJECT_SLOT_MUTABLE))
+      lookup->mutable_parent = true;
+
+    struct Object *parent = slots_of(lookup->rt, object_slot(object, i).value);
+    bool visited = false;
+    for (int j = 0; j < lookup->visited.length && !visited; j++)
+      visited = lookup->visited.data[j] == parent;
+    if (!visited)
+      lookup_in(lookup, parent, false);
+  }
+}
+
+// The bit of an object in the Bloom filters of the lookup cache.
+static uint64_t searched_bit(const struct Object *object) {
+  return UINT64_C(1) << (hash_pointer((void *)object) & 63);
+}
+
+// Returns false if there's no such slot. Adds the objects it searched to
+// searched either way.
+static bool lookup_slot(struct Runtime *rt, struct Object *receiver,
+                        const struct Symbol *name,
+                        struct SendCacheEntry *entry, bool *cacheable,
+                        uint64_t *searched) {
+  struct Lookup lookup = {.rt = rt, .name = name};
+  vec_init(&lookup.visited);
+  lookup_in(&lookup, receiver, true);
+  for (int i = 0; i < lookup.visited.length; i++)
+    *searched |= searched_bit(lookup.visited.data[i]);
+  vec_deinit(&lookup.visited);
+
+  if (lookup.ambiguous)
+    runtime_error(rt, "ambiguous lookup of %s", name->name);
+  if (!lookup.holder)
+    return false;
+
+  *entry = (struct SendCacheEntry){
+      .map = receiver->map,
+      .holder = lookup.holder == receiver ? NULL : lookup.holder,
+      .index = lookup.index,
+      .epoch = rt->epoch,
+  };
+  *cacheable = lookup.holder == receiver || !lookup.mutable_parent;
+  return true;
+}
+
+// Returns the name of the slot it found.
+static const struct Symbol *lookup(struct Runtime *rt, struct Object *receiver,
+                                   const struct Symbol *selector, int argc,
+                                   struct SendCacheEntry *entry,
+                                   bool *cacheable, uint64_t *searched) {
+  if (lookup_slot(rt, receiver, selector, entry, cacheable, searched))
+    return selector;
+
+  // foo: assigns the mutable slot foo.
+  const struct Symbol *name = argc == 1 ? assigned_name(rt, selector) : NULL;
+  if (name &&
+      lookup_slot(rt, receiver, name, entry, cacheable, searched)) {
+    struct Object *holder = entry->holder ? entry->holder : receiver;
+    if (holder->map->slots[entry->index].flags & OBJECT_SLOT_MUTABLE) {
+      entry->assignment = true;
+      return name;
+    }
+  }
+  runtime_error(rt, "%s not understood", selector->name);
+}
+
+// The lookup cache
+
+// Returns the set of RUNTIME_LOOKUP_CACHE_WAYS entries the lookup can be in.
+static struct LookupCacheEntry *lookup_cache_set(
+    struct Runtime *rt, const struct ObjectMap *map,
+    const struct Symbol *selector) {
+  uint64_t hash = hash_pointer((void *)map) ^ selector->hash;
+  int sets = RUNTIME_LOOKUP_CACHE_SIZE / RUNTIME_LOOKUP_CACHE_WAYS;
+  return &rt->lookup_cache[(hash & (sets - 1)) * RUNTIME_LOOKUP_CACHE_WAYS];
+}
+
+// Finds the slot the selector names for the receiver, in the lookup cache if
+// it's there, and caches what it finds if it can.
+static void lookup_cached(struct Runtime *rt, struct Object *receiver,
+                          const struct Symbol *selector, int argc,
+                          struct SendCacheEntry *entry, bool *cacheable) {
+  uint64_t searched = 0;
+  if (!rt->use_lookup_cache) {
+    lookup(rt, receiver, selector, argc, entry, cacheable, &searched);
+    return;
+  }
+
+  struct LookupCacheEntry *set =
+      lookup_cache_set(rt, receiver->map, selector);
+  for (int i = 0; i < RUNTIME_LOOKUP_CACHE_WAYS; i++) {
+    if (set[i].selector == selector && set[i].result.map == receiver->map) {
+      rt->lookup_hits++;
+      *entry = set[i].result;
+      entry->epoch = rt->epoch;
+      *cacheable = true;
+      return;
+    }
+  }
+
+  rt->lookup_misses++;
+  const struct Symbol *name =
+      lookup(rt, receiver, selector, argc, entry, cacheable, &searched);
+  if (!*cacheable)
+    return;
+
+  // The newest entry goes first, and the oldest one is dropped.
+  memmove(set + 1, set, (RUNTIME_LOOKUP_CACHE_WAYS - 1) * sizeof(*set));
+  set[0] = (struct LookupCacheEntry){selector, name, searched, *entry};
+}
+
+// Flushes the entries which searched the object, and found the slot called
+// name or looked for it. All of them if name is NULL.
+static void lookup_cache_flush(struct Runtime *rt, const struct Object *object,
+                               const struct Symbol *name) {
+  uint64_t bit = searched_bit(object);
+  for (int i = 0; i < RUNTIME_LOOKUP_CACHE_SIZE; i++) {
+    struct LookupCacheEntry *cached = &rt->lookup_cache[i];
+    if (cached->selector && (cached->searched & bit) &&
+        (!name || cached->selector == name || cached->name == name)) {
+      cached->selector = NULL;
+      rt->lookup_flushes++;
+    }
+  }
+}
+
+// Inline caches
+
+static bool cache_find(struct Runtime *rt, struct SendCache *cache,
+                       const struct ObjectMap *map,
+                       struct SendCacheEntry *entry) {
+  for (int i = 0; i < cache->length; i++) {
+    if (cache->entries[i].map == map && cache->entries[i].epoch == rt->epoch) {
+      *entry = cache->entries[i];
+      cache->hits++;
+      return true;
+    }
+  }
+  cache->misses++;
+  return false;
+}
+
+// Entries from an earlier epoch are replaced first.
+static void cache_add(struct Runtime *rt, struct SendCache *cache,
+                      const struct SendCacheEntry *entry) {
+  if (cache->state == CMegamorphic)
+    return;
+
+  for (int i = 0; i < cache->length; i++) {
+    if (cache->entries[i].epoch != rt->epoch) {
+      cache->entries[i] = *entry;
+      return;
+    }
+  }
+
+  if (cache->length == RUNTIME_CACHE_ENTRIES) {
+    cache->state = CMegamorphic;
+    cache->length = 0;
+    return;
+  }
+  cache->entries[cache->length++] = *entry;
+  cache->state = cache->length == 1 ? CMonomorphic : CPolymorphic;
+}
+
+// Sends
+
+static Value send_primitive(struct Runtime *rt, struct SendCache *cache,
+                            Value receiver, const struct Symbol *selector,
+                            Value *args, int argc) {
+  if (!cache->primitive) {
+    cache->primitive = hashtable_get(&rt->primitives, (void *)selector);
+    if (!cache->primitive)
+      runtime_error(rt, "unknown primitive %s", selector->name);
+  }
+  if (cache->primitive->argc != argc)
+    runtime_error(rt, "primitive %s takes %d arguments, sent %d",
+                  selector->name, cache->primitive->argc, argc);
+  return cache->primitive->func(rt, cache->primitive, receiver, args);
+}
+
+static Value send(struct Runtime *rt, struct SendCache *cache, Value receiver,
+                  const struct Symbol *selector, Value *args, int argc) {
+  if (selector->name[0] == '_')
+    return send_primitive(rt, cache, receiver, selector, args, argc);
+
+  struct Object *object = slots_of(rt, receiver);
+  struct SendCacheEntry entry;
+  if (!cache_find(rt, cache, object->map, &entry)) {
+    bool cacheable;
+    lookup_cached(rt, object, selector, argc, &entry, &cacheable);
+    if (cacheable)
+      cache_add(rt, cache, &entry);
+  }
+
+  struct Object *holder = entry.holder ? entry.holder : object;
+  if (entry.assignment) {
+    if (holder->map->slots[entry.index].flags & OBJECT_SLOT_PARENT) {
+      rt->epoch++;
+      lookup_cache_flush(rt, holder, NULL);
+    }
+    object_set_value(holder, entry.index, args[0]);
+    return receiver;
+  }
+
+  Value value = object_slot(holder, entry.index).value;
+  if (is_method(value))
+    return activate(rt, NULL, value_object(value), receiver, args, argc);
+  return value;
+}
+
+// Sends without a receiver go to the slots of the code being run first, and
+// then to self.
+static Value send_implicit(struct Runtime *rt, struct Frame *frame,
+                           struct SendCache *cache,
+                           const struct Symbol *selector, Value *args,
+                           int argc) {
+  for (struct Frame *f = frame; f; f = f->lexical) {
+    if (!f->method)
+      continue;
+
+    const struct ObjectMap *map = f->method->map;
+    int index = object_map_find(map, selector);
+    if (index >= 0) {
+      const struct ObjectMapSlot *slot = &map->slots[index];
+      if (slot->flags & OBJECT_SLOT_MUTABLE)
+        return f->locals[slot->offset];
+      if (is_method(slot->value))
+        return activate(rt, NULL, value_object(slot->value), frame->self, args,
+                        argc);
+      return slot->value;
+    }
+
+    if (argc == 1) {
+      index = object_map_find(map, assigned_name(rt, selector));
+      if (index >= 0 && (map->slots[index].flags & OBJECT_SLOT_MUTABLE)) {
+        f->locals[map->slots[index].offset] = args[0];
+        return frame->self;
+      }
+    }
+  }
+
+  return send(rt, cache, frame->self, selector, args, argc);
+}
+
+// Numbers
+
+static Value make_box(struct Runtime *rt, const struct Object *prototype,
+                      uint64_t bits) {
+  struct Object *box = object_box(prototype, bits);
+  if (!box)
+    runtime_error(rt, "out of memory");
+  return value_from_object(box);
+}
+
+// Integers which don't fit in 63 bits are boxed.
+static Value make_int(struct Runtime *rt, int64_t i) {
+  if (value_int_fits(i))
+    return value_from_int(i);
+  return make_box(rt, rt->integer_box, (uint64_t)i);
+}
+
+static Value make_float(struct Runtime *rt, double d) {
+  Value value;
+  if (value_from_float(d, &value))
+    return value;
+
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  return make_box(rt, rt->float_box, bits);
+}
+
+static bool is_box(const struct Runtime *rt, Value value) {
+  if (!value_is_object(value))
+    return false;
+  const struct ObjectMap *map = value_object(value)->map;
+  return map == rt->integer_box->map || map == rt->float_box->map;
+}
+
+// These return false if the value isn't that kind of number.
+static bool int_of(const struct Runtime *rt, Value value, int64_t *i) {
+  if (value_is_int(value)) {
+    *i = value_int(value);
+    return true;
+  }
+  if (!value_is_object(value) ||
+      value_object(value)->map != rt->integer_box->map)
+    return false;
+  *i = (int64_t)object_box_bits(value_object(value));
+  return true;
+}
+
+static bool float_of(const struct Runtime *rt, Value value, double *d) {
+  if (value_is_float(value)) {
+    *d = value_float(value);
+    return true;
+  }
+  if (!value_is_object(value) || value_object(value)->map != rt->float_box->map)
+    return false;
+  uint64_t bits = object_box_bits(value_object(value));
+  memcpy(d, &bits, sizeof(*d));
+  return true;
+}
+
+static Value eval_number(struct Runtime *rt, const struct NumberExpr *number) {
+  if (number->type == NInteger)
+    return make_int(rt, number->integer);
+  return make_float(rt, number->flt);
+}
+
+// Objects
+
+static struct Object *literal(struct Runtime *rt, struct Frame *frame,
+                              ExprRef ref);
+
+static Value slot_value(struct Runtime *rt, struct Frame *frame,
+                        const struct Slot *slot) {
+  // Object literals in slots are methods if they have code.
+  if (EXPR_TYPE(slot->value) == EObject)
+    return value_from_object(literal(rt, frame, slot->value));
+  return eval_expr(rt, frame, slot->value,
+                   slot_place(rt->ast, slot - rt->ast->slots));
+}
+
+// The arguments of a method come first, so that they are the first mutable
+// slots, in order.
+static struct Object *literal(struct Runtime *rt, struct Frame *frame,
+                              ExprRef ref) {
+  uint32_t index = EXPR_INDEX(ref);
+  if (rt->literals[index])
+    return rt->literals[index];
+
+  const struct ObjectExpr *expr = ast_object(rt->ast, ref);
+  const struct Slot *slots = rt->ast->slots + expr->slots.start;
+  struct Object *object = object_create();
+  if (!object)
+    runtime_error(rt, "out of memory");
+
+  bool ok = true;
+  for (uint32_t arg = 1; arg <= expr->slots.length; arg++) {
+    for (uint32_t i = 0; i < expr->slots.length; i++) {
+      if (slots[i].arg_index == (int)arg)
+        ok &= object_add_slot(
+            object, (struct ObjectSlot){.name = slots[i].name,
+                                        .mutable = true,
+                                        .value = value_from_object(rt->nil)});
+    }
+  }
+  for (uint32_t i = 0; i < expr->slots.length; i++) {
+    if (slots[i].arg_index)
+      continue;
+    ok &= object_add_slot(
+        object, (struct ObjectSlot){.name = slots[i].name,
+                                    .mutable = slots[i].mutable,
+                                    .parent = slots[i].parent,
+                                    .value = slot_value(rt, frame, &slots[i])});
+  }
+  if (!ok)
+    runtime_error(rt, "out of memory");
+
+  if (expr->stmts.length > 0)
+    object->map->code = expr;
+  return rt->literals[index] = object;
+}
+
+static Value eval_object(struct Runtime *rt, struct Frame *frame,
+                         ExprRef ref) {
+  const struct ObjectExpr *expr = ast_object(rt->ast, ref);
+  if (expr->stmts.length == 0)
+    return value_from_object(literal(rt, frame, ref));
+  // A parenthesized expression.
+  if (expr->slots.length == 0)
+    return eval_stmts(rt, frame, expr->stmts);
+  return activate(rt, frame, literal(rt, frame, ref), frame->self, NULL, 0);
+}
+
+static Value eval_message(struct Runtime *rt, struct Frame *frame,
+                          ExprRef ref) {
+  const struct MessageExpr *message = ast_message(rt->ast, ref);
+  struct SendCache *cache = &rt->message_caches[EXPR_INDEX(ref)];
+
+  // The parser makes self the receiver of keyword messages without one.
+  bool implicit =
+      EXPR_TYPE(message->receiver) == EIdent &&
+      ast_ident(rt->ast, message->receiver)->ident == rt->self_symbol;
+  Value receiver =
+      implicit ? 0
+               : eval_expr(rt, frame, message->receiver,
+                           receiver_place(rt->ast, EXPR_INDEX(ref)));
+
+  int argc = message->length;
+  Value args[argc > 0 ? argc : 1];
+  for (int i = 0; i < argc; i++) {
+    uint32_t arg = message->args + i;
+    args[i] = eval_expr(rt, frame, rt->ast->args[arg], arg_place(rt->ast, arg));
+  }
+
+  if (implicit)
+    return send_implicit(rt, frame, cache, message->message, args, argc);
+  return send(rt, cache, receiver, message->message, args, argc);
+}
+
+static Value eval_expr(struct Runtime *rt, struct Frame *frame, ExprRef ref,
+                       uint32_t place) {
+  if (++rt->depth > RUNTIME_MAX_DEPTH)
+    runtime_error(rt, "expressions nest deeper than %d", RUNTIME_MAX_DEPTH);
+
+  Value result;
+  switch (EXPR_TYPE(ref)) {
+  case EMessage:
+    result = eval_message(rt, frame, ref);
+    break;
+  case EIdent: {
+    const struct Symbol *ident = ast_ident(rt->ast, ref)->ident;
+    if (ident == rt->self_symbol)
+      result = frame->self;
+    else
+      result = send_implicit(rt, frame,
+                             &rt->ident_caches[rt->ident_sites[place]], ident,
+                             NULL, 0);
+    break;
+  }
+  case EObject:
+    result = eval_object(rt, frame, ref);
+    break;
+  case ENumber:
+    result = eval_number(rt, ast_number(rt->ast, ref));
+    break;
+  default:
+    runtime_error(rt, "internal error: bad expression type %d",
+                  EXPR_TYPE(ref));
+  }
+
+  rt->depth--;
+  return result;
+}
+
+// Primitives
+
+static Value boolean(const struct Runtime *rt, bool b) {
+  return value_from_object(b ? rt->true_object : rt->false_object);
+}
+
+// Numbers and their boxes don't change, and don't get slots of their own.
+static struct Object *changeable(struct Runtime *rt,
+                                 const struct Primitive *primitive,
+                                 Value value) {
+  if (!value_is_object(value) || is_box(rt, value))
+    runtime_error(rt, "%s needs an object, not a number", primitive->name);
+  return value_object(value);
+}
+
+static Value prim_add_slots(struct Runtime *rt,
+                            const struct Primitive *primitive, Value receiver,
+                            Value *args) {
+  struct Object *object = changeable(rt, primitive, receiver);
+  struct Object *slots = changeable(rt, primitive, args[0]);
+  for (int i = 0; i < slots->map->slot_count; i++) {
+    struct ObjectSlot slot = object_slot(slots, i);
+    int index = object_find_slot(object, slot.name);
+    bool parent =
+        slot.parent || (index >= 0 && object_slot(object, index).parent);
+    lookup_cache_flush(rt, object, parent ? NULL : slot.name);
+
+    if (!object_add_slot(object, slot))
+      runtime_error(rt, "out of memory");
+  }
+  rt->epoch++;
+  return receiver;
+}
+
+// Numbers are their own clones.
+static Value prim_clone(struct Runtime *rt, const struct Primitive *primitive,
+                        Value receiver, Value *args) {
+  (void)primitive;
+  (void)args;
+  if (!value_is_object(receiver) || is_box(rt, receiver))
+    return receiver;
+
+  struct Object *clone = object_clone(value_object(receiver));
+  if (!clone)
+    runtime_error(rt, "out of memory");
+  return value_from_object(clone);
+}
+
+static Value prim_eq(struct Runtime *rt, const struct Primitive *primitive,
+                     Value receiver, Value *args) {
+  (void)primitive;
+  return boolean(rt, receiver == args[0]);
+}
+
+// The results which don't fit in 63 bits are boxed, and the ones which don't
+// fit in 64 are errors. Division truncates, and the remainder has the sign of
+// the receiver.
+static Value prim_int(struct Runtime *rt, const struct Primitive *primitive,
+                      Value receiver, Value *args) {
+  int64_t a, b, result = 0;
+  if (!int_of(rt, receiver, &a) || !int_of(rt, args[0], &b))
+    runtime_error(rt, "%s needs integers", primitive->name);
+
+  bool overflow = false;
+  switch (primitive->op) {
+  case OAdd:
+    overflow = __builtin_add_overflow(a, b, &result);
+    break;
+  case OSub:
+    overflow = __builtin_sub_overflow(a, b, &result);
+    break;
+  case OMul:
+    overflow = __builtin_mul_overflow(a, b, &result);
+    break;
+  case ODiv:
+    if (b == 0)
+      runtime_error(rt, "%s divides by zero", primitive->name);
+    // INT64_MIN / -1 is the only quotient which overflows.
+    overflow = a == INT64_MIN && b == -1;
+    result = overflow ? 0 : a / b;
+    break;
+  case OMod:
+    if (b == 0)
+      runtime_error(rt, "%s divides by zero", primitive->name);
+    // INT64_MIN % -1 traps on x86, even though it's 0.
+    result = b == -1 ? 0 : a % b;
+    break;
+  case OLess:
+    return boolean(rt, a < b);
+  case OLessEqual:
+    return boolean(rt, a <= b);
+  case OGreater:
+    return boolean(rt, a > b);
+  case OGreaterEqual:
+    return boolean(rt, a >= b);
+  case OEqual:
+    return boolean(rt, a == b);
+  }
+  if (overflow)
+    runtime_error(rt, "%s overflows 64 bits", primitive->name);
+  return make_int(rt, result);
+}
+
+static Value prim_float(struct Runtime *rt, const struct Primitive *primitive,
+                        Value receiver, Value *args) {
+  double a, b;
+  if (!float_of(rt, receiver, &a) || !float_of(rt, args[0], &b))
+    runtime_error(rt, "%s needs floats", primitive->name);
+
+  switch (primitive->op) {
+  case OAdd:
+    return make_float(rt, a + b);
+  case OSub:
+    return make_float(rt, a - b);
+  case OMul:
+    return make_float(rt, a * b);
+  case ODiv:
+    return make_float(rt, a / b);
+  case OMod:
+    return make_float(rt, fmod(a, b));
+  case OLess:
+    return boolean(rt, a < b);
+  case OLessEqual:
+    return boolean(rt, a <= b);
+  case OGreater:
+    return boolean(rt, a > b);
+  case OGreaterEqual:
+    return boolean(rt, a >= b);
+  case OEqual:
+    return boolean(rt, a == b);
+  }
+  runtime_error(rt, "internal error: bad operation %d", primitive->op);
+}
+
+static Value prim_int_as_float(struct Runtime *rt,
+                               const struct Primitive *primitive,
+                               Value receiver, Value *args) {
+  (void)args;
+  int64_t i;
+  if (!int_of(rt, receiver, &i))
+    runtime_error(rt, "%s needs an integer", primitive->name);
+  return make_float(rt, (double)i);
+}
+
+// Truncates.
+static Value prim_float_as_int(struct Runtime *rt,
+                               const struct Primitive *primitive,
+                               Value receiver, Value *args) {
+  (void)args;
+  double d;
+  if (!float_of(rt, receiver, &d))
+    runtime_error(rt, "%s needs a float", primitive->name);
+  // Both bounds are powers of two, so they are exact as doubles.
+  if (!(d >= -0x1p63 && d < 0x1p63))
+    runtime_error(rt, "%s: %g is not a 64-bit integer", primitive->name, d);
+  return make_int(rt, (int64_t)d);
+}
+
+static const struct Primitive g_primitives[] = {
+    {"_AddSlots:", 1, prim_add_slots, 0},
+    {"_Clone", 0, prim_clone, 0},
+    {"_Eq:", 1, prim_eq, 0},
+
+    {"_IntAdd:", 1, prim_int, OAdd},
+    {"_IntSub:", 1, prim_int, OSub},
+    {"_IntMul:", 1, prim_int, OMul},
+    {"_IntDiv:", 1, prim_int, ODiv},
+    {"_IntMod:", 1, prim_int, OMod},
+    {"_IntLT:", 1, prim_int, OLess},
+    {"_IntLE:", 1, prim_int, OLessEqual},
+    {"_IntGT:", 1, prim_int, OGreater},
+    {"_IntGE:", 1, prim_int, OGreaterEqual},
+    {"_IntEQ:", 1, prim_int, OEqual},
+    {"_IntAsFloat", 0, prim_int_as_float, 0},
+
+    {"_FloatAdd:", 1, prim_float, OAdd},
+    {"_FloatSub:", 1, prim_float, OSub},
+    {"_FloatMul:", 1, prim_float, OMul},
+    {"_FloatDiv:", 1, prim_float, ODiv},
+    {"_FloatMod:", 1, prim_float, OMod},
+    {"_FloatLT:", 1, prim_float, OLess},
+    {"_FloatLE:", 1, prim_float, OLessEqual},
+    {"_FloatGT:", 1, prim_float, OGreater},
+    {"_FloatGE:", 1, prim_float, OGreaterEqual},
+    {"_FloatEQ:", 1, prim_float, OEqual},
+    {"_FloatAsInt", 0, prim_float_as_int, 0},
+};
+
+static bool add_constant(struct Object *object, const char *name, bool parent,
+                         struct Object *value) {
+  struct ObjectSlot slot = {.name = symbol_intern_string(name),
+                            .parent = parent,
+                            .value = value_from_object(value)};
+  return object_add_slot(object, slot);
+}
+
+// Gives every place an identifier other than self occurs in a send site, and
+// returns their caches, or NULL if allocating failed.
+static struct SendCache *number_ident_sites(struct Runtime *rt) {
+  const struct Ast *ast = rt->ast;
+  uint32_t places = slot_place(ast, ast->slot_count);
+  rt->ident_sites = malloc((places + 1) * sizeof(*rt->ident_sites));
+  if (!rt->ident_sites)
+    return NULL;
+
+  rt->ident_site_count = 0;
+  for (uint32_t place = 0; place < places; place++) {
+    ExprRef ref = place_ref(ast, place);
+    bool site = EXPR_TYPE(ref) == EIdent &&
+                ast_ident(ast, ref)->ident != rt->self_symbol;
+    rt->ident_sites[place] = site ? rt->ident_site_count++ : UINT32_MAX;
+  }
+  return calloc(rt->ident_site_count + 1, sizeof(struct SendCache));
+}
+
+bool runtime_init(struct Runtime *rt, const struct Ast *ast,
+                  struct Object *lobby, struct Object *nil) {
+  *rt = (struct Runtime){.ast = ast, .lobby = lobby, .nil = nil};
+  rt->true_object = object_create();
+  rt->false_object = object_create();
+  rt->integer_object = object_create();
+  rt->float_object = object_create();
+  rt->integer_box = object_create();
+  rt->float_box = object_create();
+  rt->self_symbol = symbol_intern_string("self");
+  // One more of each, so that none of them is empty.
+  rt->message_caches =
+      calloc(ast->message_count + 1, sizeof(*rt->message_caches));
+  rt->ident_caches = number_ident_sites(rt);
+  rt->literals = calloc(ast->object_count + 1, sizeof(*rt->literals));
+  rt->lookup_cache =
+      calloc(RUNTIME_LOOKUP_CACHE_SIZE, sizeof(*rt->lookup_cache));
+  rt->use_lookup_cache = true;
+  bool ok = rt->true_object && rt->false_object && rt->integer_object &&
+            rt->float_object && rt->integer_box && rt->float_box &&
+            rt->message_caches && rt->ident_sites && rt->ident_caches &&
+            rt->literals &&
+            rt->lookup_cache &&
+            hashtable_init(&rt->primitives, 0, hash_pointer,
+                           hash_pointer_equal);
+  if (ok && !hashtable_init(&rt->assignments, 0, hash_pointer,
+                            hash_pointer_equal)) {
+    hashtable_deinit(&rt->primitives);
+    ok = false;
+  }
+  if (!ok) {
+    free(rt->message_caches);
+    free(rt->ident_sites);
+    free(rt->ident_caches);
+    free(rt->literals);
+    free(rt->lookup_cache);
+    return false;
+  }
+
+  for (size_t i = 0; i < sizeof(g_primitives) / sizeof(*g_primitives); i++)
+    ok &= hashtable_set(&rt->primitives,
+                        (void *)symbol_intern_string(g_primitives[i].name),
+                        (void *)&g_primitives[i]);
+
+  struct {
+    const char *name;
+    struct Object *value;
+  } globals[] = {{"lobby", lobby},
+                 {"nil", nil},
+                 {"true", rt->true_object},
+                 {"false", rt->false_object},
+                 {"integer", rt->integer_object},
+                 {"float", rt->float_object}};
+  for (size_t i = 0; i < sizeof(globals) / sizeof(*globals); i++)
+    ok &= add_constant(lobby, globals[i].name, false, globals[i].value);
+
+  // Numbers see the globals, and boxes have the slots of their numbers.
+  ok &= add_constant(rt->integer_object, "parent", true, lobby);
+  ok &= add_constant(rt->float_object, "parent", true, lobby);
+  ok &= add_constant(rt->integer_box, "parent", true, rt->integer_object);
+  ok &= add_constant(rt->float_box, "parent", true, rt->float_object);
+
+  if (!ok)
+    runtime_deinit(rt);
+  return ok;
+}
+
+// Objects stay around until there is a garbage collector.
+void runtime_deinit(struct Runtime *rt) {
+  free(rt->message_caches);
+  free(rt->ident_sites);
+  free(rt->ident_caches);
+  free(rt->literals);
+  free(rt->lookup_cache);
+  hashtable_deinit(&rt->primitives);
+  hashtable_deinit(&rt->assignments);
+}
+
+Value execute(struct Runtime *rt, const struct Stmt *stmt, Value self) {
+  jmp_buf failure_jmp;
+  if (setjmp(failure_jmp)) {
+    rt->failure_jmp = NULL;
+    rt->depth = 0;
+    return 0;
+  }
+  rt->failure_jmp = &failure_jmp;
+
+  struct Frame frame = {.self = self};
+  Value result = eval_expr(rt, &frame, stmt->expr, stmt - rt->ast->stmts);
+  rt->failure_jmp = NULL;
+  return result;
+}
+
+Value runtime_send(struct Runtime *rt, struct SendCache *cache, Value receiver,
+                   const struct Symbol *selector, Value *args, int argc) {
+  return send(rt, cache, receiver, selector, args, argc);
+}
+
+static const char *const g_cache_states[] = {
+    [CEmpty] = "empty",
+    [CMonomorphic] = "monomorphic",
+    [CPolymorphic] = "polymorphic",
+    [CMegamorphic] = "megamorphic",
+};
+
+static void print_site(FILE *out, const char *kind, uint32_t index,
+                       const struct Symbol *selector,
+                       const struct SendCache *cache, uint64_t *hits,
+                       uint64_t *misses) {
+  uint64_t sends = cache->hits + cache->misses;
+  if (sends == 0)
+    return;
+
+  fprintf(out, "%s %-6" PRIu32 " %-24s %-12s %10" PRIu64 " hits %10" PRIu64
+               " misses %6.2f%%\n",
+          kind, index, selector->name, g_cache_states[cache->state],
+          cache->hits, cache->misses, 100.0 * cache->hits / sends);
+  *hits += cache->hits;
+  *misses += cache->misses;
+}
+
+void runtime_print_cache_stats(const struct Runtime *rt, FILE *out) {
+  uint64_t hits = 0, misses = 0;
+  for (uint32_t i = 0; i < rt->ast->message_count; i++)
+    print_site(out, "message", i, rt->ast->messages[i].message,
+               &rt->message_caches[i], &hits, &misses);
+  for (uint32_t place = 0; place < slot_place(rt->ast, rt->ast->slot_count);
+       place++) {
+    uint32_t site = rt->ident_sites[place];
+    if (site != UINT32_MAX)
+      print_site(out, "ident  ", site,
+                 ast_ident(rt->ast, place_ref(rt->ast, place))->ident,
+                 &rt->ident_caches[site], &hits, &misses);
+  }
+
+  uint64_t sends = hits + misses;
+  fprintf(out, "total: %" PRIu64 " sends, %" PRIu64 " hits, %" PRIu64
+               " misses, %.2f%% hit\n",
+          sends, hits, misses, sends ? 100.0 * hits / sends : 0.0);
+  fprintf(out, "lookup cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64
+               " flushed\n",
+          rt->lookup_hits, rt->lookup_misses, rt->lookup_flushes);
+}
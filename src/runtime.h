@@ -0,0 +1,159 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ast.h"
+#include "hash.h"
+#include "object.h"
+
+// A tree-walking evaluator for the statements of an AST.
+//
+// Every message send site has an inline cache of what the lookup found for
+// the maps of the receivers it has seen. It starts out empty, is monomorphic
+// once it has seen one map, polymorphic up to RUNTIME_CACHE_ENTRIES of them,
+// and megamorphic past that, when it stops caching and every send does a
+// full lookup. A lookup only depends on the map of the receiver, unless it
+// goes through a mutable parent slot of the receiver itself, and those
+// lookups aren't cached.
+//
+// Each entry remembers the epoch it was made in. Adding or changing slots,
+// or assigning a parent slot, can change what any lookup finds, so it starts
+// a new epoch, and entries from an older one count as empty.
+
+// Numbers are values rather than objects, see value.h, but they have slots
+// all the same: SmallIntegers have the slots of an object the lobby calls
+// integer, and SmallFloats those of one it calls float. Lookups for them
+// start there, and are cached by the map of that object. Boxed numbers
+// inherit from the same objects.
+
+// Inline cache misses, and every send from a megamorphic site, go to the
+// lookup cache next: a set-associative table of lookup results shared by the
+// whole runtime, keyed by receiver map and selector. Its entries aren't
+// dropped all at once when a new epoch starts. Each one remembers which
+// objects its lookup searched, in a 64-bit Bloom filter, and a change to an
+// object only flushes the entries which searched it: changing a slot flushes
+// the lookups of its name, and changing a parent slot flushes them all.
+
+#define RUNTIME_CACHE_ENTRIES 4
+// Both powers of two.
+#define RUNTIME_LOOKUP_CACHE_SIZE 1024
+#define RUNTIME_LOOKUP_CACHE_WAYS 2
+// How deep expressions may nest while they are evaluated, method activations
+// included.
+#define RUNTIME_MAX_DEPTH 10000
+
+enum CacheState {
+  CEmpty,       // Nothing has been sent from the site yet
+  CMonomorphic, // One map seen
+  CPolymorphic, // Up to RUNTIME_CACHE_ENTRIES maps seen
+  CMegamorphic, // More than that, so the site doesn't cache anymore
+};
+
+struct SendCacheEntry {
+  const struct ObjectMap *map;
+  // The object the slot was found in, or NULL if it's the receiver.
+  struct Object *holder;
+  int index;
+  // Whether the message assigns the mutable slot, rather than reading or
+  // activating it.
+  bool assignment;
+  uint32_t epoch;
+};
+
+struct LookupCacheEntry {
+  // NULL if the entry is empty.
+  const struct Symbol *selector;
+  // The name of the slot, which is not the selector for assignments.
+  const struct Symbol *name;
+  // The objects the lookup searched, one bit each.
+  uint64_t searched;
+  // The epoch isn't used.
+  struct SendCacheEntry result;
+};
+
+struct Primitive;
+
+struct SendCache {
+  enum CacheState state;
+  int length;
+  struct SendCacheEntry entries[RUNTIME_CACHE_ENTRIES];
+  // Set instead for sends of primitives, which don't depend on the receiver.
+  const struct Primitive *primitive;
+
+  uint64_t hits;
+  uint64_t misses;
+};
+
+struct Runtime {
+  const struct Ast *ast;
+  struct Object *lobby;
+  struct Object *nil;
+  struct Object *true_object;
+  struct Object *false_object;
+  // Where the slots of numbers are, and the prototypes of their boxes.
+  struct Object *integer_object;
+  struct Object *float_object;
+  struct Object *integer_box;
+  struct Object *float_box;
+
+  // The caches of message expressions, by index, and of identifiers, which
+  // are sends of unary messages to self, by site. An identifier's node is
+  // shared by every place the name occurs in, so each of those places gets a
+  // site of its own: ident_sites has the site of every place an expression
+  // can be in, or UINT32_MAX where there's no identifier.
+  struct SendCache *message_caches;
+  struct SendCache *ident_caches;
+  uint32_t *ident_sites;
+  uint32_t ident_site_count;
+  uint32_t epoch;
+
+  struct LookupCacheEntry *lookup_cache;
+  // Turning this off sends every inline cache miss to a full lookup.
+  bool use_lookup_cache;
+  uint64_t lookup_hits;
+  uint64_t lookup_misses;
+  uint64_t lookup_flushes;
+
+  // The object each object literal evaluated to, by index, or NULL. Literals
+  // are only evaluated once: data objects are the same object every time,
+  // and objects with code become methods.
+  struct Object **literals;
+
+  // Primitives by name, and unary names by the selector which assigns them.
+  struct HashTable primitives;
+  struct HashTable assignments;
+
+  const struct Symbol *self_symbol;
+  int depth;
+
+  // Runtime errors are reported to stderr and unwind to here, which abandons
+  // the statement being executed.
+  jmp_buf *failure_jmp;
+};
+
+// The lobby gets constant slots for itself, nil, true, false, integer and
+// float. Returns false if allocating failed.
+bool runtime_init(struct Runtime *rt, const struct Ast *ast,
+                  struct Object *lobby, struct Object *nil);
+void runtime_deinit(struct Runtime *rt);
+
+// Evaluates the statement, which is one of the AST's, with self as the
+// receiver. Returns its value, or 0, which is no value, if it failed, after
+// reporting why.
+Value execute(struct Runtime *rt, const struct Stmt *stmt, Value self);
+
+// Sends a message from C, through the inline cache of a send site the caller
+// keeps, zeroed before its first use. Runtime errors exit the process unless
+// this is called while a statement is executing.
+Value runtime_send(struct Runtime *rt, struct SendCache *cache, Value receiver,
+                   const struct Symbol *selector, Value *args, int argc);
+
+// Prints the hits and misses of every send site which was used, the totals,
+// and how the lookup cache did.
+void runtime_print_cache_stats(const struct Runtime *rt, FILE *out);
+
+#endif /* RUNTIME_H */
@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "scan.h"
+
+const unsigned char g_char_class[256] = {
+    [' '] = CWhitespace,
+    ['\t'] = CWhitespace,
+    ['\n'] = CWhitespace,
+    ['_'] = CIdent,
+    ['a' ... 'z'] = CIdent,
+    ['A' ... 'Z'] = CIdent,
+    ['0' ... '9'] = CIdent | CDigit,
+};
+
+// Scalar kernels
+
+static const char *whitespace_scalar(const char *p) {
+  while (scan_is_whitespace(*p))
+    p++;
+  return p;
+}
+
+static const char *comment_scalar(const char *p) {
+  while (*p != '"' && *p != '\0')
+    p++;
+  return p;
+}
+
+static const char *ident_scalar(const char *p) {
+  while (scan_is_ident(*p))
+    p++;
+  return p;
+}
+
+static const char *digits_scalar(const char *p) {
+  while (scan_is_digit(*p))
+    p++;
+  return p;
+}
+
+static long newlines_scalar(const char *p, const char *end,
+                            const char **last) {
+  long count = 0;
+  for (; p < end; p++) {
+    if (*p == '\n') {
+      count++;
+      *last = p;
+    }
+  }
+  return count;
+}
+
+static const struct ScanKernels scan_scalar = {
+    "scalar",      whitespace_scalar, comment_scalar,
+    ident_scalar,  digits_scalar,     newlines_scalar,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+// SSE2 kernels
+//
+// There are no unsigned byte comparisons, so ranges are checked by shifting
+// lo to -128 and doing a signed comparison against -128 + the range size.
+
+SSE2 static inline __m128i in_range_sse2(__m128i x, char lo, char hi) {
+  __m128i shifted = _mm_add_epi8(x, _mm_set1_epi8((char)(0x80 - lo)));
+  return _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(-128 + hi - lo + 1)));
+}
+
+SSE2 static inline __m128i ident_mask_sse2(__m128i x) {
+  // Setting 0x20 folds upper case letters into lower case ones.
+  __m128i letter =
+      in_range_sse2(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z');
+  __m128i digit = in_range_sse2(x, '0', '9');
+  __m128i underscore = _mm_cmpeq_epi8(x, _mm_set1_epi8('_'));
+  return _mm_or_si128(_mm_or_si128(letter, digit), underscore);
+}
+
+SSE2 static const char *whitespace_sse2(const char *p) {
+  for (;; p += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+    __m128i ws = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                     _mm_cmpeq_epi8(x, _mm_set1_epi8('\t'))),
+        _mm_cmpeq_epi8(x, _mm_set1_epi8('\n')));
+
+    unsigned mask = ~_mm_movemask_epi8(ws) & 0xffff;
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+}
+
+SSE2 static const char *comment_sse2(const char *p) {
+  for (;; p += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+    __m128i end = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')),
+                               _mm_cmpeq_epi8(x, _mm_setzero_si128()));
+
+    unsigned mask = _mm_movemask_epi8(end);
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+}
+
+SSE2 static const char *ident_sse2(const char *p) {
+  for (;; p += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+
+    unsigned mask = ~_mm_movemask_epi8(ident_mask_sse2(x)) & 0xffff;
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+}
+
+SSE2 static const char *digits_sse2(const char *p) {
+  for (;; p += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+
+    unsigned mask = ~_mm_movemask_epi8(in_range_sse2(x, '0', '9')) & 0xffff;
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+}
+
+SSE2 static long newlines_sse2(const char *p, const char *end,
+                               const char **last) {
+  long count = 0;
+  for (; p < end; p += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')));
+    if (end - p < 16)
+      mask &= (1u << (end - p)) - 1;
+
+    if (mask) {
+      count += __builtin_popcount(mask);
+      *last = p + 31 - __builtin_clz(mask);
+    }
+  }
+  return count;
+}
+
+static const struct ScanKernels scan_sse2 = {
+    "sse2",     whitespace_sse2, comment_sse2,
+    ident_sse2, digits_sse2,     newlines_sse2,
+};
+
+// AVX2 kernels
+//
+// Same as above, but AVX2 only has a greater-than comparison.
+
+AVX2 static inline __m256i in_range_avx2(__m256i x, char lo, char hi) {
+  __m256i shifted = _mm256_add_epi8(x, _mm256_set1_epi8((char)(0x80 - lo)));
+  return _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + hi - lo + 1)),
+                           shifted);
+}
+
+AVX2 static inline __m256i ident_mask_avx2(__m256i x) {
+  __m256i letter =
+      in_range_avx2(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 'z');
+  __m256i digit = in_range_avx2(x, '0', '9');
+  __m256i underscore = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_'));
+  return _mm256_or_si256(_mm256_or_si256(letter, digit), underscore);
+}
+
+AVX2 static const char *whitespace_avx2(const char *p) {
+  for (;; p += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)p);
+    __m256i ws = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t'))),
+        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')));
+
+    unsigned mask = ~(unsigned)_mm256_movemask_epi8(ws);
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+}
+
+AVX2 static const char *comment_avx2(const char *p) {
+  for (;; p += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)p);
+    __m256i end = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')),
+                                  _mm256_cmpeq_epi8(x, _mm256_setzero_si256()));
+
+    unsigned mask = _mm256_movemask_epi8(end);
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+}
+
+AVX2 static const char *ident_avx2(const char *p) {
+  for (;; p += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)p);
+
+    unsigned mask = ~(unsigned)_mm256_movemask_epi8(ident_mask_avx2(x));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+}
+
+AVX2 static const char *digits_avx2(const char *p) {
+  for (;; p += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)p);
+
+    unsigned mask =
+        ~(unsigned)_mm256_movemask_epi8(in_range_avx2(x, '0', '9'));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+}
+
+AVX2 static long newlines_avx2(const char *p, const char *end,
+                               const char **last) {
+  long count = 0;
+  for (; p < end; p += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)p);
+    unsigned mask =
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')));
+    if (end - p < 32)
+      mask &= (1u << (end - p)) - 1;
+
+    if (mask) {
+      count += __builtin_popcount(mask);
+      *last = p + 31 - __builtin_clz(mask);
+    }
+  }
+  return count;
+}
+
+static const struct ScanKernels scan_avx2 = {
+    "avx2",     whitespace_avx2, comment_avx2,
+    ident_avx2, digits_avx2,     newlines_avx2,
+};
+#endif
+
+struct ScanKernels g_scan;
+
+__attribute__((constructor)) static void scan_select(void) {
+  const char *forced = getenv("MYSELF_SCAN");
+  g_scan = scan_scalar;
+
+  if (forced && strcmp(forced, "scalar") == 0)
+    return;
+
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("sse2"))
+    g_scan = scan_sse2;
+
+  if (forced && strcmp(forced, "sse2") == 0)
+    return;
+
+  if (__builtin_cpu_supports("avx2"))
+    g_scan = scan_avx2;
+#endif
+}
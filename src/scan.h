@@ -0,0 +1,103 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdbool.h>
+
+// Character scanning kernels for the lexer. Each kernel has a scalar version
+// and SSE2/AVX2 versions which look at 16 or 32 bytes at a time; the best
+// one supported by the CPU is picked at startup. Setting MYSELF_SCAN to
+// "scalar", "sse2" or "avx2" forces a particular implementation.
+//
+// The kernels may read up to 32 bytes past the position where they stop, so
+// the input must be followed by at least that many readable bytes (see
+// LEXER_PADDING). A NUL byte stops every scan.
+
+struct ScanKernels {
+  const char *name;
+
+  // Returns the first character that isn't a space, tab or newline.
+  const char *(*whitespace)(const char *p);
+  // Returns the first double quote or NUL.
+  const char *(*comment)(const char *p);
+  // Returns the first character that can't continue an identifier.
+  const char *(*ident)(const char *p);
+  // Returns the first character that isn't a decimal digit.
+  const char *(*digits)(const char *p);
+  // Counts the newlines in [p, end). If there are any, *last is set to the
+  // last one.
+  long (*newlines)(const char *p, const char *end, const char **last);
+};
+
+extern struct ScanKernels g_scan;
+
+// Most runs are short (a single space between tokens, a short identifier),
+// and for those the call into a kernel costs more than it saves. The
+// wrappers below look at the first SCAN_PREFIX bytes themselves and only
+// hand longer runs to the kernels.
+#define SCAN_PREFIX 4
+
+// Character classes, so that classifying a byte is a single table lookup.
+enum CharClass {
+  CWhitespace = 1 << 0, // space, tab, newline
+  CIdent = 1 << 1,      // letters, digits and underscore
+  CDigit = 1 << 2,      // decimal digits
+};
+
+extern const unsigned char g_char_class[256];
+
+static inline bool scan_is_whitespace(char c) {
+  return g_char_class[(unsigned char)c] & CWhitespace;
+}
+
+static inline bool scan_is_ident(char c) {
+  return g_char_class[(unsigned char)c] & CIdent;
+}
+
+static inline bool scan_is_digit(char c) {
+  return g_char_class[(unsigned char)c] & CDigit;
+}
+
+static inline const char *scan_whitespace(const char *p) {
+  for (int i = 0; i < SCAN_PREFIX; i++, p++) {
+    if (!scan_is_whitespace(*p))
+      return p;
+  }
+  return g_scan.whitespace(p);
+}
+
+static inline const char *scan_comment(const char *p) {
+  return g_scan.comment(p);
+}
+
+static inline const char *scan_ident(const char *p) {
+  for (int i = 0; i < SCAN_PREFIX; i++, p++) {
+    if (!scan_is_ident(*p))
+      return p;
+  }
+  return g_scan.ident(p);
+}
+
+static inline const char *scan_digits(const char *p) {
+  for (int i = 0; i < SCAN_PREFIX; i++, p++) {
+    if (!scan_is_digit(*p))
+      return p;
+  }
+  return g_scan.digits(p);
+}
+
+static inline long scan_newlines(const char *p, const char *end,
+                                 const char **last) {
+  if (end - p > SCAN_PREFIX)
+    return g_scan.newlines(p, end, last);
+
+  long count = 0;
+  for (; p < end; p++) {
+    if (*p == '\n') {
+      count++;
+      *last = p;
+    }
+  }
+  return count;
+}
+
+#endif /* SCAN_H */
@@ -1,226 +1,58 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-#include "failure.h"
+#include "ast.h"
+#include "dump.h"
 #include "lexer.h"
+#include "loader.h"
 #include "object.h"
 #include "parser.h"
 #include "runtime.h"
+#include "symbol.h"
 
-int indent = 0;
-#define PRINT_INDENT()                                                         \
-  for (int iii = 0; iii < indent; iii++)                                       \
-  putchar(' ')
-
-void print_ast(struct StmtList *ast);
-
-void print_expr(struct Expr expr) {
-  printf("Expr {\n");
-  indent += 2;
-  PRINT_INDENT();
-  printf("type = ");
-
-  switch (expr.type) {
-  case EIdent:
-    printf("EIdent,\n");
-    PRINT_INDENT();
-    printf("ident = IdentExpr {\n");
-    indent += 2;
-
-    PRINT_INDENT();
-    printf("ident = \"%s\"\n", expr.ident->ident);
-
-    indent -= 2;
-    PRINT_INDENT();
-    printf("}\n");
-    break;
-  case EMessage:
-    printf("EMessage,\n");
-    PRINT_INDENT();
-    printf("message = MessageExpr {\n");
-    indent += 2;
-
-    PRINT_INDENT();
-    printf("receiver = ");
-    print_expr(expr.message->receiver);
-    printf(",\n");
-    PRINT_INDENT();
-    printf("message = \"%s\",\n", expr.message->message);
-    PRINT_INDENT();
-    printf("length = %d,\n", expr.message->length);
-    PRINT_INDENT();
-    printf("args = [\n");
-
-    indent += 2;
-    for (int i = 0; i < expr.message->length; i++) {
-      PRINT_INDENT();
-      print_expr(expr.message->args[i]);
-      printf(",\n");
-    }
-    indent -= 2;
-    PRINT_INDENT();
-    printf("]\n");
-
-    indent -= 2;
-    PRINT_INDENT();
-    printf("}\n");
-    break;
-  case ENumber:
-    printf("ENumber,\n");
-    PRINT_INDENT();
-    printf("number = NumberExpr {\n");
-    indent += 2;
-
-    PRINT_INDENT();
-    printf("type = %s,\n",
-           expr.number->type == NInteger ? "NInteger" : "NFloat");
-    PRINT_INDENT();
-    if (expr.number->type == NInteger) {
-      printf("integer = %ld\n", expr.number->integer);
-    } else {
-      printf("flt = %lf\n", expr.number->flt);
-    }
-
-    indent -= 2;
-    PRINT_INDENT();
-    printf("}\n");
-    break;
-  case EObject:
-    printf("EObject,\n");
-    PRINT_INDENT();
-    printf("object = ObjectExpr {\n");
-    indent += 2;
-
-    PRINT_INDENT();
-    printf("slots = SlotList {\n");
-    indent += 2;
-
-    PRINT_INDENT();
-    printf("length = %d,\n", expr.object->slots.length);
-    PRINT_INDENT();
-    printf("slots = [\n");
-    indent += 2;
-
-    for (int i = 0; i < expr.object->slots.length; i++) {
-      PRINT_INDENT();
-      printf("Slot {\n");
-      indent += 2;
-
-      PRINT_INDENT();
-      printf("parent = %d,\n", expr.object->slots.slots[i].parent);
-      PRINT_INDENT();
-      printf("mutable = %d,\n", expr.object->slots.slots[i].mutable);
-      PRINT_INDENT();
-      printf("arg_index = %d,\n", expr.object->slots.slots[i].arg_index);
-      PRINT_INDENT();
-      printf("name = \"%s\",\n", expr.object->slots.slots[i].name);
-      PRINT_INDENT();
-      printf("annotations = Annotation {\n");
-      indent += 2;
-
-      PRINT_INDENT();
-      printf("module = %s,\n", expr.object->slots.slots[i].annotation.module);
-      PRINT_INDENT();
-      printf("category = %s,\n",
-             expr.object->slots.slots[i].annotation.category);
-      PRINT_INDENT();
-      printf("comment = %s\n", expr.object->slots.slots[i].annotation.comment);
-
-      indent -= 2;
-      PRINT_INDENT();
-      printf("},\n");
-      PRINT_INDENT();
-      printf("value = ");
-      print_expr(expr.object->slots.slots[i].value);
-      putchar('\n');
-
-      indent -= 2;
-      PRINT_INDENT();
-      printf("},\n");
-    }
-
-    indent -= 2;
-    PRINT_INDENT();
-    printf("]\n");
-    indent -= 2;
-    PRINT_INDENT();
-    printf("},\n");
-    PRINT_INDENT();
-    printf("annotations = Annotation {\n");
-    indent += 2;
-
-    PRINT_INDENT();
-    printf("module = %s,\n", expr.object->annotation.module);
-    PRINT_INDENT();
-    printf("category = %s,\n", expr.object->annotation.category);
-    PRINT_INDENT();
-    printf("comment = %s\n", expr.object->annotation.comment);
-
-    indent -= 2;
-    PRINT_INDENT();
-    printf("},\n");
-    PRINT_INDENT();
-    printf("stmts = ");
-    print_ast(&expr.object->stmts);
-
-    indent -= 2;
-    PRINT_INDENT();
-    printf("}\n");
-    break;
-  case ENone:
-    failure("ENone reached");
-  case EBinary:
-    failure("TODO EBinary");
+int main(int argc, char **argv) {
+  // By default, parse with one worker per core.
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  enum DumpFormat format = DHuman;
+  bool usage = false;
+  int first_path = 1;
+  while (first_path + 1 < argc && !usage) {
+    if (strcmp(argv[first_path], "-j") == 0)
+      threads = atoi(argv[first_path + 1]);
+    else if (strcmp(argv[first_path], "-d") == 0)
+      usage = !dump_format_parse(argv[first_path + 1], &format);
+    else
+      break;
+    first_path += 2;
   }
 
-  indent -= 2;
-  PRINT_INDENT();
-  printf("}");
-}
-
-void print_ast(struct StmtList *ast) {
-  printf("StmtList {\n");
-  indent += 2;
-  PRINT_INDENT();
-  printf("length = %d,\n", ast->length);
-  PRINT_INDENT();
-  printf("stmts = [\n");
-  indent += 2;
+  // Keep machine-readable dumps clean.
+  fputs("mySelf, v0.10\n", format == DHuman ? stdout : stderr);
 
-  for (int i = 0; i < ast->length; i++) {
-    PRINT_INDENT();
-    printf("Stmt {\n");
-    indent += 2;
-
-    PRINT_INDENT();
-    print_expr(ast->stmts[i].expr);
-    putchar('\n');
-
-    indent -= 2;
-    PRINT_INDENT();
-    printf("}%s\n", i == ast->length - 1 ? "" : ",");
+  if (usage || first_path >= argc || threads < 1) {
+    puts("Usage: ./mySelf [-j threads] [-d human|json|binary] "
+         "[world script or directory]...");
+    return 1;
   }
 
-  indent -= 2;
-  PRINT_INDENT();
-  printf("]\n");
-  indent -= 2;
-  PRINT_INDENT();
-  printf("}\n");
-}
-
-int main(int argc, char **argv) {
-  puts("mySelf, v0.10");
+  symbol_table_init();
 
-  if (argc != 2) {
-    puts("Usage: ./mySelf [world script]");
+  struct Ast ast;
+  if (loader_load((const char **)argv + first_path, argc - first_path,
+                  threads, &ast) > 0) {
+    ast_deinit(&ast);
     return 1;
   }
 
-  const char *fname = argv[1];
-  lexer_init(&g_lexer, fname);
-
-  struct StmtList ast = parse_stmt_list(stmt_list_eof);
-  print_ast(&ast);
+  // The dump bypasses stdio, so the banner has to go out first.
+  fflush(stdout);
+  if (!dump_ast(STDOUT_FILENO, format, &ast, ast.root)) {
+    perror("mySelf: dump");
+    ast_deinit(&ast);
+    return 1;
+  }
 
   // The root object which will be populated by the world script.
   struct Object *lobby = object_create();
@@ -228,9 +60,25 @@ int main(int argc, char **argv) {
   // implicitly return a nil if they get activated.
   struct Object *nil = object_create();
 
-  for (int i = 0; i < ast.length; i++) {
-    execute(&ast.stmts[i], lobby);
+  struct Runtime runtime;
+  if (!lobby || !nil || !runtime_init(&runtime, &ast, lobby, nil)) {
+    fputs("mySelf: out of memory\n", stderr);
+    ast_deinit(&ast);
+    return 1;
+  }
+
+  int failed = 0;
+  for (uint32_t i = 0; i < ast.root.length; i++) {
+    if (!execute(&runtime, &ast.stmts[ast.root.start + i],
+                 value_from_object(lobby)))
+      failed++;
   }
 
-  return 0;
+  // Setting MYSELF_STATS prints how well the send caches did.
+  if (getenv("MYSELF_STATS"))
+    runtime_print_cache_stats(&runtime, stderr);
+
+  runtime_deinit(&runtime);
+  ast_deinit(&ast);
+  return failed > 0;
 }
@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "chash.h"
+#include "symbol.h"
+
+#define SYMBOL_TABLE_CAPACITY (HASHTABLE_DEFAULT_CAPACITY * 64)
+
+// The key used to look up symbols in the table. Every symbol is allocated
+// right behind the key the table keeps for it.
+struct SymbolKey {
+  const char *data;
+  int length;
+};
+
+// Parsers on different threads intern into the same table. Looking up
+// symbols which are already there, which is most of the time, takes no locks.
+static struct CHashTable g_symbols;
+
+static uint64_t symbol_key_hash(void *_key) {
+  struct SymbolKey *key = _key;
+  return hash_bytes(key->data, key->length);
+}
+
+static bool symbol_key_equal(void *_key, void *_entry_key) {
+  struct SymbolKey *key = _key, *entry_key = _entry_key;
+  return key->length == entry_key->length &&
+         memcmp(key->data, entry_key->data, key->length) == 0;
+}
+
+void symbol_table_init(void) {
+  chash_init(&g_symbols, SYMBOL_TABLE_CAPACITY, symbol_key_hash,
+             symbol_key_equal);
+}
+
+const struct Symbol *symbol_intern(const char *data, int length) {
+  struct SymbolKey key = {data, length};
+
+  struct Symbol *symbol = chash_get(&g_symbols, &key);
+  if (symbol)
+    return symbol;
+
+  struct SymbolKey *entry_key =
+      malloc(sizeof(*entry_key) + sizeof(*symbol) + length + 1);
+  symbol = (struct Symbol *)(entry_key + 1);
+  symbol->hash = symbol_key_hash(&key);
+  symbol->length = length;
+  memcpy(symbol->name, data, length);
+  symbol->name[length] = '\0';
+
+  entry_key->data = symbol->name;
+  entry_key->length = length;
+  // Another thread may have added it in the meantime.
+  struct Symbol *added = chash_add(&g_symbols, entry_key, symbol);
+  if (added != symbol)
+    free(entry_key);
+  return added;
+}
+
+const struct Symbol *symbol_intern_string(const char *string) {
+  return symbol_intern(string, strlen(string));
+}
@@ -0,0 +1,27 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include <stdint.h>
+
+// An interned string. Every distinct name exists exactly once in the symbol
+// table, so two symbols are equal if and only if their pointers are equal.
+// Identifiers, selectors, slot names and annotations all point into it.
+struct Symbol {
+  // Precomputed with hash_bytes.
+  uint64_t hash;
+
+  int length;
+  char name[]; // NUL-terminated.
+};
+
+void symbol_table_init(void);
+
+const struct Symbol *symbol_intern(const char *data, int length);
+const struct Symbol *symbol_intern_string(const char *string);
+
+// Returns the name of a possibly NULL symbol, for printing.
+static inline const char *symbol_name(const struct Symbol *symbol) {
+  return symbol ? symbol->name : "(null)";
+}
+
+#endif /* SYMBOL_H */
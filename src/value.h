@@ -0,0 +1,95 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+struct Object;
+
+// What slots hold and expressions evaluate to: a pointer to an object, or a
+// number stored in the value itself, told apart by the low bits.
+//
+//   ...iiii1  SmallInteger, a 63-bit integer shifted up by one
+//   ...ff010  SmallFloat, a double with a short exponent, see below
+//   ...pp000  Object, which malloc aligns to 8 bytes
+//
+// Arithmetic on SmallIntegers and SmallFloats doesn't allocate. Numbers which
+// don't fit go in boxes, which are objects.
+typedef uint64_t Value;
+
+_Static_assert(sizeof(void *) == sizeof(Value), "values hold pointers");
+
+#define VALUE_INT_TAG 1
+#define VALUE_FLOAT_TAG 2
+#define VALUE_TAG_MASK 7
+
+#define VALUE_INT_MIN (-(INT64_C(1) << 62))
+#define VALUE_INT_MAX ((INT64_C(1) << 62) - 1)
+
+static inline bool value_is_int(Value value) { return value & VALUE_INT_TAG; }
+
+static inline bool value_is_float(Value value) {
+  return (value & VALUE_TAG_MASK) == VALUE_FLOAT_TAG;
+}
+
+static inline bool value_is_object(Value value) {
+  return (value & VALUE_TAG_MASK) == 0;
+}
+
+static inline struct Object *value_object(Value value) {
+  return (struct Object *)(uintptr_t)value;
+}
+
+static inline Value value_from_object(const struct Object *object) {
+  return (uintptr_t)object;
+}
+
+static inline bool value_int_fits(int64_t i) {
+  return i >= VALUE_INT_MIN && i <= VALUE_INT_MAX;
+}
+
+static inline int64_t value_int(Value value) { return (int64_t)value >> 1; }
+
+// Only for integers which fit.
+static inline Value value_from_int(int64_t i) {
+  return (uint64_t)i << 1 | VALUE_INT_TAG;
+}
+
+// SmallFloats are the doubles with the exponents of floats, from 2^-126 to
+// 2^128, and zeros. The sign bit is rotated down to bit 0, and the 11-bit
+// exponent rebased by VALUE_FLOAT_EXPONENT_OFFSET, which leaves the top three
+// bits clear for the tag to be shifted in at the bottom. Other doubles,
+// subnormals, infinities and NaNs included, don't fit.
+#define VALUE_FLOAT_EXPONENT_OFFSET 896
+#define VALUE_FLOAT_REBASE ((uint64_t)VALUE_FLOAT_EXPONENT_OFFSET << 53)
+
+// Returns false if the double doesn't fit.
+static inline bool value_from_float(double d, Value *value) {
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  uint64_t rotated = bits << 1 | bits >> 63;
+
+  if (rotated > 1) {
+    uint64_t exponent = rotated >> 53;
+    if (exponent <= VALUE_FLOAT_EXPONENT_OFFSET ||
+        exponent > VALUE_FLOAT_EXPONENT_OFFSET + 255)
+      return false;
+    rotated -= VALUE_FLOAT_REBASE;
+  }
+  *value = rotated << 3 | VALUE_FLOAT_TAG;
+  return true;
+}
+
+static inline double value_float(Value value) {
+  uint64_t rotated = value >> 3;
+  if (rotated > 1)
+    rotated += VALUE_FLOAT_REBASE;
+  uint64_t bits = rotated >> 1 | rotated << 63;
+
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+#endif /* VALUE_H */
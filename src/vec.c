@@ -0,0 +1,32 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "vec.h"
+
+void *vec_grow(void *data, void *inline_data, int *capacity, int needed,
+               size_t size) {
+  int new_capacity = *capacity ? *capacity * 2 : 8;
+  while (new_capacity < needed)
+    new_capacity *= 2;
+
+  void *new_data;
+  if (data == inline_data) {
+    // Moving out of the inline buffer.
+    new_data = malloc(new_capacity * size);
+    if (new_data)
+      memcpy(new_data, data, *capacity * size);
+  } else {
+    new_data = realloc(data, new_capacity * size);
+  }
+
+  if (!new_data)
+    abort();
+
+  *capacity = new_capacity;
+  return new_data;
+}
+
+void vec_free(void *data, void *inline_data) {
+  if (data != inline_data)
+    free(data);
+}
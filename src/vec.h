@@ -0,0 +1,57 @@
+#ifndef VEC_H
+#define VEC_H
+
+#include <stddef.h>
+#include <string.h>
+
+// A growable array of type, declared as VEC(type, n). The first n elements
+// are stored inline, so short lists don't allocate at all; longer ones move
+// to the heap and double their capacity whenever they fill up.
+//
+// While a vector is inline, data points into the vector itself, so a vector
+// must not be copied or moved once initialized. Pass it around by pointer.
+#define VEC(type, n)                                                          \
+  struct {                                                                    \
+    type *data;                                                               \
+    int length;                                                               \
+    int capacity;                                                             \
+    type inline_data[n];                                                      \
+  }
+
+#define vec_init(v)                                                           \
+  ((v)->data = (v)->inline_data, (v)->length = 0,                             \
+   (v)->capacity = sizeof((v)->inline_data) / sizeof(*(v)->data))
+
+#define vec_deinit(v) vec_free((v)->data, (v)->inline_data)
+
+// Makes room for extra more elements.
+#define vec_reserve(v, extra)                                                 \
+  ((v)->length + (extra) > (v)->capacity                                      \
+       ? (void)((v)->data =                                                   \
+                    vec_grow((v)->data, (v)->inline_data, &(v)->capacity,     \
+                             (v)->length + (extra), sizeof(*(v)->data)))      \
+       : (void)0)
+
+// The value is computed before anything else, since it may push onto the
+// same vector.
+#define vec_push(v, value)                                                    \
+  do {                                                                        \
+    __typeof__(*(v)->data) vec_pushed = (value);                              \
+    vec_reserve(v, 1);                                                        \
+    (v)->data[(v)->length++] = vec_pushed;                                    \
+  } while (0)
+
+#define vec_append(v, items, count)                                           \
+  do {                                                                        \
+    vec_reserve(v, count);                                                    \
+    memcpy((v)->data + (v)->length, (items), (count) * sizeof(*(v)->data));   \
+    (v)->length += (count);                                                   \
+  } while (0)
+
+#define vec_last(v) ((v)->data[(v)->length - 1])
+
+void *vec_grow(void *data, void *inline_data, int *capacity, int needed,
+               size_t size);
+void vec_free(void *data, void *inline_data);
+
+#endif /* VEC_H */